@@ -262,8 +262,9 @@ INT32 tcps_demo_eventlistener(INT8 cbhandle, UINT8 event, UINT32 par1, UINT32 pa
 		 * Note that THE SAME DATA must be sent over and over again
 		 * until TCP_EVENT_ACK is generated (for that data)! 
 		 * Parameters:
-		 *  - par1 - amount of data to regenerate (usually all)
-		 *	- par2 = 0
+		 *  - par1 - amount of data to regenerate now, starting from the
+		 *	  oldest unacknowledged byte
+		 *	- par2 - total amount of unacknowledged data
 		 */
 		case TCP_EVENT_REGENERATE:
 			tcps_demo_send();
@@ -72,6 +72,7 @@
 #include <inet/datatypes.h>
 #include <inet/system.h>
 #include <inet/ethernet.h>
+#include <inet/timers.h>
 
 
 #include <inet/arch/config.h>
@@ -81,6 +82,9 @@ UINT8 	NE2000CurrPktPtr;			/**< Start address of current packet in the Ethernet
 
 UINT8 	EtherSleep = 0;	/**< Used for storing state of Ethernet controller (0 = awake; 1 = sleeping) */
 
+UINT8*	NE2000RxMemBuf = 0;			/**< Memory read instead of the Ethernet controller (see NE2000ReceiveMemory()) */
+UINT8*	NE2000RxMemPtr;				/**< Next byte to read from NE2000RxMemBuf */
+
 /** \brief Used for storing various information about the received Ethernet frame
  *	
  *	Fields from Ethernet packet (dest/source hardware address, 
@@ -227,6 +231,9 @@ UINT8 inNE2000again (void)
 {
  	UINT8 temp;
  	
+ 	if(NE2000RxMemBuf)
+ 		return(*NE2000RxMemPtr++);
+ 	
  	/* Wait until bus free */
 
  	IOR = 0; 	
@@ -251,6 +258,13 @@ UINT8 inNE2000again (void)
  */
 void inNE2000againbuf (UINT8* buf, UINT16 len)
 {
+	if(NE2000RxMemBuf) {
+		while(len--)
+			*buf++ = *NE2000RxMemPtr++;
+		
+		return;
+	}
+	
 	while(len--)
 	{
 		IOR = 0;
@@ -489,6 +503,8 @@ UINT8 NE2000ReceiveFrame (void)
  	
  	/* There is data, receive Ethernet info */
  	
+ 	received_frame.rx_time = clock_us();		/* Timestamp it	*/
+ 	
  	NE2000CurrPktPtr = inNE2000(BOUNDARY);	/* Store pointer */
  	outNE2000( CR, 0x22 );					/* page0, abort DMA */
  	
@@ -669,6 +685,11 @@ void NE2000DMAInit_position (UINT16 pos)
  	UINT16 page;
  	UINT8 offset;
  	
+ 	if(NE2000RxMemBuf) {
+ 		NE2000RxMemPtr = NE2000RxMemBuf + pos;
+ 		return;
+ 	}
+ 	
  	/* Calculate start page	*/
  	
 	abspos = pos + 4;
@@ -709,6 +730,50 @@ void NE2000DMAInit_position (UINT16 pos)
 
 
 
+/** \brief Read received data from memory instead of NE2000
+ *	\date 19.10.2026
+ *	\param buf pointer to memory or 0 to read from NE2000 again
+ *
+ *	Invoke this function (through NETWORK_RECEIVE_MEMORY() macro) to
+ *	make inNE2000again(), inNE2000againbuf() and NE2000DMAInit_position()
+ *	work on a buffer in memory. Position given to NE2000DMAInit_position()
+ *	is then an offset from the start of the buffer. Used by upper layers
+ *	to give data they have stored to applications that read it with
+ *	RECEIVE_NETWORK_B().
+ */
+void NE2000ReceiveMemory (UINT8* buf)
+{
+	NE2000RxMemBuf = buf;
+	NE2000RxMemPtr = buf;
+
+}
+
+/** \brief Get pointer to received data if it is in memory
+ *	\date 19.10.2026
+ *	\param len number of bytes application wants to access
+ *	\return
+ *		\li 0 - data is in NE2000, nothing was read
+ *		\li pointer to the data, len bytes were skipped
+ *
+ *	Invoke this function (through NETWORK_RECEIVE_POINTER() macro) to
+ *	access received data without copying it. NE2000 buffer isn't
+ *	addressable so this works only when reading from memory (see
+ *	NE2000ReceiveMemory()).
+ */
+UINT8* NE2000RxPointer (UINT16 len)
+{
+	UINT8* p;
+	
+	if(NE2000RxMemBuf == 0)
+		return(0);
+	
+	p = NE2000RxMemPtr;
+	NE2000RxMemPtr += len;
+	
+	return(p);
+
+}
+
 /** \brief Instruct NIC to send the Ethernet frame
  * 	\author 
  *		\li Jari Lahti (jari.lahti@violasystems.com)
@@ -74,6 +74,8 @@
 
 UINT8 https_enabled = 0; /**< Defines whether https_init has already been invoked or not */
 
+INT8 https_listener = -1; /**< Listening socket accepting connections for all HTTP sessions */
+
 /** \brief Used for storing state information about different HTTP sessions
  *
  *	This is an array of http_server_state structures holding various state 
@@ -99,37 +101,39 @@ INT8 https_init(void)
 	for( i=0; i<NO_OF_HTTP_SESSIONS; i++)
 	{
 		https[i].state = HTTPS_STATE_FREE;
-		https[i].ownersocket = 0;
+		https[i].ownersocket = -1;
 		https[i].fstart = 0;
 		https[i].fpoint = 0;
 		https[i].flen  = 0;
 		https[i].funacked = 0;
-		
-		soch = 	tcp_getsocket(TCP_TYPE_SERVER, TCP_TOS_NORMAL, TCP_DEF_TOUT, https_eventlistener);
-		
-		if(soch < 0)
-		{
-			DEBUGOUT("HTTP Server uncapable of getting socket\r\n");
-			RESET_SYSTEM();
-			/*return(-1);*/
-		}
-		
-		https[i].ownersocket = soch;
-		
-		kick_WD();
-		
-		soch = tcp_listen(https[i].ownersocket, HTTPS_SERVERPORT);
-		
-		if(soch < 0)
-		{
-			DEBUGOUT("HTTP Server uncapable of setting socket to listening mode\r\n");
-			RESET_SYSTEM();
-			/*return(-1);*/
-		}		
-		
-	
 	} 
 	
+	/* One listening socket queues connections for all sessions	*/
+	
+	soch = 	tcp_getsocket(TCP_TYPE_SERVER, TCP_TOS_NORMAL, TCP_DEF_TOUT, https_eventlistener);
+	
+	if(soch < 0)
+	{
+		DEBUGOUT("HTTP Server uncapable of getting socket\r\n");
+		RESET_SYSTEM();
+		/*return(-1);*/
+	}
+	
+	https_listener = soch;
+	
+	tcp_setopt(https_listener, TCP_OPT_BACKLOG, NO_OF_HTTP_SESSIONS);
+	
+	kick_WD();
+	
+	soch = tcp_listen(https_listener, HTTPS_SERVERPORT);
+	
+	if(soch < 0)
+	{
+		DEBUGOUT("HTTP Server uncapable of setting socket to listening mode\r\n");
+		RESET_SYSTEM();
+		/*return(-1);*/
+	}		
+	
 	https_enabled  = 1;
 	
 	return(i);	
@@ -158,6 +162,11 @@ void https_run (void)
 	
 	if( https_enabled == 0)
 		return;
+	
+	/* Keep socket listening	*/
+	
+	if(tcp_getstate(https_listener) < TCP_STATE_LISTENING)
+		tcp_listen(https_listener, HTTPS_SERVERPORT);
 		
 	/* Walk thru all sessions untill we found something to send or so	*/
 	
@@ -168,13 +177,19 @@ void https_run (void)
 		if(ses >= NO_OF_HTTP_SESSIONS)
 			ses = 0;
 
-		/* Keep sockets listening	*/
+		/* Release socket of finished session once it's closed	*/
 		
-		if(tcp_getstate(https[ses].ownersocket) < TCP_STATE_LISTENING)
+		if(https[ses].state == HTTPS_STATE_FREE)
 		{
-			tcp_listen(https[ses].ownersocket, HTTPS_SERVERPORT);
+			if( (https[ses].ownersocket >= 0) &&
+				(tcp_getstate(https[ses].ownersocket) == TCP_STATE_CLOSED) )
+			{
+				tcp_releasesocket(https[ses].ownersocket);
+				https[ses].ownersocket = -1;
+			}
+			
 			ses++;
-			continue;	
+			continue;
 		}
 
 		if(https[ses].state != HTTPS_STATE_ACTIVE)
@@ -200,7 +215,6 @@ void https_run (void)
 		if( https[ses].fpoint >= https[ses].flen)
 		{
 			tcp_close(https[ses].ownersocket);
-			tcp_abort(https[ses].ownersocket);
 			https_deletesession(ses);
 			
 			ses++;
@@ -287,12 +301,6 @@ INT32 https_eventlistener (INT8 cbhandle, UINT8 event, UINT32 par1, UINT32 par2)
 	
 		case TCP_EVENT_CONREQ:
 		
-			/* Do we have a session for requesting socket?	*/
-			
-			if(session < 0)
-				return(-1);
-
-			
 			/* Try to get new session	*/
 			
 			session = https_bindsession(cbhandle);
@@ -317,6 +325,31 @@ INT32 https_eventlistener (INT8 cbhandle, UINT8 event, UINT32 par1, UINT32 par2)
 			if(session < 0)
 				return(-1);
 		
+			/* Session owns the connection from now on. It must be	*/
+			/* the oldest one waiting on the listening socket			*/
+			
+			i = tcp_accept(https_listener);
+			
+			if(i != cbhandle) {
+			
+				/* Queue out of step, drop both connections		*/
+				
+				https_deletesession((UINT8)session);
+				tcp_abort(cbhandle);
+				
+				if(i >= 0) {
+					session = https_searchsession((INT8)i);
+					
+					if(session >= 0)
+						https_deletesession((UINT8)session);
+					
+					tcp_abort((INT8)i);
+					tcp_releasesocket((INT8)i);
+				}
+				
+				return(-1);
+			}
+		
 			https_activatesession((UINT8)session);
 			
 			return(1);
@@ -428,6 +461,11 @@ INT32 https_eventlistener (INT8 cbhandle, UINT8 event, UINT32 par1, UINT32 par2)
 
 void https_deletesession (UINT8 ses)
 {
+	/* Connection that was never accepted is released by TCP	*/
+	
+	if(https[ses].state == HTTPS_STATE_RESERVED)
+		https[ses].ownersocket = -1;
+	
 	https[ses].state = HTTPS_STATE_FREE;
 	https[ses].fstart = 0;
 	https[ses].fpoint = 0;
@@ -436,7 +474,7 @@ void https_deletesession (UINT8 ses)
 
 }
 
-INT16 https_searchsession (UINT8 soch)
+INT16 https_searchsession (INT8 soch)
 {
 	UINT8 i;
 	
@@ -451,16 +489,17 @@ INT16 https_searchsession (UINT8 soch)
 
 }
 
-INT16 https_bindsession (UINT8 soch)
+INT16 https_bindsession (INT8 soch)
 {
 	UINT8 i;
 	
 	for(i=0; i<NO_OF_HTTP_SESSIONS; i++)
 	{
-		if(https[i].ownersocket == soch)
+		if(https[i].ownersocket < 0)
 		{
 			if(https[i].state == HTTPS_STATE_FREE)
 			{
+				https[i].ownersocket = soch;
 				https[i].state = HTTPS_STATE_RESERVED;
 				return(i);
 			}			
@@ -103,6 +103,12 @@
 
 #define 	RESETPIN_NE2000	PDR2_P27	/**< Reset pin */
 
+/* Sub-tick part of the monotonic clock. Reload timer 1 generates the
+ * 10 ms timer interrupt and counts down from TMRLR1 in 4 us steps
+ */
+
+#define 	CLOCK_SUBTICK_US()	((UINT32)(TMRLR1 - TMR1) << 2)	/**< Microseconds since last timer tick */
+
 #endif	/* mb90f553a */
 
 
@@ -162,6 +162,11 @@ struct ethernet_frame
 											 * 	 controllers buffer where
 											 *	 data can be read from
 											 */
+	UINT32	rx_time;						/**< Time (as returned by
+											 *	 clock_us()) when the frame
+											 *	 was taken from the
+											 *	 Ethernet controller
+											 */
 
 };
 
@@ -179,6 +184,8 @@ void InitTransmission(UINT8);
 void NE2000WriteEthernetHeader(struct ethernet_frame*);
 void NE2000DMAInit(UINT8);
 void NE2000DMAInit_position(UINT16);
+void NE2000ReceiveMemory(UINT8*);
+UINT8* NE2000RxPointer(UINT16);
 void NE2000SendFrame(UINT16);
 void NE2000EnterSleep(void);
 void NE2000ExitSleep(void);
@@ -69,8 +69,9 @@
  *	\brief Defines number of simultaneous HTTP sessions
  *
  *	Change this define to change how many simultaneous HTTP sessions will
- *	be possible at any given time. Note that this will require at least
- *	as much TCP sockets, so change #NO_OF_TCPSOCKETS also!
+ *	be possible at any given time. Note that this will require as much TCP
+ *	sockets for the connections and one more for listening, so change
+ *	#NO_OF_TCPSOCKETS also!
  */
 #define NO_OF_HTTP_SESSIONS		3
 
@@ -115,9 +116,11 @@ struct http_server_state{
 	/**	\brief TCP socket used for TCP communication
 	 *
 	 *	This variable holds a handle to TCP socket that is used to achieve
-	 *	data transfer.
+	 *	data transfer. Socket accepted from the listening socket stays here
+	 *	after the session ends until it's closed and released. -1 when
+	 *	session has no socket.
 	 */
-	UINT8 ownersocket;
+	INT8 ownersocket;
 	
 	/**	\brief File start
 	 *
@@ -161,8 +164,8 @@ INT32 https_eventlistener(INT8, UINT8, UINT32, UINT32);
 INT8 https_init(void);
 void https_run(void);
 void https_deletesession(UINT8);
-INT16 https_searchsession(UINT8);
-INT16 https_bindsession(UINT8);
+INT16 https_searchsession(INT8);
+INT16 https_bindsession(INT8);
 void https_activatesession(UINT8);
 INT16 https_calculatehash(UINT32);
 INT16 https_findfile(UINT8, UINT8);
@@ -129,10 +129,25 @@ struct ip_frame
 	
 };
 
+/** \struct ip_iovec ip.h
+ *	\brief One piece of data sent in an IP datagram
+ *
+ *	Datagram may be sent from several separate buffers (process_ip_outv()
+ *	and tcp_sendv() for example) so that they don't need to be copied
+ *	together first. Data may reside anywhere the CPU can read it from,
+ *	including constant data in ROM.
+ */
+struct ip_iovec
+{
+	UINT8*	data;					/**< First byte of the piece		*/
+	UINT16	len;					/**< Number of bytes in the piece	*/
+};
+
 /* IP function prototypes	*/
 
 INT16 process_ip_in(struct ethernet_frame*);
 INT16 process_ip_out(UINT32, UINT8, UINT8, UINT8, UINT8*, UINT16);
+INT16 process_ip_outv(UINT32, UINT8, UINT8, UINT8, UINT8*, UINT16, struct ip_iovec*, UINT8);
 UINT8 ip_check_cs(struct ip_frame*);
 UINT16 ip_checksum(UINT16, UINT8, UINT8);
 UINT32 ip_checksum_buf (UINT16 cs, UINT8* buf, UINT16 len);
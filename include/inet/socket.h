@@ -0,0 +1,187 @@
+/*
+ *Copyright (c) 2000-2002 Viola Systems Ltd.
+ *All rights reserved.
+ *
+ *Redistribution and use in source and binary forms, with or without 
+ *modification, are permitted provided that the following conditions 
+ *are met:
+ *
+ *1. Redistributions of source code must retain the above copyright 
+ *notice, this list of conditions and the following disclaimer.
+ *
+ *2. Redistributions in binary form must reproduce the above copyright 
+ *notice, this list of conditions and the following disclaimer in the 
+ *documentation and/or other materials provided with the distribution.
+ *
+ *3. The end-user documentation included with the redistribution, if 
+ *any, must include the following acknowledgment:
+ *	"This product includes software developed by Viola 
+ *	Systems (http://www.violasystems.com/)."
+ *
+ *Alternately, this acknowledgment may appear in the software itself, 
+ *if and wherever such third-party acknowledgments normally appear.
+ *
+ *4. The names "OpenTCP" and "Viola Systems" must not be used to 
+ *endorse or promote products derived from this software without prior 
+ *written permission. For written permission, please contact 
+ *opentcp@opentcp.org.
+ *
+ *5. Products derived from this software may not be called "OpenTCP", 
+ *nor may "OpenTCP" appear in their name, without prior written 
+ *permission of the Viola Systems Ltd.
+ *
+ *THIS SOFTWARE IS PROVIDED "AS IS" AND ANY EXPRESSED OR IMPLIED 
+ *WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF 
+ *MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+ *IN NO EVENT SHALL VIOLA SYSTEMS LTD. OR ITS CONTRIBUTORS BE LIABLE 
+ *FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ *CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ *SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR 
+ *BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+ *WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE 
+ *OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, 
+ *EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *====================================================================
+ *
+ *OpenTCP is the unified open source TCP/IP stack available on a series 
+ *of 8/16-bit microcontrollers, please see <http://www.opentcp.org>.
+ *
+ *For more information on how to network-enable your devices, or how to 
+ *obtain commercial technical support for OpenTCP, please see 
+ *<http://www.violasystems.com/>.
+ */
+
+/** \file socket.h
+ *	\brief OpenTCP socket layer interface file
+ *	\version 1.0
+ *	\date 19.10.2026
+ *
+ *	Socket layer function declarations, constants, etc. See socket.c
+ *	for description of the socket layer.
+ */
+
+#ifndef INCLUDE_SOCKET_H
+#define INCLUDE_SOCKET_H
+
+#include <inet/datatypes.h>
+#include <inet/system.h>
+#include <inet/tcp_ip.h>
+
+/** \def NO_OF_SOCKDESCS
+ *	\ingroup opentcp_config
+ *	\brief Number of socket descriptors available
+ *
+ *	Every socket descriptor uses a TCP or UDP socket from the pools
+ *	defined by #NO_OF_TCPSOCKETS and #NO_OF_UDPSOCKETS. Stream sockets
+ *	also need a send buffer (#TCP_NO_OF_SNDBUFS) and a receive buffer
+ *	(#TCP_NO_OF_RCVBUFS) while connected, so these pools should be
+ *	enlarged accordingly.
+ */
+#define NO_OF_SOCKDESCS		4
+
+/* Socket types					*/
+
+#define SOCK_TYPE_NONE			0		/**< Descriptor is free			*/
+#define SOCK_TYPE_STREAM		1		/**< TCP socket					*/
+#define SOCK_TYPE_DGRAM			2		/**< UDP socket					*/
+
+/* Readiness events				*/
+
+/** \def SOCK_EV_READ
+ *	\brief Socket is readable
+ *
+ *	Data can be read, connection can be accepted (listening socket) or
+ *	remote host has closed the connection (sock_recv() returns 0).
+ */
+#define SOCK_EV_READ			0x01
+
+/** \def SOCK_EV_WRITE
+ *	\brief Socket is writable
+ *
+ *	Data can be sent. Reported for a connecting stream socket once the
+ *	connection is established.
+ */
+#define SOCK_EV_WRITE			0x02
+
+/** \def SOCK_EV_ERROR
+ *	\brief Connection failed or was aborted
+ *
+ *	Reported for every socket that is being watched, regardless of the
+ *	events it was registered for.
+ */
+#define SOCK_EV_ERROR			0x04
+
+/** \def SOCK_WOULDBLOCK
+ *	\brief Operation can't be completed now
+ *
+ *	Returned by socket functions instead of waiting. Application
+ *	retries the operation when sock_wait() reports the socket ready.
+ *	Returned by sock_connect() when connection establishment was
+ *	started.
+ */
+#define SOCK_WOULDBLOCK			(-2)
+
+/* Internal flags				*/
+
+#define SOCK_FLAG_LISTEN		0x01	/**< Stream socket is listening	*/
+#define SOCK_FLAG_EOF			0x02	/**< Remote host closed connection */
+#define SOCK_FLAG_ERROR			0x04	/**< Connection failed or aborted	*/
+#define SOCK_FLAG_QUEUED		0x08	/**< Descriptor is on ready queue	*/
+
+/** \def SOCK_ORPHAN
+ *	\brief Closed descriptor's TCP socket still finishing the connection
+ */
+#define SOCK_ORPHAN				(-2)
+
+/** \struct sockdesc
+ *	\brief Socket descriptor
+ *
+ *	Socket descriptors are indexes to a table of these structures.
+ */
+struct sockdesc
+{
+	UINT8	type;				/**< Socket type, #SOCK_TYPE_NONE if free */
+	UINT8	flags;				/**< Internal flags						*/
+	INT8	handle;				/**< TCP or UDP socket handle or -1		*/
+	UINT16	port;				/**< Local port given with sock_bind()	*/
+	UINT8	events;				/**< Events application is waiting for	*/
+	UINT8	pending;			/**< Connections waiting for sock_accept() */
+	struct net_view dgram;		/**< Datagram waiting for sock_recvfrom() */
+	UINT32	dgram_ip;			/**< Source IP address of the datagram	*/
+	UINT16	dgram_port;			/**< Source port of the datagram		*/
+};
+
+/** \struct sock_event
+ *	\brief Readiness of a socket
+ *
+ *	Filled in by sock_wait().
+ */
+struct sock_event
+{
+	INT8	sd;					/**< Socket descriptor					*/
+	UINT8	events;				/**< Events (SOCK_EV_xxx) that occurred	*/
+};
+
+/* Socket layer prototypes		*/
+
+INT8 sock_init(void);
+INT8 sock_socket(UINT8);
+INT8 sock_bind(INT8, UINT16);
+INT8 sock_listen(INT8, UINT8);
+INT8 sock_accept(INT8);
+INT8 sock_connect(INT8, UINT32, UINT16);
+INT16 sock_send(INT8, UINT8*, UINT16);
+INT16 sock_recv(INT8, UINT8*, UINT16);
+INT16 sock_sendto(INT8, UINT8*, UINT16, UINT32, UINT16);
+INT16 sock_recvfrom(INT8, UINT8*, UINT16, UINT32*, UINT16*);
+INT8 sock_close(INT8);
+INT8 sock_ctl(INT8, UINT8);
+UINT8 sock_wait(struct sock_event*, UINT8);
+UINT8 sock_readiness(INT8);
+void sock_wakeup(INT8);
+void sock_reap(void);
+INT8 sock_attach(INT8);
+INT32 sock_tcp_listener(INT8, UINT8, UINT32, UINT32);
+INT32 sock_udp_listener(INT8, UINT8, UINT32, UINT16, UINT16, UINT16);
+
+#endif
@@ -84,11 +84,56 @@
  *
  *	NETWORK_TX_BUFFER_SIZE defines the size of the network buffer
  *	used for data transmission by ICMP as well as TCP and UDP applications.
+ *	TCP segments sent are limited to the size of this buffer, 1500 bytes
+ *	allows full-sized segments on Ethernet.
  *	
  *	See net_buf documentation for more reference on the shared transmit
  *	buffer.
  */
-#define	NETWORK_TX_BUFFER_SIZE	1024			
+#define	NETWORK_TX_BUFFER_SIZE	1500			
+
+/** \def NET_NO_OF_VIEWBUFS
+ *	\ingroup opentcp_config
+ *	\brief Number of buffers for receive views
+ *
+ *	Received data that can't be addressed directly (it is in the
+ *	Ethernet controller) is copied to one of these buffers when
+ *	application asks for a view of it with net_view(). Application
+ *	holds the buffer until it calls net_view_release() so this limits
+ *	how many views can be kept at the same time. Each buffer takes
+ *	#NET_VIEWBUF_SIZE bytes of RAM so they are disabled by default and
+ *	only views of data already in memory are given. Datagram sockets of
+ *	the socket layer (socket.c) need at least one.
+ */
+#define NET_NO_OF_VIEWBUFS	0
+
+/** \def NET_VIEWBUF_SIZE
+ *	\ingroup opentcp_config
+ *	\brief Size of one receive view buffer
+ *
+ *	Longest view net_view() gives of data copied from the Ethernet
+ *	controller. 1460 bytes holds payload of a full-sized TCP segment.
+ */
+#define NET_VIEWBUF_SIZE	1460
+
+/** \struct net_view system.h
+ *	\brief Read-only view of received data
+ *
+ *	Filled in by net_view() inside an event listener. Application may
+ *	read len bytes starting from data (scan them, parse them, give them
+ *	to another module) without copying them first. If buf is -1 the
+ *	data is in a buffer owned by the stack and is valid only until
+ *	event listener returns; net_view_retain() makes it valid until
+ *	net_view_release() is invoked.
+ */
+struct net_view
+{
+	UINT8*	data;		/**< First byte of the viewed data 		*/
+	UINT16	len;		/**< Number of bytes viewed				*/
+	INT8	buf;		/**< Handle of view buffer holding the data
+						 *	 or -1 if the data isn't owned by view
+						 */
+};
 
 /** \struct netif system.h
  *	\brief Network Interface declaration
@@ -269,6 +314,30 @@ struct netif{
  */
 #define NETWORK_RECEIVE_INITIALIZE(c)	NE2000DMAInit_position(c)
 
+/** \def NETWORK_RECEIVE_MEMORY
+ *	\brief Read received data from memory buffer
+ *
+ *	After this macro is invoked with a pointer to a buffer,
+ *	RECEIVE_NETWORK_B(), RECEIVE_NETWORK_BUF() and
+ *	NETWORK_RECEIVE_INITIALIZE() read the buffer instead of the Ethernet
+ *	controller, NETWORK_RECEIVE_INITIALIZE() taking an offset from the
+ *	start of the buffer. Invoke with 0 to read from the Ethernet
+ *	controller again. TCP uses this to give out-of-order data it has
+ *	stored to applications.
+ */
+#define NETWORK_RECEIVE_MEMORY(c)		NE2000ReceiveMemory(c)
+
+/** \def NETWORK_RECEIVE_POINTER
+ *	\brief Get pointer to received data in memory
+ *
+ *	Returns pointer to the next c bytes of received data and skips
+ *	them, like RECEIVE_NETWORK_BUF() would, if the data is addressable
+ *	by MCU (see NETWORK_RECEIVE_MEMORY()). Returns 0 and reads nothing
+ *	if the data must be read from the Ethernet controller. Used by
+ *	net_view() to avoid copying.
+ */
+#define NETWORK_RECEIVE_POINTER(c)		NE2000RxPointer(c)
+
 /** \def NETWORK_RECEIVE_END
  *	\ingroup periodic_functions
  *	\brief Dump received packet in the Ethernet controller
@@ -323,6 +392,10 @@ extern UINT8 isnumeric(UINT8);
 extern void mputs(UINT8*);
 void mputhex(UINT8 );
 extern UINT32 random(void);
+extern UINT32 mix32(UINT32);
+extern INT16 net_view(struct net_view*, UINT16);
+extern INT8 net_view_retain(struct net_view*);
+extern void net_view_release(struct net_view*);
 extern void dummy(void);
 
 /*	External functions	*/
@@ -80,6 +80,65 @@
  */
 #define NO_OF_TCPSOCKETS	8
 
+/** \def TCP_HASH_SIZE
+ *	\ingroup opentcp_config
+ *	\brief Number of buckets in TCP connection lookup table
+ *
+ *	Received packets are mapped to their connection through a hash table
+ *	keyed on remote IP address, remote port and local port. Must be a
+ *	power of two. Setting it close to #NO_OF_TCPSOCKETS keeps the lookup
+ *	time constant, every bucket takes one byte of RAM.
+ */
+#define TCP_HASH_SIZE		8
+
+/** \def TCP_LISTEN_HASH_SIZE
+ *	\ingroup opentcp_config
+ *	\brief Number of buckets in TCP listening socket lookup table
+ *
+ *	Listening sockets are kept in a separate table keyed on local port.
+ *	Must be a power of two.
+ */
+#define TCP_LISTEN_HASH_SIZE	4
+
+/** \def TCP_SYNCOOKIE_HALFOPEN
+ *	\ingroup opentcp_config
+ *	\brief Number of half-open connections that turns on SYN cookies
+ *
+ *	Connection request normally takes a socket that stays in SYN_RECEIVED
+ *	state until the handshake completes or times out. Once this many
+ *	sockets are half-open, or when the backlog of the listening socket
+ *	is full, further connection requests are answered with a SYN cookie
+ *	instead: initial sequence number encodes the MSS and a time stamp
+ *	and the socket is allocated only when the final ACK brings a valid
+ *	cookie back. Connections opened this way don't use window scaling,
+ *	SACK or timestamps. Zero makes TCP use SYN cookies always, value
+ *	above #NO_OF_TCPSOCKETS disables them.
+ */
+#define TCP_SYNCOOKIE_HALFOPEN	2
+
+/** \def TCP_NO_OF_TWRECS
+ *	\ingroup opentcp_config
+ *	\brief Number of connections that can wait in TIME_WAIT
+ *
+ *	Connection entering TIMED_WAIT state is moved to a compact record
+ *	holding only its identifiers and sequence numbers, and the socket
+ *	returns to LISTENING or CLOSED state at once. If all records are
+ *	in use the one closest to expiry is reused. Every record takes 19
+ *	bytes of RAM. Set to zero to keep sockets in TIMED_WAIT state
+ *	instead. Must not exceed 127.
+ */
+#define TCP_NO_OF_TWRECS	8
+
+/** \def TCP_POLL_BUDGET
+ *	\ingroup opentcp_config
+ *	\brief Maximum number of sockets served by one tcp_poll() call
+ *
+ *	Sockets with an expired timer or other work pending are queued and
+ *	tcp_poll() serves them in that order. Limits the time one call can
+ *	take, rest of the sockets are served on the next call.
+ */
+#define TCP_POLL_BUDGET		NO_OF_TCPSOCKETS
+
 /** \def NO_OF_UDPSOCKETS
  *	\ingroup opentcp_config
  *	\brief Defines number of UDP sockets available
@@ -90,23 +149,58 @@
  */
 #define NO_OF_UDPSOCKETS	4
 
+/** \def TCP_PORTS_START
+ *	\ingroup opentcp_config
+ *	\brief First port of ephemeral port range
+ *
+ *	Local ports assigned by tcp_getfreeport() are chosen randomly from
+ *	#TCP_PORTS_START to #TCP_PORTS_END (inclusive). Default is the
+ *	dynamic port range of RFC 6335 so that assigned ports don't collide
+ *	with well-known services. Range must be larger than
+ *	#TCP_PORTMAP_SIZE.
+ */
+#define TCP_PORTS_START		49152
+
 /** \def TCP_PORTS_END
  *	\ingroup opentcp_config
- *	\brief Define reserved-ports space
+ *	\brief Last port of ephemeral port range
+ */
+#define TCP_PORTS_END		65535
+
+/** \def TCP_PORTMAP_SIZE
+ *	\ingroup opentcp_config
+ *	\brief Number of entries in TCP local port use table
  *
- *	TCP socket numbers will only be assigned to be lower than this 
- *	number. 
+ *	Every entry counts the sockets whose local port maps to it, so that
+ *	tcp_getfreeport() finds an unused port without looking at the
+ *	sockets. Must be larger than #NO_OF_TCPSOCKETS and should be a power
+ *	of two.
  */
-#define TCP_PORTS_END		1023
+#define TCP_PORTMAP_SIZE	32
+
+/** \def UDP_PORTS_START
+ *	\ingroup opentcp_config
+ *	\brief First port of UDP ephemeral port range
+ *
+ *	Local ports assigned by udp_getfreeport() are chosen randomly from
+ *	#UDP_PORTS_START to #UDP_PORTS_END (inclusive). Range must be larger
+ *	than #UDP_PORTMAP_SIZE.
+ */
+#define UDP_PORTS_START		49152
 
 /** \def UDP_PORTS_END
  *	\ingroup opentcp_config
- *	\brief Define reserved-ports space
+ *	\brief Last port of UDP ephemeral port range
+ */
+#define UDP_PORTS_END		65535
+
+/** \def UDP_PORTMAP_SIZE
+ *	\ingroup opentcp_config
+ *	\brief Number of entries in UDP local port use table
  *
- *	UDP socket numbers will only be assigned to be lower than this 
- *	number. 
+ *	Must be larger than #NO_OF_UDPSOCKETS and should be a power of two.
  */
-#define UDP_PORTS_END			1023					
+#define UDP_PORTMAP_SIZE	16
 
 /* UDP Control optios			*/
 
@@ -145,7 +239,154 @@
 
 #define	MIN_TCP_HLEN		20
 #define	MAX_TCP_OPTLEN		40				
-#define TCP_DEF_MTU			512				/* Default MTU for TCP			*/
+
+/** \def TCP_DEF_MTU
+ *	\brief Default size of TCP segment (header and data)
+ *
+ *	Used until remote host tells its maximum segment size and if it
+ *	doesn't send MSS option at all. This gives the 536 data bytes
+ *	assumed by RFC 1122.
+ */
+#define TCP_DEF_MTU			(536 + MIN_TCP_HLEN)
+
+/** \def TCP_MAX_MTU
+ *	\brief Largest TCP segment (header and data) fitting in a frame
+ *
+ *	Our MSS option advertises this less TCP header. Segments we send are
+ *	also limited by the size of the network transmit buffer (see
+ *	#NETWORK_TX_BUFFER_SIZE).
+ */
+#define TCP_MAX_MTU			(ETH_MTU - IP_HLEN)
+
+/** \def TCP_MIN_MSS
+ *	\brief Smallest maximum segment size accepted from remote host
+ *
+ *	Smaller MSS in received SYN is raised to this so that segments
+ *	always carry data after options are taken off. Same floor as
+ *	used by Linux.
+ */
+#define TCP_MIN_MSS			88
+
+/** \def TCP_DEF_SEND_WINDOW
+ *	\ingroup opentcp_config
+ *	\brief Default amount of unacknowledged data allowed per socket
+ *
+ *	TCP socket may have this many bytes sent but not yet acknowledged,
+ *	provided that remote host advertises a big enough window. This allows
+ *	several data segments to be in flight on one connection. Setting this
+ *	to the size of one segment gives the old stop-and-wait behaviour. Use tcp_setopt() with
+ *	#TCP_OPT_SEND_WINDOW to change the value of individual sockets.
+ */
+#define TCP_DEF_SEND_WINDOW	(4 * (TCP_MAX_MTU - MIN_TCP_HLEN))
+
+/** \def TCP_DEF_RECV_WINDOW
+ *	\ingroup opentcp_config
+ *	\brief Default receive window of a socket (in bytes)
+ *
+ *	Amount of data remote host may send before waiting for our
+ *	acknowledgment. Received data is passed to the application as soon
+ *	as the segment is processed, so this is limited mainly by how many
+ *	frames Ethernet controller's receive buffer can hold while the
+ *	stack is busy. Default allows four full-sized segments. Use
+ *	tcp_setopt() with #TCP_OPT_RECV_WINDOW to change the window of
+ *	individual sockets.
+ */
+#define TCP_DEF_RECV_WINDOW	(4 * (TCP_MAX_MTU - MIN_TCP_HLEN))
+
+/** \def TCP_MAX_WSCALE
+ *	\brief Largest window scale shift allowed (RFC 7323)
+ */
+#define TCP_MAX_WSCALE		14
+
+/** \def TCP_NO_OF_SNDBUFS
+ *	\ingroup opentcp_config
+ *	\brief Number of TCP send buffers available
+ *
+ *	TCP sockets may obtain a send buffer (see #TCP_OPT_SEND_BUFFER) from
+ *	a pool of this many buffers. Socket that has a send buffer keeps the
+ *	unacknowledged data itself and retransmits it without asking the
+ *	application to regenerate it. Set to zero to save the RAM if all
+ *	applications can regenerate their data.
+ */
+#define TCP_NO_OF_SNDBUFS	2
+
+/** \def TCP_SNDBUF_SIZE
+ *	\ingroup opentcp_config
+ *	\brief Size of one TCP send buffer (in bytes)
+ *
+ *	Total amount of RAM used by the send buffer pool is
+ *	#TCP_NO_OF_SNDBUFS * #TCP_SNDBUF_SIZE bytes. Must not exceed 32768.
+ */
+#define TCP_SNDBUF_SIZE		2048
+
+/** \def TCP_NO_OF_REGIONS
+ *	\ingroup opentcp_config
+ *	\brief Number of storage regions tcp_sendfile() can send from
+ *
+ *	Application registers memory-mapped flash or ROM areas holding static
+ *	content with tcp_region_register(). TCP sends and retransmits the
+ *	content straight from there, so neither the application nor a send
+ *	buffer needs to keep it. Set to zero if tcp_sendfile() isn't used.
+ */
+#define TCP_NO_OF_REGIONS	4
+
+/** \def TCP_NO_OF_REASMBUFS
+ *	\ingroup opentcp_config
+ *	\brief Number of TCP reassembly buffers available
+ *
+ *	Data that arrives ahead of a lost segment is kept in a reassembly
+ *	buffer and given to the application once the missing segment
+ *	arrives, so remote host has to retransmit only the lost segment.
+ *	Socket takes a buffer from a pool of this many buffers when it
+ *	receives data out of order and releases it when the gap is filled.
+ *	Disabled by default since each buffer takes #TCP_REASM_SIZE bytes of
+ *	RAM, out-of-order data is then dropped.
+ */
+#define TCP_NO_OF_REASMBUFS	0
+
+/** \def TCP_REASM_SIZE
+ *	\ingroup opentcp_config
+ *	\brief Size of one TCP reassembly buffer (in bytes)
+ *
+ *	Only data that lies less than this many bytes after the first
+ *	missing byte is kept, so buffer should be as big as the receive
+ *	window (see #TCP_OPT_RECV_WINDOW). Total amount of RAM used by the
+ *	pool is #TCP_NO_OF_REASMBUFS * #TCP_REASM_SIZE bytes. Must not exceed
+ *	32768.
+ */
+#define TCP_REASM_SIZE		TCP_DEF_RECV_WINDOW
+
+/** \def TCP_NO_OF_RCVBUFS
+ *	\ingroup opentcp_config
+ *	\brief Number of TCP receive buffers available
+ *
+ *	TCP sockets may obtain a receive buffer (see #TCP_OPT_RECV_BUFFER)
+ *	from a pool of this many buffers. Socket that has a receive buffer
+ *	stores the received data there and application reads it with
+ *	tcp_recv() when it is ready to. Each buffer takes #TCP_RCVBUF_SIZE
+ *	bytes of RAM so the pool is empty by default and applications
+ *	process the data in #TCP_EVENT_DATA.
+ */
+#define TCP_NO_OF_RCVBUFS	0
+
+/** \def TCP_RCVBUF_SIZE
+ *	\ingroup opentcp_config
+ *	\brief Size of one TCP receive buffer (in bytes)
+ *
+ *	Receive window of a socket with a receive buffer is the free space
+ *	in the buffer. Total amount of RAM used by the pool is
+ *	#TCP_NO_OF_RCVBUFS * #TCP_RCVBUF_SIZE bytes. Must not exceed 32768.
+ */
+#define TCP_RCVBUF_SIZE		TCP_DEF_RECV_WINDOW
+
+/** \def TCP_SENDV_MAX
+ *	\ingroup opentcp_config
+ *	\brief Maximum number of buffers given to tcp_sendv() at once
+ *
+ *	tcp_sendv() keeps description of one segment's pieces on stack,
+ *	so this limits the stack space it uses.
+ */
+#define TCP_SENDV_MAX		8
 
 /** \def TCP_DEF_RETRIES
  *	\ingroup opentcp_config
@@ -181,29 +422,70 @@
 
 /** \def TCP_DEF_RETRY_TOUT
  *	\ingroup opentcp_config
- *	\brief Default data-retransmission period (in seconds)
+ *	\brief Default wait period in closing states (in seconds)
  *
- *	If data was not acknowledged during the time-frame defined by this
- *	value (in seconds) retransmission procedure will occur.
+ *	Defines how long socket waits in TIMED_WAIT state and how long it
+ *	waits for the remote host's FIN in FINW2 state. Retransmissions use
+ *	adaptive time-out instead (see #TCP_INIT_RETRY_TOUT).
  */
 #define TCP_DEF_RETRY_TOUT	4
 
+/** \def TCP_TW_SLOTS
+ *	\brief Number of one second slots in TIME_WAIT timer wheel
+ *
+ *	TIME_WAIT record is put to the slot that is reached after
+ *	#TCP_DEF_RETRY_TOUT full seconds.
+ */
+#define TCP_TW_SLOTS		(TCP_DEF_RETRY_TOUT + 2)
+
 /** \def TCP_INIT_RETRY_TOUT
  *	\ingroup opentcp_config
- *	\brief Initial retransmission period (in seconds)
+ *	\brief Initial retransmission time-out (in seconds)
  *
- *	Initial retransmission is made a little faster, which helps with
- *	connection establishment if ARP cache didn't contain remote IP address.
+ *	Retransmission time-out (RTO) used before round-trip time of the
+ *	connection has been measured, i.e. for SYN packets. After that RTO is
+ *	calculated from the measured round-trip times as defined in RFC 6298
+ *	and doubled on every time-out.
  */
 #define TCP_INIT_RETRY_TOUT	1
 
-/** \def TCP_SYN_RETRY_TOUT
+/** \def TCP_MIN_RTO
  *	\ingroup opentcp_config
- *	\brief Retranmission period for SYN packet
+ *	\brief Lower bound of retransmission time-out (in milliseconds)
  *
- *	Controls SYN packet (segment) retransmit period.
+ *	RFC 6298 recommends one second. Lower value recovers much faster
+ *	from losses on LANs but may cause needless retransmissions if
+ *	remote host delays its acknowledgments.
  */
-#define TCP_SYN_RETRY_TOUT	2
+#define TCP_MIN_RTO			200
+
+/** \def TCP_MAX_RTO
+ *	\ingroup opentcp_config
+ *	\brief Upper bound of retransmission time-out (in milliseconds)
+ */
+#define TCP_MAX_RTO			60000
+
+/** \def TCP_DELACK_TIME
+ *	\ingroup opentcp_config
+ *	\brief Maximum delay of acknowledgment (in milliseconds)
+ *
+ *	Received data is not acknowledged immediately but at most this long
+ *	later, so that the acknowledgment can be sent together with the data
+ *	application sends as an answer. Every second segment is acknowledged
+ *	immediately (RFC 1122). Must be well below #TCP_MIN_RTO of remote
+ *	hosts. Set to zero to acknowledge every segment immediately.
+ */
+#define TCP_DELACK_TIME		100
+
+/** \def TCP_FLUSH_TIME
+ *	\ingroup opentcp_config
+ *	\brief Maximum time small segment is held back (in milliseconds)
+ *
+ *	When socket coalesces small writes (see #TCP_OPT_NAGLE and
+ *	#TCP_OPT_CORK) data that doesn't fill a full segment is sent at the
+ *	latest this long after it was first held back.
+ */
+#define TCP_FLUSH_TIME		200
 
 /** \def TCP_TOS_NORMAL
  *	\brief Defines normal type of service for TCP socket
@@ -226,6 +508,22 @@
 
 #define TCP_HALF_SEQ_SPACE	0x0000FFFF		/* For detecting sequence space	*/
 
+#define TCP_DUPACK_THRESHOLD	3			/* Duplicate ACKs before fast	*/
+											/* retransmit (RFC 5681)		*/
+
+/** \def TCP_SACK_BLOCKS
+ *	\ingroup opentcp_config
+ *	\brief Number of selectively acknowledged ranges remembered per socket
+ *
+ *	Sockets with a send buffer keep a scoreboard of data remote host has
+ *	selectively acknowledged (RFC 2018) so that only the holes between
+ *	them are retransmitted in fast recovery. Same number of ranges of
+ *	out-of-order data is kept by the receiver (see #TCP_NO_OF_REASMBUFS)
+ *	and reported to remote host. Every entry takes sixteen bytes of RAM
+ *	per socket.
+ */
+#define TCP_SACK_BLOCKS		4
+
 
 /* ICMP message types */
 
@@ -278,6 +576,7 @@
 
 /* TCP FLAGS					*/
 
+#define TCP_FLAG_URGENT			0x20
 #define	TCP_FLAG_ACK			0x10
 #define TCP_FLAG_PUSH			0x08
 #define TCP_FLAG_RESET			0x04
@@ -287,6 +586,146 @@
 /* TCP Internal flags			*/
 
 #define TCP_INTFLAGS_CLOSEPENDING	0x01
+#define TCP_INTFLAGS_RTTVALID		0x02	/**< srtt and rttvar are valid	*/
+#define TCP_INTFLAGS_RTTTIMING		0x04	/**< Round-trip time is being
+											 *	 measured
+											 */
+#define TCP_INTFLAGS_RECOVERY		0x08	/**< In fast recovery			*/
+#define TCP_INTFLAGS_WSCALE			0x10	/**< Window scaling in use		*/
+#define TCP_INTFLAGS_WNDUPDATE		0x20	/**< Window update to be sent	*/
+#define TCP_INTFLAGS_DELACK			0x40	/**< Acknowledgment delayed		*/
+#define TCP_INTFLAGS_SACK			0x80	/**< Selective ACKs permitted	*/
+#define TCP_INTFLAGS_TSTAMP			0x0100	/**< Timestamps in use			*/
+
+/* Small write coalescing flags	*/
+
+#define TCP_COALESCE_NAGLE			0x01	/**< Nagle algorithm enabled	*/
+#define TCP_COALESCE_CORK			0x02	/**< Socket corked				*/
+#define TCP_COALESCE_FLUSH			0x04	/**< Send all held back data	*/
+#define TCP_COALESCE_HELD			0x08	/**< Small segment held back	*/
+
+/* TCP header options (RFC 793, RFC 7323)	*/
+
+#define TCP_OPTKIND_EOL			0		/**< End of option list			*/
+#define TCP_OPTKIND_NOP			1		/**< No operation (padding)		*/
+#define TCP_OPTKIND_MSS			2		/**< Maximum segment size		*/
+#define TCP_OPTKIND_WSCALE		3		/**< Window scale				*/
+#define TCP_OPTKIND_SACKPERM	4		/**< Selective ACKs permitted	*/
+#define TCP_OPTKIND_SACK		5		/**< Selective acknowledgment	*/
+#define TCP_OPTKIND_TSTAMP		8		/**< Timestamps					*/
+#define TCP_OPTLEN_MSS			4
+#define TCP_OPTLEN_WSCALE		3
+#define TCP_OPTLEN_SACKPERM		2
+#define TCP_OPTLEN_TSTAMP		10
+
+/** \def TCP_DATA_OPTLEN
+ *	\brief Room for options in data segments
+ *
+ *	Data segments carry timestamp option (padded to 12 bytes) when
+ *	timestamps are in use. Room for it is reserved in front of
+ *	application's data, see #TCP_APP_OFFSET.
+ */
+#define TCP_DATA_OPTLEN			12
+
+/** \def TCP_PAWS_IDLE
+ *	\brief Time after which remembered timestamp is no longer valid
+ *
+ *	Remote host's timestamp clock may have wrapped around if the
+ *	connection has been idle this long (24 days in milliseconds), so
+ *	protection against wrapped sequence numbers (PAWS) isn't applied
+ *	(RFC 7323).
+ */
+#define TCP_PAWS_IDLE			(24L * 24 * 60 * 60 * 1000)
+
+/* TCP socket options			*/
+
+/** \def TCP_OPT_SEND_WINDOW
+ *	\brief Maximum amount of unacknowledged data on socket
+ *
+ *	Use this option with tcp_setopt() to change how many bytes of data
+ *	may be in flight (sent but not yet acknowledged) on a socket. Default
+ *	value is #TCP_DEF_SEND_WINDOW.
+ */
+#define TCP_OPT_SEND_WINDOW		1
+
+/** \def TCP_OPT_SEND_BUFFER
+ *	\brief Attach or release socket's send buffer
+ *
+ *	Use this option with tcp_setopt() to attach a send buffer from the
+ *	send buffer pool to the socket (non-zero value) or to return it to
+ *	the pool (zero value). Data sent over a socket with a send buffer is
+ *	copied to the buffer and kept there until it is acknowledged, so
+ *	TCP retransmits it without generating #TCP_EVENT_REGENERATE.
+ *	Send buffer can't be changed while it holds unacknowledged data.
+ */
+#define TCP_OPT_SEND_BUFFER		2
+
+/** \def TCP_OPT_RECV_WINDOW
+ *	\brief Amount of data application can receive
+ *
+ *	Use this option with tcp_setopt() to tell how many bytes the
+ *	application is able to receive. Remote host is not allowed to send
+ *	more than this. Applications that process the data in
+ *	#TCP_EVENT_DATA can leave it to the default (#TCP_DEF_RECV_WINDOW).
+ *	Applications that buffer the received data should set it to the
+ *	free space in their buffer whenever that changes. Value set before
+ *	the connection is established determines the window scale used.
+ *	Window of a socket with a receive buffer (see #TCP_OPT_RECV_BUFFER)
+ *	can't be set.
+ */
+#define TCP_OPT_RECV_WINDOW		3
+
+/** \def TCP_OPT_NAGLE
+ *	\brief Enable or disable Nagle algorithm
+ *
+ *	Use this option with tcp_setopt() on a socket with a send buffer
+ *	(see #TCP_OPT_SEND_BUFFER). When enabled (non-zero value) segments
+ *	smaller than the maximum segment size are not sent while earlier
+ *	data is unacknowledged, so that small writes are collected to full
+ *	segments (RFC 896). Held back data is sent at the latest after
+ *	#TCP_FLUSH_TIME.
+ */
+#define TCP_OPT_NAGLE			4
+
+/** \def TCP_OPT_CORK
+ *	\brief Cork or uncork socket
+ *
+ *	Use this option with tcp_setopt() on a socket with a send buffer
+ *	(see #TCP_OPT_SEND_BUFFER). While socket is corked (non-zero value)
+ *	only full segments are sent. Uncorking (zero value) sends out the
+ *	rest of the data on next tcp_poll(). Held back data is sent at the
+ *	latest after #TCP_FLUSH_TIME even if socket stays corked.
+ */
+#define TCP_OPT_CORK			5
+
+/** \def TCP_OPT_BACKLOG
+ *	\brief Number of connections listening socket can queue
+ *
+ *	Use this option with tcp_setopt() on a server socket before
+ *	tcp_listen(). With the default value (zero) listening socket itself
+ *	takes the connection. Non-zero value makes the listening socket
+ *	stay listening and allocate a new socket from the pool for every
+ *	connection request. Up to this many connections that are being
+ *	established or wait for tcp_accept() are held, further connection
+ *	requests are ignored so that remote hosts retry them later.
+ *	Connections inherit event listener, type and options of the
+ *	listening socket.
+ */
+#define TCP_OPT_BACKLOG			6
+
+/** \def TCP_OPT_RECV_BUFFER
+ *	\brief Attach or release socket's receive buffer
+ *
+ *	Use this option with tcp_setopt() to attach a receive buffer from
+ *	the receive buffer pool to the socket (non-zero value) or to return
+ *	it to the pool (zero value). Data received over a socket with a
+ *	receive buffer is stored in the buffer and application reads it
+ *	with tcp_recv() whenever it wants to. Receive window advertised to
+ *	remote host is the free space in the buffer, so application that
+ *	doesn't read makes the remote host wait instead of losing data.
+ *	Receive buffer can't be changed while it holds data.
+ */
+#define TCP_OPT_RECV_BUFFER		7
 
 /* TCP socket types				*/
 /** \def TCP_TYPE_NONE
@@ -328,6 +767,37 @@
  */
 #define	TCP_TYPE_CLIENT_SERVER	0x03
 
+/** \def TCP_TYPE_CC_NEWRENO
+ *	\brief Use NewReno congestion control on socket
+ *
+ *	OR this with socket type given to tcp_getsocket() to select the
+ *	congestion control algorithm of the socket. NewReno (RFC 5681,
+ *	RFC 6582) is the default.
+ */
+#define TCP_TYPE_CC_NEWRENO		0x00
+
+/** \def TCP_TYPE_CC_CUBIC
+ *	\brief Use CUBIC congestion control on socket
+ *
+ *	OR this with socket type given to tcp_getsocket() to use CUBIC
+ *	(RFC 8312) congestion control. CUBIC recovers the window faster
+ *	than NewReno on paths with large bandwidth-delay product.
+ */
+#define TCP_TYPE_CC_CUBIC		0x10
+
+/** \def TCP_TYPE_CC_MASK
+ *	\brief Bits of socket type selecting congestion control algorithm
+ */
+#define TCP_TYPE_CC_MASK		0xF0
+
+/** \def TCP_CC_MAX_CWND
+ *	\brief Upper limit of congestion window
+ *
+ *	Congestion window is not grown beyond the largest window that can
+ *	be used on a socket.
+ */
+#define TCP_CC_MAX_CWND			0xFFFFL
+
 /* TCP States. For more detailed descriptions see RFC793		*/
 
 #define	TCP_STATE_FREE			1	/**< Entry is free and unused 				*/
@@ -422,8 +892,10 @@
  *
  *	TCP/IP stack has received correct acknowledgment packet for the 
  *	previously sent data and is informing the application about it.
- *	After this event, application can send new data packet to remote
- *	host.
+ *	This event is generated when all of the data sent so far has been
+ *	acknowledged. After this event, application can send new data to
+ *	remote host. Applications that keep several segments in flight
+ *	use tcp_checksend() to find out when the send window opens again.
  */
 #define TCP_EVENT_ACK			16
 
@@ -432,7 +904,18 @@
  *
  *	Previously sent data packet was not acknowledged (or the acknowledgment
  *	packet did not arrive) so retransmission needs to be peformed.
- *	Application must resend the data that was sent in the previous packet.
+ *	Sending is restarted from the oldest unacknowledged byte:
+ *		\li par1 - number of bytes application must resend now, starting
+ *		from the oldest unacknowledged byte
+ *		\li par2 - total number of unacknowledged bytes. These are
+ *		considered unsent again, so data following the first par1 bytes
+ *		must also be sent again later
+ *
+ *	Application that sends one packet at a time simply resends the data
+ *	that was sent in the previous packet.
+ *
+ *	This event is not generated for sockets that have a send buffer (see
+ *	#TCP_OPT_SEND_BUFFER). Their data is retransmitted by TCP itself.
  */
 #define TCP_EVENT_REGENERATE	32
 
@@ -441,6 +924,13 @@
  *
  *	TCP received some data from remote host and is informing application
  *	that it is available for reading from the Ethernet controller.
+ *	Event listener parameters:
+ *		\li par1 - number of bytes received
+ *
+ *	For sockets that have a receive buffer (see #TCP_OPT_RECV_BUFFER)
+ *	data is already stored in the buffer and par1 is the number of bytes
+ *	tcp_recv() can read. Application doesn't have to read them before
+ *	returning.
  */
 #define	TCP_EVENT_DATA			64
 
@@ -454,9 +944,9 @@
  *  This value defines offset that TCP applications must use when
  *	writing to transmit buffer. This many bytes will be used
  *	<b>before</b> the first byte of applications data in the 
- *	transmit buffer to store TCP header.
+ *	transmit buffer to store TCP header and options.
  */
-#define TCP_APP_OFFSET			MIN_TCP_HLEN		/* Application buffers must have 	*/
+#define TCP_APP_OFFSET			(MIN_TCP_HLEN + TCP_DATA_OPTLEN)	/* Application buffers must have 	*/
 													/* this much free on start of buf	*/
 
 /** \def UDP_APP_OFFSET
@@ -577,6 +1067,49 @@ struct tcp_frame
 										 */	
 };
 
+struct tcb;
+
+/** \struct tcp_cc_ops
+ *	\brief Congestion control algorithm
+ *
+ *	Each congestion control algorithm provides these functions. Slow
+ *	start, fast recovery and time-outs are handled by the stack itself
+ *	(see tcp_cc.c), algorithm decides how congestion window grows in
+ *	congestion avoidance and how much it is reduced after a loss.
+ */
+struct tcp_cc_ops
+{
+	void	(*init)(struct tcb*);		/**< Connection established, reset
+										 *	 algorithm specific state
+										 */
+	void	(*ack)(struct tcb*, UINT32);	/**< Bytes acknowledged in
+											 *	 congestion avoidance
+											 */
+	void	(*loss)(struct tcb*);		/**< Loss detected, set ssthresh */
+};
+
+/** \struct tcp_cubic
+ *	\brief CUBIC congestion control state of a socket
+ */
+struct tcp_cubic
+{
+	UINT32	w_max;		/**< Window before the last reduction (bytes)	*/
+	UINT32	w_est;		/**< Window NewReno would have (bytes)			*/
+	UINT32	origin;		/**< Window at the plateau of cubic curve		*/
+	UINT32	epoch;		/**< Time (clock_us()) current epoch started	*/
+	UINT16	k;			/**< Time from epoch to plateau (10 ms units)	*/
+	UINT8	valid;		/**< Epoch has been started						*/
+};
+
+/** \struct tcp_sackblock
+ *	\brief Range of data selectively acknowledged by remote host
+ */
+struct tcp_sackblock
+{
+	UINT32	start;		/**< First acknowledged sequence number			*/
+	UINT32	end;		/**< Sequence number following the range			*/
+};
+
 /** \struct tcb
  *	\brief TCP transmission control block
  *
@@ -619,22 +1152,137 @@ struct tcb
 	 *		\li TCP_TYPE_CLIENT_SERVER
 	 */
 	UINT8	type;						
-	UINT8	flags;						/**< State machine flags			*/
+	UINT16	flags;						/**< State machine flags			*/
 	UINT32	rem_ip;						/**< Remote IP address			*/
 	UINT16	remport;					/**< Remote TCP port				*/
 	UINT16	locport;					/**< Local TCP port				*/
+	INT8	hash_next;					/**< Next socket in the same lookup
+										 *	 table bucket or -1
+										 */
+	INT8*	hash_bucket;				/**< Lookup table bucket socket is
+										 *	 linked to or 0
+										 */
+	UINT8	backlog;					/**< Maximum number of connections
+										 *	 not yet accepted
+										 */
+	UINT8	npending;					/**< Connections not yet accepted */
+	INT8	acceptq;					/**< First established connection
+										 *	 waiting for tcp_accept() or -1
+										 */
+	INT8	parent;						/**< Listening socket connection
+										 *	 was created by until accepted,
+										 *	 otherwise -1
+										 */
+	INT8	qnext;						/**< Next connection in listening
+										 *	 socket's accept queue or -1
+										 */
+	UINT8	ready;						/**< Waiting in the queue of sockets
+										 *	 tcp_poll() serves
+										 */
 	UINT32 	send_unacked;
 	UINT8	myflags;					/**< My flags to be Txed			*/
 	UINT32	send_next;
+	UINT32	send_max;					/**< Highest sequence number sent */
 	UINT16 	send_mtu;
 	UINT16	tout;						/**< Socket idle timeout (seconds)*/
 	UINT8	tos;						/**< Type of service allocated */
 	UINT32	receive_next;
 	UINT16	persist_timerh;				/**< Persistent timers' handle */
 	UINT16	retransmit_timerh;			/**< Retransmission timers' handle */
+	UINT16	delack_timerh;				/**< Delayed ACK timers' handle */
+	UINT16	flush_timerh;				/**< Held back data flush timers'
+										 *	 handle
+										 */
 	UINT8	retries_left;				/**< Number of retries left before
 										 *	 aborting
 										 */
+	UINT32	rtt_seq;					/**< Sequence number whose ACK ends
+										 *	 round-trip time measurement
+										 */
+	UINT32	rtt_time;					/**< Time (clock_us()) measurement
+										 *	 was started
+										 */
+	UINT32	srtt;						/**< Smoothed round-trip time (us) */
+	UINT32	rttvar;						/**< Round-trip time variation (us) */
+	UINT16	rto;						/**< Retransmission time-out (timer
+										 *	 ticks)
+										 */
+	UINT8	dupacks;					/**< Number of duplicate ACKs received */
+	UINT32	recover;					/**< send_max when fast recovery was
+										 *	 entered
+										 */
+	UINT16	timeouts;					/**< Retransmission time-outs		*/
+	UINT16	fast_retransmits;			/**< Fast retransmissions			*/
+	UINT32	send_window;				/**< Window advertised by remote host */
+	UINT16	send_budget;				/**< Maximum amount of data in flight */
+	UINT32	rcv_wnd;					/**< Data application can receive */
+	UINT32	rcv_adv;					/**< Right edge of the window
+										 *	 advertised to remote host
+										 */
+	UINT32	last_ack_sent;				/**< Acknowledgment number last sent */
+	UINT32	ts_recent;					/**< Timestamp to echo to remote host */
+	UINT32	ts_recent_age;				/**< Time (clock_ms()) ts_recent was
+										 *	 updated
+										 */
+	UINT8	rcv_wscale;					/**< Scale of our window			*/
+	UINT8	snd_wscale;					/**< Scale of remote host's window */
+	INT8	sndbuf;						/**< Handle of send buffer or -1 */
+	UINT16	sndbuf_start;				/**< Send buffer offset of the oldest
+										 *	 unacknowledged byte
+										 */
+	UINT16	sndbuf_len;					/**< Bytes stored in send buffer
+										 *	 (sent or not yet sent), or part
+										 *	 of file being sent
+										 */
+	INT8	file;						/**< Storage region of file being
+										 *	 sent by tcp_sendfile() or -1
+										 */
+	UINT32	file_pos;					/**< Region offset of the oldest
+										 *	 unacknowledged byte of file
+										 */
+	UINT32	file_rest;					/**< Bytes of file not yet counted
+										 *	 in sndbuf_len
+										 */
+	INT8	rcvbuf;						/**< Handle of receive buffer or -1 */
+	UINT16	rcvbuf_start;				/**< Receive buffer offset of the
+										 *	 first unread byte
+										 */
+	UINT16	rcvbuf_len;					/**< Bytes stored in receive buffer */
+	UINT8	coalesce;					/**< Small write coalescing flags */
+	UINT8	nsacked;					/**< Entries used in sacked		*/
+	struct tcp_sackblock sacked[TCP_SACK_BLOCKS];	/**< Selectively
+													 *	 acknowledged data,
+													 *	 in sequence order
+													 */
+	UINT32	rexmit_high;				/**< End of data retransmitted in
+										 *	 fast recovery
+										 */
+	UINT32	rexmit_bytes;				/**< Bytes retransmitted from send
+										 *	 buffer
+										 */
+	INT8	reasm;						/**< Handle of reassembly buffer
+										 *	 or -1
+										 */
+	UINT32	reasm_seq;					/**< Sequence number stored at
+										 *	 the start of reassembly buffer
+										 */
+	UINT8	nreasm;						/**< Entries used in reasm_blk	*/
+	struct tcp_sackblock reasm_blk[TCP_SACK_BLOCKS];	/**< Out-of-order
+														 *	 data in
+														 *	 reassembly
+														 *	 buffer, most
+														 *	 recent first
+														 */
+	struct tcp_cc_ops* cc;				/**< Congestion control algorithm */
+	UINT32	cwnd;						/**< Congestion window (bytes)	*/
+	UINT32	ssthresh;					/**< Slow start threshold (bytes) */
+	
+	/** \brief Congestion control algorithm specific state
+	 */
+	union
+	{
+		struct tcp_cubic cubic;
+	} ccdata;
 	
 	/** \brief TCP socket application event listener
 	 *
@@ -645,6 +1293,65 @@ struct tcb
 	
 };
 
+/** \struct tcp_twrec
+ *	\brief Connection waiting in TIME_WAIT
+ *
+ *	Holds what is needed to recognize segments of a closed connection
+ *	and to acknowledge retransmitted FIN of the remote host. Records
+ *	are linked to a lookup table bucket the same way as sockets and to
+ *	the slot of TIME_WAIT timer wheel they expire in.
+ */
+struct tcp_twrec
+{
+	UINT32	rem_ip;				/**< Remote IP address					*/
+	UINT32	send_next;			/**< Sequence number following our FIN	*/
+	UINT32	receive_next;		/**< Sequence number following remote
+								 *	 host's FIN
+								 */
+	UINT16	remport;			/**< Remote TCP port					*/
+	UINT16	locport;			/**< Local TCP port						*/
+	INT8	hash_next;			/**< Next record in the same bucket		*/
+	INT8	wheel_next;			/**< Next record in the same wheel slot
+								 *	 or in the free list
+								 */
+	UINT8	slot;				/**< Wheel slot record expires in		*/
+};
+
+/** \struct tcp_synstats
+ *	\brief TCP connection establishment statistics
+ *
+ *	Filled in by tcp_getsynstats(). Counters wrap around.
+ */
+struct tcp_synstats
+{
+	UINT8	halfopen;			/**< Sockets in SYN_RECEIVED state			*/
+	UINT16	cookies_sent;		/**< Connection requests answered with a
+								 *	 SYN cookie
+								 */
+	UINT16	cookies_ok;			/**< Connections opened with SYN cookie		*/
+	UINT16	cookies_invalid;	/**< ACKs to listening sockets carrying an
+								 *	 invalid or expired cookie
+								 */
+};
+
+/** \struct tcp_sockstats
+ *	\brief TCP socket statistics
+ *
+ *	Filled in by tcp_getstats(). Round-trip time values are zero until
+ *	the first round-trip time has been measured on the connection.
+ */
+struct tcp_sockstats
+{
+	UINT32	srtt;		/**< Smoothed round-trip time (microseconds)		*/
+	UINT32	rttvar;		/**< Round-trip time variation (microseconds)		*/
+	UINT32	rto;		/**< Current retransmission time-out (milliseconds)	*/
+	UINT16	timeouts;	/**< Number of retransmission time-outs				*/
+	UINT16	fast_retransmits;	/**< Number of fast retransmissions			*/
+	UINT32	cwnd;		/**< Congestion window (bytes)						*/
+	UINT32	ssthresh;	/**< Slow start threshold (bytes)					*/
+	UINT32	rexmit_bytes;	/**< Bytes retransmitted from send buffer		*/
+};
+
 /* ICMP function prototypes	*/
 
 INT16 process_icmp_in(struct ip_frame*, UINT16);
@@ -658,15 +1365,19 @@ INT8 udp_close (INT8 );
 INT16 udp_send (INT8 , UINT32 , UINT16 , UINT8* , UINT16 , UINT16 );
 INT16 process_udp_in(struct ip_frame* , UINT16 );
 UINT16 udp_getfreeport(void); 
+void udp_setlocport(struct ucb*, UINT16);
 
 /*	TCP Function prototypes	*/
 
 INT16 process_tcp_in(struct ip_frame*, UINT16);
 INT16 process_tcp_out(INT8, UINT8*, UINT16, UINT16);
+INT16 tcp_sendseg(INT8, UINT8*, UINT16, struct ip_iovec*, UINT8);
 INT8 tcp_init(void);
 INT8 tcp_listen(INT8, UINT16);
+INT8 tcp_accept(INT8);
+INT8 tcp_getparent(INT8);
 INT8 tcp_mapsocket(struct ip_frame*, struct tcp_frame*);
-UINT8 tcp_check_cs(struct ip_frame*, UINT16);
+UINT8 tcp_check_cs(struct ip_frame*, UINT16, UINT8);
 void tcp_sendcontrol(INT8);
 UINT32 tcp_initseq(void);
 void tcp_poll(void);
@@ -675,12 +1386,93 @@ INT8 tcp_getsocket(UINT8, UINT8, UINT16, INT32 (*)(INT8, UINT8, UINT32, UINT32)
 INT8 tcp_releasesocket(INT8);
 INT8 tcp_connect(INT8, UINT32, UINT16, UINT16);
 INT16 tcp_send(INT8, UINT8*, UINT16, UINT16);
+INT16 tcp_sendv(INT8, struct ip_iovec*, UINT8);
+INT8 tcp_sendfile(INT8, INT8, UINT32, UINT32);
+INT8 tcp_region_register(UINT8*, UINT32);
+void tcp_region_unregister(INT8);
 INT8 tcp_close(INT8);
 void tcp_sendreset(struct tcp_frame*, UINT32);
 INT8 tcp_getstate(INT8);
 UINT16 tcp_getfreeport(void);
+void tcp_setlocport(struct tcb*, UINT16);
 INT16 tcp_checksend(INT8);
+INT16 tcp_recv(INT8, UINT8*, UINT16);
+INT16 tcp_checkrecv(INT8);
 INT8 tcp_abort(INT8);
+INT8 tcp_setopt(INT8, UINT8, UINT32);
+void tcp_setwindow(INT8, UINT32);
+UINT16 tcp_sendroom(struct tcb*);
+INT8 tcp_sndbuf_get(void);
+void tcp_sndbuf_free(INT8);
+void tcp_sndbuf_write(struct tcb*, UINT8*, UINT16);
+UINT16 tcp_sndbuf_output(INT8);
+UINT8 tcp_coalesce_hold(struct tcb*, UINT16);
+INT8 tcp_getstats(INT8, struct tcp_sockstats*);
+void tcp_getsynstats(struct tcp_synstats*);
+void tcp_rtt_init(struct tcb*);
+void tcp_rtt_sent(struct tcb*, UINT16);
+void tcp_rtt_sample(struct tcb*);
+void tcp_rtt_update(struct tcb*, UINT32);
+void tcp_rtt_backoff(struct tcb*);
+INT32 tcp_regenerate(INT8);
+void tcp_fastretransmit(INT8);
+void tcp_sndbuf_xmit(INT8, UINT16, UINT16);
+UINT16 tcp_recvwindow(struct tcb*);
+UINT8 tcp_putoptions(struct tcb*, UINT8*, UINT8);
+void tcp_getoptions(struct tcb*, UINT8);
+UINT8* tcp_findoption(UINT8, UINT8);
+UINT8 tcp_gettimestamp(UINT8, UINT32*, UINT32*);
+UINT8 tcp_sack_update(struct tcb*, UINT8);
+void tcp_sack_add(struct tcb*, UINT32, UINT32);
+void tcp_sack_trim(struct tcb*);
+UINT8 tcp_sack_lost(struct tcb*);
+UINT16 tcp_sack_hole(struct tcb*, UINT32*);
+INT8 tcp_reasm_get(void);
+void tcp_reasm_free(INT8);
+UINT8 tcp_reasm_add(struct tcb*, UINT32, UINT32);
+void tcp_reasm_store(struct tcb*, UINT16);
+void tcp_reasm_deliver(INT8);
+void tcp_reasm_clear(struct tcb*);
+INT8 tcp_rcvbuf_get(void);
+void tcp_rcvbuf_free(INT8);
+void tcp_deliver(INT8, UINT16);
+UINT8 tcp_hash(UINT32, UINT16, UINT16);
+void tcp_rehash(struct tcb*);
+INT8 tcp_spawn(INT8);
+void tcp_unqueue(struct tcb*);
+UINT32 tcp_cookie(UINT32, UINT16, UINT16, UINT32, UINT8);
+UINT8 tcp_cookie_check(struct ip_frame*, struct tcp_frame*);
+void tcp_sendcookie(struct tcb*, struct ip_frame*, struct tcp_frame*);
+void tcp_timewait(struct tcb*);
+INT8 tcp_tw_get(void);
+void tcp_tw_free(INT8);
+UINT8 tcp_tw_input(struct ip_frame*, struct tcp_frame*);
+void tcp_tw_age(void);
+UINT8 tcp_service(INT8);
+UINT8 tcp_fastpath(INT8, UINT16, UINT8, UINT32);
+UINT8 tcp_newack(INT8, UINT32, UINT32);
+void tcp_output(INT8, UINT16, UINT8);
+void tcp_ready(UINT8);
+void tcp_wakeup(INT8);
+
+/*	TCP congestion control prototypes	*/
+
+extern struct tcp_cc_ops tcp_cc_newreno;
+extern struct tcp_cc_ops tcp_cc_cubic;
+
+struct tcp_cc_ops* tcp_cc_select(UINT8);
+void tcp_cc_init(struct tcb*);
+void tcp_cc_ack(struct tcb*, UINT32);
+void tcp_cc_dupack(struct tcb*);
+void tcp_cc_loss(struct tcb*, UINT8);
+void tcp_cc_recovered(struct tcb*);
+void tcp_newreno_init(struct tcb*);
+void tcp_newreno_ack(struct tcb*, UINT32);
+void tcp_newreno_loss(struct tcb*);
+void tcp_cubic_init(struct tcb*);
+void tcp_cubic_ack(struct tcb*, UINT32);
+void tcp_cubic_loss(struct tcb*);
+UINT16 tcp_cubic_cbrt(UINT32);
 
 
 
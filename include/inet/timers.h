@@ -85,6 +85,40 @@
  */
 #define TIMERTIC 100			/* Timer period 1/secs			*/
 
+/** \def CLOCK_TICK_US
+ *	\brief Length of one timer tick in microseconds
+ *
+ *	Derived from #TIMERTIC. Used by the monotonic clock to convert the
+ *	number of elapsed timer ticks to microseconds.
+ */
+#define CLOCK_TICK_US	(1000000L / TIMERTIC)
+
+/** \def CLOCK_SUBTICK_US
+ *	\brief Microseconds elapsed since the last timer tick
+ *
+ *	Architecture specific part of the monotonic clock. It should return
+ *	the number of microseconds elapsed since decrement_timers() was
+ *	last invoked, normally by reading the hardware counter that generates
+ *	the timer interrupt. If architecture doesn't define it the clock
+ *	simply has the resolution of one timer tick.
+ */
+#ifndef CLOCK_SUBTICK_US
+#define CLOCK_SUBTICK_US()	0
+#endif
+
+/** \struct clock_time timers.h
+ *	\brief 64-bit monotonic clock value
+ *
+ *	Holds number of microseconds elapsed since timer_pool_init() was
+ *	invoked. Since the compilers OpenTCP is used with don't have a 64-bit
+ *	integer type the value is split into two 32-bit halves.
+ */
+struct clock_time
+{
+	UINT32	hi;		/**< Upper 32 bits of the microsecond count */
+	UINT32	lo;		/**< Lower 32 bits of the microsecond count */
+};
+
 
 UINT8 get_timer(void);			/* Get Timer from Timer Pool 	*/
 void free_timer(UINT8);			/* Return Timer to Timer Pool	*/
@@ -92,5 +126,9 @@ void init_timer(UINT8,UINT32);	/* Init timers timeout value	*/
 void timer_pool_init(void);		/* Init the pool when uC starts	*/
 UINT32 check_timer(UINT8);		/* Return Timers value			*/ 	
 void decrement_timers(void);	/* decrement all timers' values */
+void notify_timer(UINT8, void (*)(UINT8), UINT8);	/* Set expiry callback */
+void clock_get(struct clock_time*);	/* Read 64-bit microsecond clock */
+UINT32 clock_us(void);			/* Lower 32 bits of the clock	*/
+UINT32 clock_ms(void);			/* Clock in milliseconds		*/
 
 #endif
\ No newline at end of file
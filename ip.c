@@ -298,8 +298,34 @@ INT16 process_ip_in (struct ethernet_frame* frame)
  *		\li Instructing NIC to send the data
  */
 INT16 process_ip_out (UINT32 ipadr, UINT8 pcol, UINT8 tos, UINT8 ttl, UINT8* dat, UINT16 len)
+{
+	return( process_ip_outv(ipadr, pcol, tos, ttl, dat, len, 0, 0) );
+
+}
+
+/** \brief Try to send out IP frame assembled from several buffers
+ *	\date 19.10.2026
+ *	\param ipadr remote IP address
+ *	\param pcol protocol over IP used (#IP_ICMP, #IP_UDP or #IP_TCP)
+ *	\param tos type of service required
+ *	\param ttl time to live header field of IP packet
+ *	\param dat pointer to upper layer header (or whole data)
+ *	\param len length of the header
+ *	\param iov pieces of data sent after the header
+ *	\param cnt number of pieces in iov
+ *	\return
+ *		\li -1 - general error
+ *		\li -2 - ARP cache not ready
+ *		\li >0 - number of data bytes sent (packet OK)
+ *
+ *	Works like process_ip_out() but data is written to the Ethernet
+ *	controller directly from every piece, so upper layer may send its
+ *	header and application's data without copying them to one buffer.
+ */
+INT16 process_ip_outv (UINT32 ipadr, UINT8 pcol, UINT8 tos, UINT8 ttl, UINT8* dat, UINT16 len, struct ip_iovec* iov, UINT8 cnt)
 {
 	struct arp_entry *qstruct;
+	UINT16 tlen;
 	UINT16 i;
 	
 	/* Try to get MAC address from ARP cache	*/
@@ -352,9 +378,14 @@ INT16 process_ip_out (UINT32 ipadr, UINT8 pcol, UINT8 tos, UINT8 ttl, UINT8* dat
 	
 	/* Construct the IP header	*/
 	
+	tlen = len;
+	
+	for(i=0; i < cnt; i++)
+		tlen += iov[i].len;
+	
 	send_ip_packet.vihl = IP_DEF_VIHL;
 	send_ip_packet.tos = tos;
-	send_ip_packet.tlen = IP_HLEN + len;
+	send_ip_packet.tlen = IP_HLEN + tlen;
 	send_ip_packet.id = ip_id++;
 	send_ip_packet.frags = 0;
 	send_ip_packet.ttl = ttl;
@@ -393,12 +424,15 @@ INT16 process_ip_out (UINT32 ipadr, UINT8 pcol, UINT8 tos, UINT8 ttl, UINT8* dat
 	/* Assemble data	*/
 	
 	SEND_NETWORK_BUF(dat,len);
-		
+	
+	for(i=0; i < cnt; i++)
+		SEND_NETWORK_BUF(iov[i].data, iov[i].len);
+	
 	/* Launch it		*/
 	
 	NETWORK_COMPLETE_SEND( send_ip_packet.tlen );
 	
-	return(len);
+	return(tlen);
 	
 	
 }
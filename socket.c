@@ -0,0 +1,962 @@
+/*
+ *Copyright (c) 2000-2002 Viola Systems Ltd.
+ *All rights reserved.
+ *
+ *Redistribution and use in source and binary forms, with or without 
+ *modification, are permitted provided that the following conditions 
+ *are met:
+ *
+ *1. Redistributions of source code must retain the above copyright 
+ *notice, this list of conditions and the following disclaimer.
+ *
+ *2. Redistributions in binary form must reproduce the above copyright 
+ *notice, this list of conditions and the following disclaimer in the 
+ *documentation and/or other materials provided with the distribution.
+ *
+ *3. The end-user documentation included with the redistribution, if 
+ *any, must include the following acknowledgment:
+ *	"This product includes software developed by Viola 
+ *	Systems (http://www.violasystems.com/)."
+ *
+ *Alternately, this acknowledgment may appear in the software itself, 
+ *if and wherever such third-party acknowledgments normally appear.
+ *
+ *4. The names "OpenTCP" and "Viola Systems" must not be used to 
+ *endorse or promote products derived from this software without prior 
+ *written permission. For written permission, please contact 
+ *opentcp@opentcp.org.
+ *
+ *5. Products derived from this software may not be called "OpenTCP", 
+ *nor may "OpenTCP" appear in their name, without prior written 
+ *permission of the Viola Systems Ltd.
+ *
+ *THIS SOFTWARE IS PROVIDED "AS IS" AND ANY EXPRESSED OR IMPLIED 
+ *WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF 
+ *MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+ *IN NO EVENT SHALL VIOLA SYSTEMS LTD. OR ITS CONTRIBUTORS BE LIABLE 
+ *FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ *CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ *SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR 
+ *BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+ *WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE 
+ *OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, 
+ *EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *====================================================================
+ *
+ *OpenTCP is the unified open source TCP/IP stack available on a series 
+ *of 8/16-bit microcontrollers, please see <http://www.opentcp.org>.
+ *
+ *For more information on how to network-enable your devices, or how to 
+ *obtain commercial technical support for OpenTCP, please see 
+ *<http://www.violasystems.com/>.
+ */
+
+/** \file socket.c
+ *	\brief OpenTCP socket layer
+ *	\version 1.0
+ *	\date 19.10.2026
+ *	\bug
+ *	\warning
+ *	\todo
+ *
+ *	Thin BSD-like socket layer on top of the TCP and UDP modules. Socket
+ *	descriptors are non-blocking: functions that can't complete at once
+ *	return #SOCK_WOULDBLOCK instead of waiting. Application registers
+ *	the events it waits for with sock_ctl() and gets all sockets that
+ *	are ready in one sock_wait() call, so that many sockets can be
+ *	served from the main loop and existing protocol code written
+ *	against BSD sockets can be ported easily.
+ *
+ *	Socket layer is an ordinary TCP and UDP application. Its event
+ *	listeners put descriptors whose state changed on a ready queue, and
+ *	sock_wait() only looks at the queued descriptors. Stream sockets use
+ *	TCP send and receive buffers (see #TCP_OPT_SEND_BUFFER and
+ *	#TCP_OPT_RECV_BUFFER) so data is kept by TCP until application sends
+ *	or reads it. Datagram socket keeps one received datagram in a
+ *	receive view (see net_view()), datagrams arriving while it is
+ *	unread are dropped. Socket layer therefore needs #TCP_NO_OF_SNDBUFS,
+ *	#TCP_NO_OF_RCVBUFS and #NET_NO_OF_VIEWBUFS set to at least one
+ *	buffer per socket used at the same time.
+ */
+
+#include <inet/debug.h>
+#include <inet/datatypes.h>
+#include <inet/system.h>
+#include <inet/tcp_ip.h>
+#include <inet/socket.h>
+
+/** \brief Socket descriptor table
+ *
+ *	Socket descriptor is an index to this table.
+ */
+struct sockdesc sock_table[NO_OF_SOCKDESCS];
+
+/** \brief Socket descriptor of every TCP socket
+ *
+ *	-1 if TCP socket isn't used by the socket layer or is a connection
+ *	not yet accepted, #SOCK_ORPHAN if its descriptor was closed while
+ *	the connection is still being closed.
+ */
+INT8 sock_tcpmap[NO_OF_TCPSOCKETS];
+
+/** \brief Socket descriptor of every UDP socket or -1
+ */
+INT8 sock_udpmap[NO_OF_UDPSOCKETS];
+
+/** \brief Descriptors whose readiness may have changed
+ *
+ *	Ring of descriptors, sock_readyq_head is the oldest one and
+ *	sock_nready their number. Descriptor is queued only once (see
+ *	#SOCK_FLAG_QUEUED).
+ */
+INT8 sock_readyq[NO_OF_SOCKDESCS];
+UINT8 sock_readyq_head;
+UINT8 sock_nready;
+
+/** \brief Number of TCP sockets marked #SOCK_ORPHAN
+ */
+UINT8 sock_norphans;
+
+/** \brief Initialize socket layer
+ *	\ingroup core_initializer
+ *	\date 19.10.2026
+ *	\return
+ *		\li >=0 - number of socket descriptors initialized
+ *	\warning
+ *		\li This function <b>must</b> be invoked after tcp_init() and
+ *		udp_init() and before any other socket layer function
+ */
+INT8 sock_init (void)
+{
+	INT8 i;
+	
+	for(i=0; i < NO_OF_SOCKDESCS; i++) {
+		sock_table[i].type = SOCK_TYPE_NONE;
+		sock_table[i].flags = 0;
+		sock_table[i].handle = -1;
+		sock_table[i].dgram.buf = -1;
+	}
+	
+	for(i=0; i < NO_OF_TCPSOCKETS; i++)
+		sock_tcpmap[i] = -1;
+	
+	for(i=0; i < NO_OF_UDPSOCKETS; i++)
+		sock_udpmap[i] = -1;
+	
+	sock_readyq_head = 0;
+	sock_nready = 0;
+	sock_norphans = 0;
+	
+	return(i);
+
+}
+
+/** \brief Allocate a socket descriptor
+ *	\ingroup socket_api
+ *	\date 19.10.2026
+ *	\param type type of socket, #SOCK_TYPE_STREAM or #SOCK_TYPE_DGRAM
+ *	\return
+ *		\li -1 - Error (invalid type, no free descriptors or UDP sockets)
+ *		\li >=0 - socket descriptor
+ *
+ *	Stream socket gets its TCP socket when it is made listening or
+ *	connected, datagram socket gets its UDP socket at once.
+ */
+INT8 sock_socket (UINT8 type)
+{
+	struct sockdesc* d;
+	INT8 sd;
+	INT8 h;
+	
+	if( (type != SOCK_TYPE_STREAM) && (type != SOCK_TYPE_DGRAM) )
+		return(-1);
+	
+	for(sd=0; sd < NO_OF_SOCKDESCS; sd++) {
+		if(sock_table[sd].type == SOCK_TYPE_NONE)
+			break;
+	}
+	
+	if(sd == NO_OF_SOCKDESCS) {
+		DEBUGOUT("No free socket descriptors\r\n");
+		return(-1);
+	}
+	
+	d = &sock_table[sd];
+	h = -1;
+	
+	if(type == SOCK_TYPE_DGRAM) {
+		h = udp_getsocket(0, sock_udp_listener, UDP_OPT_SEND_CS | UDP_OPT_CHECK_CS);
+		
+		if(h < 0)
+			return(-1);
+		
+		sock_udpmap[h] = sd;
+	}
+	
+	d->type = type;
+	d->flags &= SOCK_FLAG_QUEUED;
+	d->handle = h;
+	d->port = 0;
+	d->events = 0;
+	d->pending = 0;
+	d->dgram.buf = -1;
+	
+	return(sd);
+
+}
+
+/** \brief Give socket a local port
+ *	\ingroup socket_api
+ *	\date 19.10.2026
+ *	\param sd socket descriptor
+ *	\param port local port number
+ *	\return
+ *		\li -1 - Error (invalid descriptor or socket already in use)
+ *		\li >=0 - socket descriptor
+ *
+ *	Stream socket uses the port when it is made listening (connecting
+ *	socket picks a free port if none was given). Datagram socket is
+ *	opened on the port at once.
+ */
+INT8 sock_bind (INT8 sd, UINT16 port)
+{
+	struct sockdesc* d;
+	
+	if( (sd < 0) || (sd >= NO_OF_SOCKDESCS) )
+		return(-1);
+	
+	d = &sock_table[sd];
+	
+	if(d->type == SOCK_TYPE_DGRAM) {
+		if( udp_open(d->handle, port) < 0 )
+			return(-1);
+	} else if( (d->type != SOCK_TYPE_STREAM) || (d->handle >= 0) )
+		return(-1);
+	
+	d->port = port;
+	
+	return(sd);
+
+}
+
+/** \brief Make stream socket listen for connections
+ *	\ingroup socket_api
+ *	\date 19.10.2026
+ *	\param sd socket descriptor given a port with sock_bind()
+ *	\param backlog number of connections held for sock_accept() (at
+ *		least 1 is used)
+ *	\return
+ *		\li -1 - Error (invalid descriptor, no port or no free TCP sockets)
+ *		\li >=0 - socket descriptor
+ *
+ *	Socket becomes readable when connections can be accepted.
+ */
+INT8 sock_listen (INT8 sd, UINT8 backlog)
+{
+	struct sockdesc* d;
+	INT8 h;
+	
+	if( (sd < 0) || (sd >= NO_OF_SOCKDESCS) )
+		return(-1);
+	
+	d = &sock_table[sd];
+	
+	if( (d->type != SOCK_TYPE_STREAM) || (d->handle >= 0) || (d->port == 0) )
+		return(-1);
+	
+	h = tcp_getsocket(TCP_TYPE_SERVER, TCP_TOS_NORMAL, TCP_DEF_TOUT, sock_tcp_listener);
+	
+	if(h < 0)
+		return(-1);
+	
+	if(backlog == 0)
+		backlog = 1;
+	
+	if( (tcp_setopt(h, TCP_OPT_BACKLOG, backlog) < 0) || (tcp_listen(h, d->port) < 0) ) {
+		tcp_releasesocket(h);
+		return(-1);
+	}
+	
+	d->handle = h;
+	d->flags |= SOCK_FLAG_LISTEN;
+	sock_tcpmap[h] = sd;
+	
+	return(sd);
+
+}
+
+/** \brief Accept connection on listening socket
+ *	\ingroup socket_api
+ *	\date 19.10.2026
+ *	\param sd listening socket descriptor
+ *	\return
+ *		\li -1 - Error (invalid descriptor or no free descriptors)
+ *		\li #SOCK_WOULDBLOCK - no connections waiting
+ *		\li >=0 - socket descriptor of the connection
+ *
+ *	If there are no free descriptors the connection stays waiting.
+ */
+INT8 sock_accept (INT8 sd)
+{
+	struct sockdesc* d;
+	INT8 nsd;
+	INT8 h;
+	
+	if( (sd < 0) || (sd >= NO_OF_SOCKDESCS) )
+		return(-1);
+	
+	d = &sock_table[sd];
+	
+	if( (d->type != SOCK_TYPE_STREAM) || ((d->flags & SOCK_FLAG_LISTEN) == 0) )
+		return(-1);
+	
+	if(d->pending == 0)
+		return(SOCK_WOULDBLOCK);
+	
+	nsd = sock_socket(SOCK_TYPE_STREAM);
+	
+	if(nsd < 0)
+		return(-1);
+	
+	h = tcp_accept(d->handle);
+	
+	/* Connections counted may have closed before they were accepted	*/
+	
+	if(h < 0) {
+		d->pending = 0;
+		sock_table[nsd].type = SOCK_TYPE_NONE;
+		return(SOCK_WOULDBLOCK);
+	}
+	
+	d->pending--;
+	
+	sock_table[nsd].handle = h;
+	sock_table[nsd].port = d->port;
+	sock_tcpmap[h] = nsd;
+	
+	/* Data or close may have arrived before it was accepted	*/
+	
+	if(tcp_getstate(h) != TCP_STATE_CONNECTED)
+		sock_table[nsd].flags |= SOCK_FLAG_EOF;
+	
+	return(nsd);
+
+}
+
+/** \brief Connect stream socket to remote host
+ *	\ingroup socket_api
+ *	\date 19.10.2026
+ *	\param sd socket descriptor
+ *	\param ip IP address of remote host
+ *	\param port remote port number
+ *	\return
+ *		\li -1 - Error (invalid descriptor, socket in use or no free TCP
+ *		sockets or buffers)
+ *		\li #SOCK_WOULDBLOCK - connection establishment started
+ *
+ *	Socket becomes writable once the connection is established. If it
+ *	fails #SOCK_EV_ERROR is reported instead.
+ */
+INT8 sock_connect (INT8 sd, UINT32 ip, UINT16 port)
+{
+	struct sockdesc* d;
+	INT8 h;
+	
+	if( (sd < 0) || (sd >= NO_OF_SOCKDESCS) )
+		return(-1);
+	
+	d = &sock_table[sd];
+	
+	if( (d->type != SOCK_TYPE_STREAM) || (d->handle >= 0) )
+		return(-1);
+	
+	h = tcp_getsocket(TCP_TYPE_CLIENT, TCP_TOS_NORMAL, TCP_DEF_TOUT, sock_tcp_listener);
+	
+	if(h < 0)
+		return(-1);
+	
+	if( (sock_attach(h) < 0) || (tcp_connect(h, ip, port, d->port) < 0) ) {
+		tcp_releasesocket(h);
+		return(-1);
+	}
+	
+	d->handle = h;
+	d->flags &= SOCK_FLAG_QUEUED;
+	sock_tcpmap[h] = sd;
+	
+	return(SOCK_WOULDBLOCK);
+
+}
+
+/** \brief Send data over connected stream socket
+ *	\ingroup socket_api
+ *	\date 19.10.2026
+ *	\param sd socket descriptor
+ *	\param buf pointer to data
+ *	\param len number of bytes to send
+ *	\return
+ *		\li -1 - Error (invalid descriptor or socket not connected)
+ *		\li #SOCK_WOULDBLOCK - send buffer is full
+ *		\li >0 - number of bytes taken, may be less than len
+ *
+ *	Data is copied to the socket's send buffer so buf doesn't need room
+ *	for headers and can be reused at once.
+ */
+INT16 sock_send (INT8 sd, UINT8* buf, UINT16 len)
+{
+	struct sockdesc* d;
+	INT16 room;
+	
+	if( (sd < 0) || (sd >= NO_OF_SOCKDESCS) )
+		return(-1);
+	
+	d = &sock_table[sd];
+	
+	if( (d->type != SOCK_TYPE_STREAM) || (d->handle < 0) || (d->flags & SOCK_FLAG_LISTEN) )
+		return(-1);
+	
+	if( d->flags & SOCK_FLAG_ERROR )
+		return(-1);
+	
+	if( tcp_getstate(d->handle) != TCP_STATE_CONNECTED ) {
+		if( tcp_getstate(d->handle) < TCP_STATE_CONNECTED )
+			return(SOCK_WOULDBLOCK);
+		
+		return(-1);
+	}
+	
+	room = tcp_checksend(d->handle);
+	
+	if(room <= 0)
+		return(SOCK_WOULDBLOCK);
+	
+	if(len > room)
+		len = room;
+	
+	return(tcp_send(d->handle, buf, len, len));
+
+}
+
+/** \brief Read data from stream socket
+ *	\ingroup socket_api
+ *	\date 19.10.2026
+ *	\param sd socket descriptor
+ *	\param buf pointer to buffer where data is copied
+ *	\param len size of the buffer
+ *	\return
+ *		\li -1 - Error (invalid descriptor or connection aborted)
+ *		\li #SOCK_WOULDBLOCK - no data available
+ *		\li 0 - remote host closed the connection and all data has
+ *		been read
+ *		\li >0 - number of bytes read
+ *
+ *	Invoked for a datagram socket works as sock_recvfrom() without
+ *	returning the address.
+ */
+INT16 sock_recv (INT8 sd, UINT8* buf, UINT16 len)
+{
+	struct sockdesc* d;
+	INT16 n;
+	
+	if( (sd < 0) || (sd >= NO_OF_SOCKDESCS) )
+		return(-1);
+	
+	d = &sock_table[sd];
+	
+	if(d->type == SOCK_TYPE_DGRAM)
+		return(sock_recvfrom(sd, buf, len, 0, 0));
+	
+	if( (d->type != SOCK_TYPE_STREAM) || (d->handle < 0) || (d->flags & SOCK_FLAG_LISTEN) )
+		return(-1);
+	
+	n = tcp_recv(d->handle, buf, len);
+	
+	if(n != 0)
+		return(n);
+	
+	if(d->flags & SOCK_FLAG_ERROR)
+		return(-1);
+	
+	if(d->flags & SOCK_FLAG_EOF)
+		return(0);
+	
+	return(SOCK_WOULDBLOCK);
+
+}
+
+/** \brief Send datagram
+ *	\ingroup socket_api
+ *	\date 19.10.2026
+ *	\param sd datagram socket descriptor
+ *	\param buf pointer to data
+ *	\param len number of bytes to send
+ *	\param ip destination IP address
+ *	\param port destination port
+ *	\return
+ *		\li -1 - Error (invalid descriptor, datagram too long)
+ *		\li #SOCK_WOULDBLOCK - destination address isn't resolved yet
+ *		\li >=0 - number of bytes sent
+ *
+ *	Socket not given a port with sock_bind() is opened on a free port.
+ *	Data is copied to net_buf so buf doesn't need room for headers.
+ */
+INT16 sock_sendto (INT8 sd, UINT8* buf, UINT16 len, UINT32 ip, UINT16 port)
+{
+	struct sockdesc* d;
+	UINT16 i;
+	INT16 n;
+	
+	if( (sd < 0) || (sd >= NO_OF_SOCKDESCS) )
+		return(-1);
+	
+	d = &sock_table[sd];
+	
+	if(d->type != SOCK_TYPE_DGRAM)
+		return(-1);
+	
+	if(len > NETWORK_TX_BUFFER_SIZE - UDP_APP_OFFSET)
+		return(-1);
+	
+	if(d->port == 0) {
+		d->port = udp_getfreeport();
+		
+		if( (d->port == 0) || (udp_open(d->handle, d->port) < 0) ) {
+			d->port = 0;
+			return(-1);
+		}
+	}
+	
+	for(i=0; i < len; i++)
+		net_buf[UDP_APP_OFFSET + i] = buf[i];
+	
+	n = udp_send(d->handle, ip, port, &net_buf[UDP_APP_OFFSET], NETWORK_TX_BUFFER_SIZE - UDP_APP_OFFSET, len);
+	
+	if(n == -2)
+		return(SOCK_WOULDBLOCK);
+	
+	if(n < 0)
+		return(-1);
+	
+	return(n);
+
+}
+
+/** \brief Read datagram
+ *	\ingroup socket_api
+ *	\date 19.10.2026
+ *	\param sd datagram socket descriptor
+ *	\param buf pointer to buffer where data is copied
+ *	\param len size of the buffer
+ *	\param ip pointer to where source IP address is stored or 0
+ *	\param port pointer to where source port is stored or 0
+ *	\return
+ *		\li -1 - Error (invalid descriptor)
+ *		\li #SOCK_WOULDBLOCK - no datagram received
+ *		\li >=0 - number of bytes read
+ *
+ *	Part of the datagram that doesn't fit in buf is discarded.
+ */
+INT16 sock_recvfrom (INT8 sd, UINT8* buf, UINT16 len, UINT32* ip, UINT16* port)
+{
+	struct sockdesc* d;
+	UINT16 i;
+	
+	if( (sd < 0) || (sd >= NO_OF_SOCKDESCS) )
+		return(-1);
+	
+	d = &sock_table[sd];
+	
+	if(d->type != SOCK_TYPE_DGRAM)
+		return(-1);
+	
+	if(d->dgram.buf < 0)
+		return(SOCK_WOULDBLOCK);
+	
+	if(len > d->dgram.len)
+		len = d->dgram.len;
+	
+	if(len > 0x7FFF)
+		len = 0x7FFF;
+	
+	for(i=0; i < len; i++)
+		buf[i] = d->dgram.data[i];
+	
+	if(ip)
+		*ip = d->dgram_ip;
+	
+	if(port)
+		*port = d->dgram_port;
+	
+	net_view_release(&d->dgram);
+	
+	return((INT16)len);
+
+}
+
+/** \brief Close socket and free the descriptor
+ *	\ingroup socket_api
+ *	\date 19.10.2026
+ *	\param sd socket descriptor
+ *	\return
+ *		\li -1 - Error (invalid descriptor)
+ *		\li >=0 - closed descriptor
+ *
+ *	Connection is closed gracefully, data still in the send buffer is
+ *	sent first. Its TCP socket is released once the connection is
+ *	closed. Listening socket aborts connections not yet accepted.
+ */
+INT8 sock_close (INT8 sd)
+{
+	struct sockdesc* d;
+	INT8 h;
+	
+	if( (sd < 0) || (sd >= NO_OF_SOCKDESCS) )
+		return(-1);
+	
+	d = &sock_table[sd];
+	h = d->handle;
+	
+	if(d->type == SOCK_TYPE_NONE)
+		return(-1);
+	
+	if(d->type == SOCK_TYPE_DGRAM) {
+		net_view_release(&d->dgram);
+		udp_close(h);
+		udp_releasesocket(h);
+		sock_udpmap[h] = -1;
+	} else if(d->flags & SOCK_FLAG_LISTEN) {
+		tcp_abort(h);
+		tcp_releasesocket(h);
+		sock_tcpmap[h] = -1;
+	} else if(h >= 0) {
+		tcp_close(h);
+		
+		if( tcp_getstate(h) == TCP_STATE_CLOSED ) {
+			tcp_releasesocket(h);
+			sock_tcpmap[h] = -1;
+		} else {
+			sock_tcpmap[h] = SOCK_ORPHAN;
+			sock_norphans++;
+		}
+	}
+	
+	d->type = SOCK_TYPE_NONE;
+	d->flags &= SOCK_FLAG_QUEUED;
+	d->handle = -1;
+	d->events = 0;
+	
+	return(sd);
+
+}
+
+/** \brief Set events application waits for on a socket
+ *	\ingroup socket_api
+ *	\date 19.10.2026
+ *	\param sd socket descriptor
+ *	\param events #SOCK_EV_READ and/or #SOCK_EV_WRITE, 0 to stop
+ *		watching the socket
+ *	\return
+ *		\li -1 - Error (invalid descriptor)
+ *		\li >=0 - socket descriptor
+ *
+ *	Socket that is already ready is reported by the next sock_wait().
+ */
+INT8 sock_ctl (INT8 sd, UINT8 events)
+{
+	if( (sd < 0) || (sd >= NO_OF_SOCKDESCS) )
+		return(-1);
+	
+	if(sock_table[sd].type == SOCK_TYPE_NONE)
+		return(-1);
+	
+	sock_table[sd].events = events & (SOCK_EV_READ | SOCK_EV_WRITE);
+	sock_wakeup(sd);
+	
+	return(sd);
+
+}
+
+/** \brief Get sockets that are ready
+ *	\ingroup socket_api
+ *	\ingroup periodic_functions
+ *	\date 19.10.2026
+ *	\param ev pointer to array where ready sockets are stored
+ *	\param max number of entries in the array
+ *	\return number of ready sockets stored
+ *
+ *	Invoke this function from the main loop after the received frames
+ *	have been processed and tcp_poll() has been invoked. Only sockets
+ *	whose state has changed since they were last found not ready are
+ *	examined. Sockets stay ready (and are reported again) until
+ *	application has read, written or accepted what they had, like
+ *	level-triggered epoll. Also releases TCP sockets of closed
+ *	descriptors once their connection has been closed.
+ */
+UINT8 sock_wait (struct sock_event* ev, UINT8 max)
+{
+	struct sockdesc* d;
+	UINT8 n;
+	UINT8 count;
+	UINT8 r;
+	INT8 sd;
+	
+	if(sock_norphans)
+		sock_reap();
+	
+	/* Descriptors queued again below are left for next invocation	*/
+	
+	n = 0;
+	
+	for(count = sock_nready; (count > 0) && (n < max); count--) {
+		sd = sock_readyq[sock_readyq_head];
+		sock_readyq_head = (sock_readyq_head + 1) % NO_OF_SOCKDESCS;
+		sock_nready--;
+		
+		d = &sock_table[sd];
+		d->flags &= ~SOCK_FLAG_QUEUED;
+		
+		if( (d->type == SOCK_TYPE_NONE) || (d->events == 0) )
+			continue;
+		
+		r = sock_readiness(sd) & (d->events | SOCK_EV_ERROR);
+		
+		if(r == 0)
+			continue;
+		
+		ev[n].sd = sd;
+		ev[n].events = r;
+		n++;
+		
+		sock_wakeup(sd);
+	}
+	
+	return(n);
+
+}
+
+/** \brief Find out which events are true for a socket now
+ *	\date 19.10.2026
+ *	\param sd socket descriptor
+ *	\return SOCK_EV_xxx flags
+ */
+UINT8 sock_readiness (INT8 sd)
+{
+	struct sockdesc* d;
+	UINT8 r;
+	
+	d = &sock_table[sd];
+	r = 0;
+	
+	if(d->flags & SOCK_FLAG_ERROR)
+		r |= SOCK_EV_ERROR | SOCK_EV_READ;
+	
+	if(d->type == SOCK_TYPE_DGRAM) {
+		if(d->dgram.buf >= 0)
+			r |= SOCK_EV_READ;
+		
+		return(r | SOCK_EV_WRITE);
+	}
+	
+	if(d->handle < 0)
+		return(r);
+	
+	if(d->flags & SOCK_FLAG_LISTEN) {
+		if(d->pending)
+			r |= SOCK_EV_READ;
+		
+		return(r);
+	}
+	
+	if( (tcp_checkrecv(d->handle) > 0) || (d->flags & SOCK_FLAG_EOF) )
+		r |= SOCK_EV_READ;
+	
+	if(tcp_checksend(d->handle) > 0)
+		r |= SOCK_EV_WRITE;
+	
+	return(r);
+
+}
+
+/** \brief Put descriptor on ready queue
+ *	\date 19.10.2026
+ *	\param sd socket descriptor
+ *
+ *	Invoked when something happens that may make the socket ready.
+ *	sock_wait() then finds out if it really is.
+ */
+void sock_wakeup (INT8 sd)
+{
+	if( sock_table[sd].flags & SOCK_FLAG_QUEUED )
+		return;
+	
+	sock_table[sd].flags |= SOCK_FLAG_QUEUED;
+	sock_readyq[(sock_readyq_head + sock_nready) % NO_OF_SOCKDESCS] = sd;
+	sock_nready++;
+
+}
+
+/** \brief Release TCP sockets of closed descriptors
+ *	\date 19.10.2026
+ *
+ *	TCP socket of a closed descriptor stays allocated until the
+ *	connection has been closed, possibly without telling its event
+ *	listener, so they are checked here while there are any.
+ */
+void sock_reap (void)
+{
+	INT8 h;
+	
+	for(h=0; h < NO_OF_TCPSOCKETS; h++) {
+		if(sock_tcpmap[h] != SOCK_ORPHAN)
+			continue;
+		
+		if(tcp_getstate(h) != TCP_STATE_CLOSED)
+			continue;
+		
+		tcp_releasesocket(h);
+		sock_tcpmap[h] = -1;
+		sock_norphans--;
+	}
+
+}
+
+/** \brief Give TCP socket the buffers stream socket needs
+ *	\date 19.10.2026
+ *	\param h TCP socket handle
+ *	\return
+ *		\li -1 - no free send or receive buffers
+ *		\li >=0 - TCP socket handle
+ */
+INT8 sock_attach (INT8 h)
+{
+	if( tcp_setopt(h, TCP_OPT_SEND_BUFFER, 1) < 0 )
+		return(-1);
+	
+	if( tcp_setopt(h, TCP_OPT_RECV_BUFFER, 1) < 0 )
+		return(-1);
+	
+	return(h);
+
+}
+
+/** \brief Event listener of TCP sockets used by socket layer
+ *	\date 19.10.2026
+ *	\param cb TCP socket handle
+ *	\param event TCP event
+ *	\param par1 first event parameter
+ *	\param par2 second event parameter
+ *	\return
+ *		\li -2 - connection request can't be taken now (no free buffers)
+ *		\li -1 - event not handled
+ *		\li 1 - OK
+ *
+ *	Records what happened and queues the descriptor. Connections of a
+ *	listening socket get their buffers when they are requested, so data
+ *	arriving before sock_accept() is kept.
+ */
+INT32 sock_tcp_listener (INT8 cb, UINT8 event, UINT32 par1, UINT32 par2)
+{
+	INT8 sd;
+	INT8 p;
+	
+	sd = sock_tcpmap[cb];
+	
+	if(sd == SOCK_ORPHAN)
+		return(1);
+	
+	if(sd < 0) {
+		
+		/* Connection of a listening socket, not accepted yet	*/
+		
+		p = tcp_getparent(cb);
+		
+		if(p < 0)
+			return(-1);
+		
+		if(event == TCP_EVENT_CONREQ) {
+			if( sock_attach(cb) < 0 )
+				return(-2);
+			
+			return(1);
+		}
+		
+		if( (event == TCP_EVENT_CONNECTED) && (sock_tcpmap[p] >= 0) ) {
+			sd = sock_tcpmap[p];
+			sock_table[sd].pending++;
+			sock_wakeup(sd);
+		}
+		
+		return(1);
+	}
+	
+	switch(event) {
+		case TCP_EVENT_CONNECTED:
+		case TCP_EVENT_DATA:
+		case TCP_EVENT_ACK:
+			break;
+		
+		case TCP_EVENT_CLOSE:
+			sock_table[sd].flags |= SOCK_FLAG_EOF;
+			break;
+		
+		case TCP_EVENT_ABORT:
+			sock_table[sd].flags |= SOCK_FLAG_EOF | SOCK_FLAG_ERROR;
+			break;
+		
+		default:
+			return(-1);
+	}
+	
+	sock_wakeup(sd);
+	
+	return(1);
+
+}
+
+/** \brief Event listener of UDP sockets used by socket layer
+ *	\date 19.10.2026
+ *	\param cb UDP socket handle
+ *	\param event UDP event
+ *	\param ipaddr source IP address
+ *	\param port source port
+ *	\param buffindex position of data in the received frame
+ *	\param datalen length of data
+ *	\return
+ *		\li -1 - datagram dropped
+ *		\li 1 - OK
+ *
+ *	Keeps the datagram in a receive view until sock_recvfrom().
+ */
+INT32 sock_udp_listener (INT8 cb, UINT8 event, UINT32 ipaddr, UINT16 port, UINT16 buffindex, UINT16 datalen)
+{
+	struct sockdesc* d;
+	INT8 sd;
+	
+	sd = sock_udpmap[cb];
+	
+	if( (sd < 0) || (event != UDP_EVENT_DATA) )
+		return(-1);
+	
+	d = &sock_table[sd];
+	
+	if(d->dgram.buf >= 0) {
+		DEBUGOUT("Unread datagram, new one dropped\r\n");
+		return(-1);
+	}
+	
+	if( net_view(&d->dgram, datalen) < 0 )
+		return(-1);
+	
+	if( net_view_retain(&d->dgram) < 0 ) {
+		net_view_release(&d->dgram);
+		return(-1);
+	}
+	
+	d->dgram_ip = ipaddr;
+	d->dgram_port = port;
+	
+	sock_wakeup(sd);
+	
+	return(1);
+
+}
@@ -69,6 +69,7 @@
 #include <inet/arch/config.h>
 #include <inet/datatypes.h>
 #include <inet/system.h>
+#include <inet/ethernet.h>
 #include <inet/debug.h>
 
 UINT32 base_timer;		/**< System 1.024 msec timer	*/
@@ -98,6 +99,21 @@ UINT8 sleep_mode = 0;	/**< Used to store information about power-saving state we
  */
 UINT8 net_buf[NETWORK_TX_BUFFER_SIZE];	/* Network transmit buffer	*/
 
+#if NET_NO_OF_VIEWBUFS > 0
+
+/** \brief Buffers holding received data for application views
+ *
+ *	See net_view(). Number and size of the buffers are defined by
+ *	#NET_NO_OF_VIEWBUFS and #NET_VIEWBUF_SIZE.
+ */
+struct
+{
+	UINT8 data[NET_VIEWBUF_SIZE];
+	UINT8 used;
+} net_viewbuf_pool[NET_NO_OF_VIEWBUFS];
+
+#endif
+
 /********************************************************************************
 Function:		strlen
 
@@ -527,6 +543,27 @@ UINT32 random (void)
 	return(0x345A2890);
 }
 
+/** \brief Scramble bits of 32-bit value
+ *	\date 19.10.2026
+ *	\param x value to scramble
+ *	\return Scrambled value
+ *
+ *	Every bit of the result depends on every bit of the argument. Used by
+ *	TCP and UDP to build values that remote hosts can't easily predict,
+ *	such as SYN cookies and local port numbers.
+ */
+UINT32 mix32 (UINT32 x)
+{
+	x ^= x >> 16;
+	x *= 0x045D9F3BL;
+	x ^= x >> 16;
+	x *= 0x045D9F3BL;
+	x ^= x >> 16;
+	
+	return(x);
+
+}
+
 /* Do nothing	*/
 
 void dummy (void)
@@ -580,4 +617,122 @@ void exit_power_save (void)
 	
 }
 
+/** \brief Get a view of received data
+ *	\date 19.10.2026
+ *	\param view pointer to view that is filled in
+ *	\param len number of bytes application wants to access
+ *	\return
+ *		\li -1 - data is in Ethernet controller and there are no free
+ *		view buffers, nothing was read
+ *		\li >=0 - number of bytes viewed
+ *
+ *	Invoke this function from TCP or UDP event listener instead of
+ *	reading data with RECEIVE_NETWORK_B() byte by byte. Data is read
+ *	from the current position just like RECEIVE_NETWORK_B() would.
+ *	If it is already in memory the view points to it, otherwise it is
+ *	copied, at most #NET_VIEWBUF_SIZE bytes at a time, to a view buffer
+ *	that stays valid until net_view_release(). Application should keep
+ *	invoking this function until it has viewed all the data it wants
+ *	and release every view it got.
+ */
+INT16 net_view (struct net_view* view, UINT16 len)
+{
+	view->buf = -1;
+	view->len = 0;
+	view->data = NETWORK_RECEIVE_POINTER(len);
+	
+	if(view->data) {
+		view->len = len;
+		return(len);
+	}
+	
+#if NET_NO_OF_VIEWBUFS > 0
+	for(view->buf = 0; view->buf < NET_NO_OF_VIEWBUFS; view->buf++) {
+		if( net_viewbuf_pool[view->buf].used == FALSE )
+			break;
+	}
+	
+	if( view->buf < NET_NO_OF_VIEWBUFS ) {
+		if( len > NET_VIEWBUF_SIZE )
+			len = NET_VIEWBUF_SIZE;
+		
+		net_viewbuf_pool[view->buf].used = TRUE;
+		view->data = net_viewbuf_pool[view->buf].data;
+		view->len = len;
+		
+		RECEIVE_NETWORK_BUF(view->data, len);
+		
+		return(len);
+	}
+	
+	view->buf = -1;
+#endif
+
+	return(-1);
+
+}
+
+/** \brief Keep view valid after event listener returns
+ *	\date 19.10.2026
+ *	\param view pointer to view obtained from net_view()
+ *	\return
+ *		\li -1 - no free view buffers, view is unchanged
+ *		\li 0 - view is valid until net_view_release()
+ *
+ *	Views of data in stack's memory point to it directly and are lost
+ *	when event listener returns. This function copies such data to a
+ *	view buffer so that application can process it later, for example
+ *	after a slow write to flash has completed.
+ */
+INT8 net_view_retain (struct net_view* view)
+{
+#if NET_NO_OF_VIEWBUFS > 0
+	INT8 i;
+	UINT16 j;
+	
+	if( view->buf >= 0 )
+		return(0);
+	
+	if( view->len > NET_VIEWBUF_SIZE )
+		return(-1);
+	
+	for(i=0; i < NET_NO_OF_VIEWBUFS; i++) {
+		if( net_viewbuf_pool[i].used == TRUE )
+			continue;
+		
+		net_viewbuf_pool[i].used = TRUE;
+		
+		for(j=0; j < view->len; j++)
+			net_viewbuf_pool[i].data[j] = view->data[j];
+		
+		view->data = net_viewbuf_pool[i].data;
+		view->buf = i;
+		
+		return(0);
+	}
+#endif
+
+	return(-1);
+
+}
+
+/** \brief Release view obtained from net_view()
+ *	\date 19.10.2026
+ *	\param view pointer to view being released
+ *
+ *	Returns view buffer held by the view (if any) to the pool. View
+ *	is empty afterwards.
+ */
+void net_view_release (struct net_view* view)
+{
+#if NET_NO_OF_VIEWBUFS > 0
+	if( (view->buf >= 0) && (view->buf < NET_NO_OF_VIEWBUFS) )
+		net_viewbuf_pool[view->buf].used = FALSE;
+#endif
+
+	view->buf = -1;
+	view->data = 0;
+	view->len = 0;
+
+}
 
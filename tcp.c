@@ -68,7 +68,6 @@
  *		\li	There's probably no need for that <b>+1</b> for determining
  *		the size of tcp_tempbuf. But if previous TODO is possible,
  *		this isn't important anyway.
- *		\li Implement per-socket window size (just add API function)
  *
  *	OpenTCP TCP implementation. All functions necessary for TCP
  *	processing are present here. Note that only a small subset
@@ -89,6 +88,7 @@
 #include <inet/ip.h>
 #include <inet/tcp_ip.h>
 #include <inet/system.h>
+#include <inet/globalvariables.h>
 
 /**	\brief Used for storing field information about the received TCP packet
  *	
@@ -117,7 +117,162 @@ struct tcp_frame received_tcp_packet;
  */
 struct tcb tcp_socket[NO_OF_TCPSOCKETS + 1]; 
 
-UINT8 tcp_tempbuf[MIN_TCP_HLEN + 1]; /**< Temporary buffer used for sending TCP control packets */
+UINT8 tcp_tempbuf[MIN_TCP_HLEN + MAX_TCP_OPTLEN + 1]; /**< Temporary buffer used for TCP headers of control packets and of data sent from separate buffers */
+
+/** \brief Connection lookup table
+ *
+ *	Sockets that have a connection (from SYN_RECEIVED or SYN_SENT until
+ *	TIMED_WAIT) are linked to a bucket selected by tcp_hash(). Every
+ *	bucket holds handle of the first socket, rest of them are linked
+ *	through tcb's hash_next field.
+ */
+INT8 tcp_conn_hash[TCP_HASH_SIZE];
+
+/** \brief Listening socket lookup table
+ *
+ *	Listening sockets are linked to a bucket selected by local port the
+ *	same way as in #tcp_conn_hash.
+ */
+INT8 tcp_listen_hash[TCP_LISTEN_HASH_SIZE];
+
+/** \brief Connection establishment statistics
+ *
+ *	Number of half-open connections decides whether connection requests
+ *	are answered with SYN cookies. See tcp_synstats for details.
+ */
+struct tcp_synstats tcp_syncounters;
+
+/** \brief Local port use table
+ *
+ *	Entry <i>p % #TCP_PORTMAP_SIZE</i> counts the sockets that have local
+ *	port <i>p</i>. Kept up to date by tcp_setlocport().
+ */
+UINT8 tcp_portuse[TCP_PORTMAP_SIZE];
+
+/** \brief Secret mixed into SYN cookies
+ *
+ *	Zero until the first SYN cookie is sent. Then seeded from the
+ *	microsecond clock at that moment, which is the least predictable
+ *	value available.
+ */
+UINT32 tcp_cookie_secret;
+
+/** \brief Maximum segment sizes SYN cookie can encode
+ *
+ *	Cookie carries an index to this table. The largest value not above
+ *	the MSS offered by the remote host is used.
+ */
+UINT16 tcp_cookie_mss[8] = { 216, 536, 1024, 1220, 1360, 1400, 1440, 1460 };
+
+/** \brief Queue of sockets tcp_poll() serves
+ *
+ *	Ring holding handles of sockets that have a timer expired or other
+ *	work pending, #tcp_nready of them starting from #tcp_readyq_head.
+ *	Socket is in the queue at most once (see tcb's ready field), so the
+ *	ring never overflows. Timers add sockets from interrupt, other
+ *	accesses are done with interrupts disabled.
+ */
+INT8 tcp_readyq[NO_OF_TCPSOCKETS];
+
+UINT8 tcp_readyq_head;	/**< First socket in #tcp_readyq		*/
+UINT8 tcp_nready;		/**< Number of sockets in #tcp_readyq	*/
+
+#if TCP_NO_OF_TWRECS > 0
+
+/** \brief Records of connections waiting in TIME_WAIT
+ *
+ *	See tcp_twrec definition. Unused records are linked to
+ *	#tcp_tw_freelist through their wheel_next field.
+ */
+struct tcp_twrec tcp_tw_pool[TCP_NO_OF_TWRECS];
+
+/** \brief TIME_WAIT record lookup table
+ *
+ *	Records are linked to a bucket selected by tcp_hash() the same way
+ *	as sockets in #tcp_conn_hash.
+ */
+INT8 tcp_tw_hash[TCP_HASH_SIZE];
+
+/** \brief TIME_WAIT timer wheel
+ *
+ *	Every slot holds the first of records expiring in the same second.
+ *	Each time timer #tcp_tw_timerh runs out the wheel is turned by one
+ *	slot and records in the slot reached are released.
+ */
+INT8 tcp_tw_wheel[TCP_TW_SLOTS];
+
+UINT8 tcp_tw_now;		/**< Current slot of TIME_WAIT timer wheel	*/
+INT8 tcp_tw_freelist;	/**< First unused TIME_WAIT record			*/
+UINT8 tcp_tw_timerh;	/**< Timer turning TIME_WAIT timer wheel	*/
+
+#endif
+
+#if TCP_NO_OF_SNDBUFS > 0
+
+/** \brief Pool of send buffers available to TCP sockets
+ *
+ *	Sockets that don't want to regenerate unacknowledged data themselves
+ *	obtain a buffer from this pool with tcp_setopt() (#TCP_OPT_SEND_BUFFER).
+ *	Every buffer is used as a ring holding the socket's data starting
+ *	from the oldest unacknowledged byte. Number and size of the buffers
+ *	are defined by #TCP_NO_OF_SNDBUFS and #TCP_SNDBUF_SIZE.
+ */
+struct
+{
+	UINT8 data[TCP_SNDBUF_SIZE];
+	UINT8 free;
+} tcp_sndbuf_pool[TCP_NO_OF_SNDBUFS];
+
+#endif
+
+#if TCP_NO_OF_REASMBUFS > 0
+
+/** \brief Pool of reassembly buffers available to TCP sockets
+ *
+ *	Socket that receives data out of order obtains a buffer from this
+ *	pool and keeps the data there until the missing data arrives.
+ *	Every buffer is used as a ring, data with sequence number <i>s</i>
+ *	stored at offset <i>(s - reasm_seq) % #TCP_REASM_SIZE</i>.
+ */
+struct
+{
+	UINT8 data[TCP_REASM_SIZE];
+	UINT8 free;
+} tcp_reasm_pool[TCP_NO_OF_REASMBUFS];
+
+#endif
+
+#if TCP_NO_OF_RCVBUFS > 0
+
+/** \brief Pool of receive buffers available to TCP sockets
+ *
+ *	Sockets whose applications read the received data with tcp_recv()
+ *	obtain a buffer from this pool with tcp_setopt()
+ *	(#TCP_OPT_RECV_BUFFER). Every buffer is used as a ring holding the
+ *	data application hasn't read yet.
+ */
+struct
+{
+	UINT8 data[TCP_RCVBUF_SIZE];
+	UINT8 free;
+} tcp_rcvbuf_pool[TCP_NO_OF_RCVBUFS];
+
+#endif
+
+#if TCP_NO_OF_REGIONS > 0
+
+/** \brief Storage regions registered for tcp_sendfile()
+ *
+ *	Memory-mapped areas (internal flash, ROM) whose content sockets send
+ *	with tcp_sendfile(). Entry whose base is 0 is free.
+ */
+struct
+{
+	UINT8* base;
+	UINT32 len;
+} tcp_region[TCP_NO_OF_REGIONS];
+
+#endif
 
 
 /***********************************************************************/
@@ -135,6 +290,10 @@ UINT8 tcp_tempbuf[MIN_TCP_HLEN + 1]; /**< Temporary buffer used for sending TCP
  *		\li #TCP_TYPE_SERVER
  *		\li #TCP_TYPE_CLIENT
  *		\li #TCP_TYPE_CLIENT_SERVER
+ *		
+ *		Congestion control algorithm of the socket can be selected by
+ *		OR-ing the type with #TCP_TYPE_CC_NEWRENO (default) or
+ *		#TCP_TYPE_CC_CUBIC.
  *	\param tos type of service for socket. For now only #TCP_TOS_NORMAL.
  *	\param tout Timeout of socket in seconds. Defines after how many seconds
  *		of inactivity (application not sending and/or receiving any data
@@ -156,6 +315,7 @@ INT8 tcp_getsocket (UINT8 soctype, UINT8 tos, UINT16 tout, INT32 (*listener)(INT
 {
 	INT8 i;
 	struct tcb* soc;
+	struct tcp_cc_ops* cc;
 	
 	if( NO_OF_TCPSOCKETS < 0 )
 		return(-1);
@@ -163,6 +323,15 @@ INT8 tcp_getsocket (UINT8 soctype, UINT8 tos, UINT16 tout, INT32 (*listener)(INT
 	if( NO_OF_TCPSOCKETS == 0 )
 		return(-1);
 	
+	cc = tcp_cc_select(soctype);
+	
+	if(cc == 0) {
+		TCP_DEBUGOUT("Invalid congestion control requested\r\n");
+		return(-1);
+	}
+	
+	soctype &= ~TCP_TYPE_CC_MASK;
+	
 	if( (soctype != TCP_TYPE_SERVER) &&
 		(soctype != TCP_TYPE_CLIENT) &&
 		(soctype != TCP_TYPE_CLIENT_SERVER) &&
@@ -192,9 +361,14 @@ INT8 tcp_getsocket (UINT8 soctype, UINT8 tos, UINT16 tout, INT32 (*listener)(INT
 			soc->event_listener = listener;
 			soc->rem_ip = 0;
 			soc->remport = 0;
-			soc->locport = 0;
+			tcp_setlocport(soc, 0);
 			soc->flags = 0;
 			soc->tout = tout*TIMERTIC;
+			soc->send_budget = TCP_DEF_SEND_WINDOW;
+			soc->rcv_wnd = TCP_DEF_RECV_WINDOW;
+			soc->coalesce = 0;
+			soc->backlog = 0;
+			soc->cc = cc;
 			
 			return(i);
 		}
@@ -228,6 +402,7 @@ INT8 tcp_getsocket (UINT8 soctype, UINT8 tos, UINT16 tout, INT32 (*listener)(INT
 INT8 tcp_releasesocket (INT8 sochandle)
 {
 	struct tcb* soc;
+	INT8 i;
 	
 	if( NO_OF_TCPSOCKETS < 0 )
 		return(-1);
@@ -256,14 +431,43 @@ INT8 tcp_releasesocket (INT8 sochandle)
 	
 	/* We are there so all OK	*/
 	
+	/* Connections of listening socket nobody has accepted go with it	*/
+	
+	for(i=0; (soc->npending != 0) && (i < NO_OF_TCPSOCKETS); i++) {
+		if(tcp_socket[i].parent != sochandle)
+			continue;
+		
+		tcp_abort(i);
+		tcp_socket[i].event_listener(i, TCP_EVENT_ABORT, tcp_socket[i].rem_ip, tcp_socket[i].remport);
+		tcp_releasesocket(i);
+	}
+	
+	tcp_unqueue(soc);
+	
 	soc->state = TCP_STATE_FREE;
 	soc->type = TCP_TYPE_NONE;
 	soc->tos = 0;
 	soc->event_listener = 0;
 	soc->rem_ip = 0;
 	soc->remport = 0;
-	soc->locport = 0;
+	tcp_setlocport(soc, 0);
 	soc->flags = 0;
+	soc->backlog = 0;
+	tcp_rehash(soc);
+	
+	/* Return send buffer to the pool	*/
+	
+	tcp_sndbuf_free(soc->sndbuf);
+	soc->sndbuf = -1;
+	soc->sndbuf_len = 0;
+	soc->file = -1;
+	soc->coalesce = 0;
+	
+	tcp_rcvbuf_free(soc->rcvbuf);
+	soc->rcvbuf = -1;
+	soc->rcvbuf_len = 0;
+	
+	tcp_reasm_clear(soc);
 	
 	return(sochandle);
 
@@ -337,13 +541,14 @@ INT8 tcp_listen (INT8 sochandle, UINT16 port)
 	soc->flags = 0;
 	soc->rem_ip = 0;
 	soc->remport = 0;
-	soc->locport = port;
+	tcp_setlocport(soc, port);
 	soc->send_unacked = 0;
 	soc->myflags = 0;
 	soc->send_next = 0xFFFFFFFF;
 	soc->send_mtu = TCP_DEF_MTU;
 	soc->receive_next = 0;
 	soc->retries_left = 0;
+	tcp_rehash(soc);
 			
 	TCP_DEBUGOUT("TCP listening socket created\r\n");
 			
@@ -352,6 +557,100 @@ INT8 tcp_listen (INT8 sochandle, UINT16 port)
 }
 
 
+/** \brief Take established connection from listening socket
+ *  \ingroup tcp_app_api
+ *	\date 19.10.2026
+ *	\param sochandle handle to listening socket
+ *	\return
+ *		\li -1 - Error (invalid socket handle or no connections waiting)
+ *		\li >=0 - Handle to the connection
+ *
+ *	Listening socket with a backlog (see #TCP_OPT_BACKLOG) allocates a
+ *	new socket for every connection request. Once the connection is
+ *	established it is queued on the listening socket and this function
+ *	returns the oldest one. Event listener sees the events of the
+ *	connection with its own handle already before that, so application
+ *	can as well invoke tcp_accept() when it gets #TCP_EVENT_CONNECTED.
+ *
+ *	Accepted connection belongs to the application which must release it
+ *	with tcp_releasesocket() once it's closed. Connections that are
+ *	closed before they are accepted are released by TCP.
+ */
+INT8 tcp_accept (INT8 sochandle)
+{
+	struct tcb* soc;
+	INT8 i;
+	
+	if( NO_OF_TCPSOCKETS < 0 )
+		return(-1);
+	
+	if( NO_OF_TCPSOCKETS == 0 )
+		return(-1);
+	
+	if( sochandle >= NO_OF_TCPSOCKETS ) {
+		TCP_DEBUGOUT("Socket handle non-valid\r\n");
+		return(-1);
+	}
+	
+	if( sochandle < 0 ) {
+		TCP_DEBUGOUT("Socket handle non-valid\r\n");
+		return(-1);
+	}
+	
+	/* Oldest connection that is not already closed	*/
+	
+	for(i = tcp_socket[sochandle].acceptq; i >= 0; i = soc->qnext) {
+		soc = &tcp_socket[i];
+		
+		if(soc->state == TCP_STATE_CLOSED)
+			continue;
+		
+		tcp_unqueue(soc);
+		
+		return(i);
+	}
+	
+	return(-1);
+
+}
+
+/** \brief Get listening socket a connection was received on
+ *  \ingroup tcp_app_api
+ *	\date 19.10.2026
+ *	\param sochandle handle to the connection
+ *	\return
+ *		\li -1 - Error (invalid socket handle) or socket is not a
+ *		connection waiting for tcp_accept()
+ *		\li >=0 - Handle to the listening socket
+ *
+ *	Connections allocated by a listening socket with a backlog (see
+ *	#TCP_OPT_BACKLOG) share its event listener. Listener can use this
+ *	function to find out which listening socket an event of a connection
+ *	that is not accepted yet relates to.
+ */
+INT8 tcp_getparent (INT8 sochandle)
+{
+	if( NO_OF_TCPSOCKETS < 0 )
+		return(-1);
+	
+	if( NO_OF_TCPSOCKETS == 0 )
+		return(-1);
+	
+	if( sochandle >= NO_OF_TCPSOCKETS ) {
+		TCP_DEBUGOUT("Socket handle non-valid\r\n");
+		return(-1);
+	}
+	
+	if( sochandle < 0 ) {
+		TCP_DEBUGOUT("Socket handle non-valid\r\n");
+		return(-1);
+	}
+	
+	return(tcp_socket[sochandle].parent);
+
+}
+
+
 /** \brief Initialize connection establishment towards remote IP&port
  *  \ingroup tcp_app_api
  * 	\author 
@@ -431,7 +730,7 @@ INT8 tcp_connect (INT8 sochandle, UINT32 ip, UINT16 rport, UINT16 myport )
 	
 	soc->rem_ip = ip;
 	soc->remport = rport;
-	soc->locport = myport;
+	tcp_setlocport(soc, myport);
 	soc->flags = 0;
 	soc->send_mtu = TCP_DEF_MTU;
 	
@@ -439,6 +738,7 @@ INT8 tcp_connect (INT8 sochandle, UINT32 ip, UINT16 rport, UINT16 myport )
 	
 	soc->send_unacked = tcp_initseq(); 
 	soc->send_next = soc->send_unacked + 1;
+	tcp_rtt_init(soc);
 	soc->myflags = TCP_FLAG_SYN;
 	tcp_sendcontrol(sochandle);
 	tcp_newstate(soc, TCP_STATE_SYN_SENT);
@@ -462,26 +762,36 @@ INT8 tcp_connect (INT8 sochandle, UINT32 ip, UINT16 rport, UINT16 myport )
  *		\li -1 - Error
  *		\li >0 - OK (number represents number of bytes actually sent)
  *
- *	\warning
- *		\li <i>buf</i> parameter is a pointer to data to be sent in 
- *		user buffer. But note that there <b>MUST</b> be sufficient
- *		free buffer space before that data for TCP header (of #MIN_TCP_HLEN
- *		size). 
+ *	\note
+ *		\li Earlier versions required free buffer space of #TCP_APP_OFFSET
+ *		bytes before the data for TCP header and options. This is not
+ *		needed any more since the header is built separately and data is
+ *		sent directly from <i>buf</i> (see tcp_sendv()).
  *
  *	Invoke this function to initiate data sending over TCP connection
- *	established over a TCP socket. Since data is not buffered (in order
- *	to reduce RAM memory consumption) new data can not be sent until
- *	data that was previously sent is acknowledged. So, application knows when
- *	it can send new data either by:
+ *	established over a TCP socket. Unless the socket has a send buffer
+ *	(see #TCP_OPT_SEND_BUFFER) data is not buffered (in order to reduce
+ *	RAM memory consumption) and application must be able to
+ *	regenerate all of the unacknowledged data (see #TCP_EVENT_REGENERATE).
+ *	If the socket has a send buffer, data is copied to it and sent as
+ *	the send window allows, so the return value tells how much of the
+ *	data fit in the buffer.
+ *	Several packets may be sent before they are acknowledged, as long as
+ *	they fit in the send window (smaller of the window advertised by the
+ *	remote host and socket's #TCP_OPT_SEND_WINDOW setting). Data longer than
+ *	the maximum segment size is sent in several segments. If data doesn't
+ *	fit in the window completely only the part that fits is sent. So,
+ *	application knows when it can send new data either by:
  *		\li waiting for TCP_EVENT_ACK in event_listener function
- *		\li invoking tcp_check_send() function to check if it is possible
+ *		\li invoking tcp_checksend() function to check if it is possible
  *			to send data
  *
  */
 INT16 tcp_send (INT8 sockethandle, UINT8* buf, UINT16 blen, UINT16 dlen)
 {
 	struct tcb* soc;
-	UINT8 i;
+	struct ip_iovec iov;
+	UINT16 room;
 
 	
 	TCP_DEBUGOUT("Entering to send TCP data packet\r\n");
@@ -505,126 +815,449 @@ INT16 tcp_send (INT8 sockethandle, UINT8* buf, UINT16 blen, UINT16 dlen)
 		return(-1);
 	}
 	
-	if(soc->send_unacked != soc->send_next) {
-		TCP_DEBUGOUT("TCP contains unacked data, cannot send more\r\n");
+	if(soc->file >= 0) {
+		TCP_DEBUGOUT("TCP is sending file, cannot send more\r\n");
 		return(-1);
 	}
 	
 	if( dlen > blen )
 		dlen = blen;
 	
-	if(dlen + MIN_TCP_HLEN > soc->send_mtu) {
-		if(soc->send_mtu > MIN_TCP_HLEN)
-			dlen = soc->send_mtu - MIN_TCP_HLEN;
-		else
+	/* Socket with send buffer? Store data to buffer and send from there	*/
+	
+	if(soc->sndbuf >= 0) {
+		room = TCP_SNDBUF_SIZE - soc->sndbuf_len;
+		
+		if(room == 0) {
+			TCP_DEBUGOUT("TCP send buffer full, cannot send more\r\n");
 			return(-1);
+		}
+		
+		if( dlen > room )
+			dlen = room;
+		
+		tcp_sndbuf_write(soc, buf, dlen);
+		tcp_sndbuf_output(sockethandle);
+		
+		return(dlen);
 	}
 	
-	soc->send_next += dlen;
-	
-	soc->myflags = TCP_FLAG_ACK | TCP_FLAG_PUSH;
-	process_tcp_out(sockethandle, buf - MIN_TCP_HLEN, blen + MIN_TCP_HLEN + 1, dlen);
+	iov.data = buf;
+	iov.len = dlen;
 	
-	return(dlen);
+	return( tcp_sendv(sockethandle, &iov, 1) );
 }
 
 
-/** \brief Initiate TCP connection closing procedure
- *  \ingroup tcp_app_api
- * 	\author 
- *		\li Jari Lahti (jari.lahti@violasystems.com)
- *	\date 21.07.2002
- *	\param sochandle handle to socket on which TCP connection is to be closed
- *	\return 
- *		\li -2 - there is unacked data on this socket. Try again later.
- *		\li -1 - Error
- *		\li >=0 - OK (connection closing procedure started. Handle to socket
- *			returned)
+/** \brief Send user data from several buffers over TCP
+ *	\ingroup tcp_app_api
+ *	\date 19.10.2026
+ *	\param sockethandle handle to TCP socket to be used for sending data
+ *	\param iov buffers holding the data, sent in the given order
+ *	\param cnt number of buffers (at most #TCP_SENDV_MAX)
+ *	\return
+ *		\li -1 - Error (socket not connected, too many buffers, send
+ *		window or send buffer full)
+ *		\li >0 - OK (number represents number of bytes actually sent)
  *
- *	Invoke this function to start connetion closing procedure over a given
- *	socket. Note that connection is not immediately closed. It may take some
- *	time for that to happen. Event_listener function will be invoked with 
- *	appropriate event when that really happens.
+ *	Works like tcp_send() but the data may be scattered over several
+ *	buffers (protocol header, payload from ROM and trailer for example)
+ *	and the buffers don't need free space before them. Data is divided to
+ *	segments of maximum segment size and every segment is written to the
+ *	Ethernet controller straight from the buffers, TCP header and
+ *	checksum being computed for each segment without copying the data
+ *	together first. Only the part that fits in the send window is sent.
+ *
+ *	If the socket has a send buffer (see #TCP_OPT_SEND_BUFFER) data is
+ *	copied there as with tcp_send(). Otherwise application must be able
+ *	to send the same data again on #TCP_EVENT_REGENERATE.
  */
-INT8 tcp_close (INT8 sochandle)
+INT16 tcp_sendv (INT8 sockethandle, struct ip_iovec* iov, UINT8 cnt)
 {
 	struct tcb* soc;
+	struct ip_iovec seg[TCP_SENDV_MAX];
+	UINT16 total;
+	UINT16 sent;
+	UINT16 room;
+	UINT16 len;
+	UINT16 left;
+	UINT16 pos;
+	UINT8 i;
+	UINT8 n;
 	
-	TCP_DEBUGOUT("FUNCTION: tcp_close\r\n");
-
-	if( NO_OF_TCPSOCKETS < 0 )
+	TCP_DEBUGOUT("Entering to send TCP data from several buffers\r\n");
+	
+	kick_WD();
+	
+	if( (sockethandle < 0) || (sockethandle >= NO_OF_TCPSOCKETS) ) {
+		TCP_DEBUGOUT("ERROR:Socket Handle not valid\r\n");
 		return(-1);
+	}
 	
-	if( NO_OF_TCPSOCKETS == 0 )
+	if( cnt > TCP_SENDV_MAX ) {
+		TCP_DEBUGOUT("ERROR:Too many buffers\r\n");
 		return(-1);
+	}
 	
-	if( sochandle > NO_OF_TCPSOCKETS ) {
-		TCP_DEBUGOUT("Socket handle non-valid\r\n");
+	soc = &tcp_socket[sockethandle];
+	
+	if(soc->state != TCP_STATE_CONNECTED) {
+		TCP_DEBUGOUT("TCP is not connected!!\r\n");
 		return(-1);
 	}
 	
-	if( sochandle < 0 ) {
-		TCP_DEBUGOUT("Socket handle non-valid\r\n");
+	if(soc->file >= 0) {
+		TCP_DEBUGOUT("TCP is sending file, cannot send more\r\n");
 		return(-1);
 	}
 	
-	soc = &tcp_socket[sochandle];		/* Get referense	*/	
+	total = 0;
 	
-	switch(soc->state) {
-		case TCP_STATE_LISTENING:
-			tcp_newstate(soc, TCP_STATE_CLOSED);
-			break;
+	for(i=0; i < cnt; i++) {
+		if( iov[i].len > 0xFFFF - total )
+			return(-1);
 		
-		case TCP_STATE_SYN_RECEIVED:
-			soc->myflags = TCP_FLAG_ACK | TCP_FLAG_FIN;
-			soc->send_unacked++;
-			soc->send_next++;
-			tcp_sendcontrol(sochandle);
-			tcp_newstate(soc, TCP_STATE_FINW1);
-			break;
+		total += iov[i].len;
+	}
+	
+	sent = 0;
+	
+	/* Socket with send buffer? Store data to buffer and send from there	*/
+	
+	if(soc->sndbuf >= 0) {
+		for(i=0; i < cnt; i++) {
+			len = TCP_SNDBUF_SIZE - soc->sndbuf_len;
+			
+			if( len > iov[i].len )
+				len = iov[i].len;
+			
+			if(len == 0)
+				break;
+			
+			tcp_sndbuf_write(soc, iov[i].data, len);
+			sent += len;
+		}
 		
-		case TCP_STATE_SYN_SENT:
+		if( (sent == 0) && (total) ) {
+			TCP_DEBUGOUT("TCP send buffer full, cannot send more\r\n");
+			return(-1);
+		}
 		
-			tcp_newstate(soc, TCP_STATE_CLOSED);
+		tcp_sndbuf_output(sockethandle);
+		
+		return(sent);
+	}
+	
+	if(soc->send_mtu <= MIN_TCP_HLEN)
+		return(-1);
+	
+	/* Send a segment at a time as long as window allows	*/
+	
+	i = 0;
+	pos = 0;
+	
+	while(sent < total) {
+		room = tcp_sendroom(soc);
 		
+		if(room == 0)
 			break;
 		
-		case TCP_STATE_FINW1:
-		case TCP_STATE_FINW2:
-		case TCP_STATE_CLOSING:
-		case TCP_STATE_TIMED_WAIT:
-		case TCP_STATE_LAST_ACK:
+		len = total - sent;
 		
-			/* We are closing already	*/
-			
-			break;
+		if(len > room)
+			len = room;
 		
-		case TCP_STATE_CONNECTED:
+		if(len > soc->send_mtu - MIN_TCP_HLEN)
+			len = soc->send_mtu - MIN_TCP_HLEN;
 		
-			/* Is there unacked data?	*/
+		/* Describe the pieces of buffers this segment consists of	*/
+		
+		n = 0;
+		
+		for(left = len; left > 0; ) {
+			seg[n].data = iov[i].data + pos;
+			seg[n].len = iov[i].len - pos;
 			
-			if(soc->send_unacked == soc->send_next ) {
-				/* There is no unacked data	*/
-				
-				soc->myflags = TCP_FLAG_ACK | TCP_FLAG_FIN;
-				soc->send_next++;
-				tcp_sendcontrol(sochandle);
-				tcp_newstate(soc, TCP_STATE_FINW1);				
-			} else {
-				/* Can't do much but raise pollable flag to soc->flags		*/
-				/* and process it on tcp_poll								*/
-				
-				soc->flags |= TCP_INTFLAGS_CLOSEPENDING;
-				
-				
-				return(sochandle);
+			if(seg[n].len > left)
+				seg[n].len = left;
+			
+			left -= seg[n].len;
+			pos += seg[n].len;
+			
+			if(pos == iov[i].len) {
+				i++;
+				pos = 0;
 			}
+			
+			if(seg[n].len)
+				n++;
+		}
 		
-			break;
-	
-		default:
-			return(-1);
-	}
+		/* Start retransmission timer if this is the first packet in flight	*/
+		
+		if(soc->send_unacked == soc->send_next)
+			init_timer(soc->retransmit_timerh, soc->rto);
+		
+		soc->send_next += len;
+		tcp_rtt_sent(soc, len);
+		
+		soc->myflags = TCP_FLAG_ACK;
+		
+		if(sent + len == total)
+			soc->myflags |= TCP_FLAG_PUSH;
+		
+		tcp_sendseg(sockethandle, &tcp_tempbuf[0], TCP_APP_OFFSET, seg, n);
+		
+		sent += len;
+	}
+	
+	if( (sent == 0) && (total) ) {
+		TCP_DEBUGOUT("TCP send window full, cannot send more\r\n");
+		return(-1);
+	}
+	
+	return(sent);
+
+}
+
+
+/** \brief Send content of a storage region over TCP
+ *	\ingroup tcp_app_api
+ *	\date 19.10.2026
+ *	\param sochandle handle to TCP socket to be used for sending data
+ *	\param region storage region handle given by tcp_region_register()
+ *	\param offset offset of the first byte to send within the region
+ *	\param len number of bytes to send
+ *	\return
+ *		\li -2 - there is unacked data on this socket. Try again later.
+ *		\li -1 - Error (socket not connected, invalid region or range)
+ *		\li >=0 - OK (sending started. Handle to socket returned)
+ *
+ *	Invoke this function to send static content kept in flash or ROM
+ *	(web pages, files served by TFTP, canned mail bodies...). TCP sends
+ *	the data straight from the region as the send window allows and also
+ *	retransmits lost data from there, so application doesn't need to
+ *	copy the data to net_buf nor regenerate it. #TCP_EVENT_ACK is given
+ *	once all of it has been acknowledged. Until then other data can't be
+ *	sent on the socket (tcp_send() returns -1), but tcp_close() may be
+ *	invoked and the connection is closed after the last byte is sent.
+ */
+INT8 tcp_sendfile (INT8 sochandle, INT8 region, UINT32 offset, UINT32 len)
+{
+#if TCP_NO_OF_REGIONS > 0
+	struct tcb* soc;
+	
+	if( (sochandle < 0) || (sochandle >= NO_OF_TCPSOCKETS) ) {
+		TCP_DEBUGOUT("ERROR:Socket Handle not valid\r\n");
+		return(-1);
+	}
+	
+	if( (region < 0) || (region >= TCP_NO_OF_REGIONS) )
+		return(-1);
+	
+	if(tcp_region[region].base == 0)
+		return(-1);
+	
+	if( (offset > tcp_region[region].len) ||
+		(len > tcp_region[region].len - offset) ) {
+		TCP_DEBUGOUT("ERROR:File doesn't fit in storage region\r\n");
+		return(-1);
+	}
+	
+	soc = &tcp_socket[sochandle];
+	
+	if(soc->state != TCP_STATE_CONNECTED) {
+		TCP_DEBUGOUT("TCP is not connected!!\r\n");
+		return(-1);
+	}
+	
+	/* File is sent alone, after earlier data is acknowledged	*/
+	
+	if( (soc->send_unacked != soc->send_next) ||
+		(soc->sndbuf_len != 0) || (soc->file >= 0) )
+		return(-2);
+	
+	if(len == 0)
+		return(sochandle);
+	
+	/* Part of file is counted in sndbuf_len so that it is sent and	*/
+	/* retransmitted like data in send buffer						*/
+	
+	soc->file = region;
+	soc->file_pos = offset;
+	soc->sndbuf_len = (len > 0x7FFF) ? 0x7FFF : (UINT16)len;
+	soc->file_rest = len - soc->sndbuf_len;
+	
+	tcp_sndbuf_output(sochandle);
+	
+	return(sochandle);
+#else
+	return(-1);
+#endif
+
+}
+
+
+/** \brief Register storage region for tcp_sendfile()
+ *	\ingroup tcp_app_api
+ *	\date 19.10.2026
+ *	\param base address of the region (memory-mapped flash or ROM)
+ *	\param len length of the region in bytes
+ *	\return
+ *		\li -1 - Error (no free region entries)
+ *		\li >=0 - storage region handle
+ *
+ *	Content of the region must not change while it is being sent.
+ */
+INT8 tcp_region_register (UINT8* base, UINT32 len)
+{
+#if TCP_NO_OF_REGIONS > 0
+	INT8 i;
+	
+	if(base == 0)
+		return(-1);
+	
+	for(i=0; i < TCP_NO_OF_REGIONS; i++) {
+		if(tcp_region[i].base == 0) {
+			tcp_region[i].base = base;
+			tcp_region[i].len = len;
+			return(i);
+		}
+	}
+	
+	TCP_DEBUGOUT("No free storage region entries\r\n");
+#endif
+
+	return(-1);
+
+}
+
+
+/** \brief Remove storage region registered with tcp_region_register()
+ *	\ingroup tcp_app_api
+ *	\date 19.10.2026
+ *	\param region storage region handle
+ *
+ *	Sockets still sending from the region are aborted.
+ */
+void tcp_region_unregister (INT8 region)
+{
+#if TCP_NO_OF_REGIONS > 0
+	INT8 i;
+	
+	if( (region < 0) || (region >= TCP_NO_OF_REGIONS) )
+		return;
+	
+	for(i=0; i < NO_OF_TCPSOCKETS; i++) {
+		if(tcp_socket[i].file == region)
+			tcp_abort(i);
+	}
+	
+	tcp_region[region].base = 0;
+#endif
+
+}
+
+
+/** \brief Initiate TCP connection closing procedure
+ *  \ingroup tcp_app_api
+ * 	\author 
+ *		\li Jari Lahti (jari.lahti@violasystems.com)
+ *	\date 21.07.2002
+ *	\param sochandle handle to socket on which TCP connection is to be closed
+ *	\return 
+ *		\li -2 - there is unacked data on this socket. Try again later.
+ *		\li -1 - Error
+ *		\li >=0 - OK (connection closing procedure started. Handle to socket
+ *			returned)
+ *
+ *	Invoke this function to start connetion closing procedure over a given
+ *	socket. Note that connection is not immediately closed. It may take some
+ *	time for that to happen. Event_listener function will be invoked with 
+ *	appropriate event when that really happens.
+ */
+INT8 tcp_close (INT8 sochandle)
+{
+	struct tcb* soc;
+	
+	TCP_DEBUGOUT("FUNCTION: tcp_close\r\n");
+
+	if( NO_OF_TCPSOCKETS < 0 )
+		return(-1);
+	
+	if( NO_OF_TCPSOCKETS == 0 )
+		return(-1);
+	
+	if( sochandle > NO_OF_TCPSOCKETS ) {
+		TCP_DEBUGOUT("Socket handle non-valid\r\n");
+		return(-1);
+	}
+	
+	if( sochandle < 0 ) {
+		TCP_DEBUGOUT("Socket handle non-valid\r\n");
+		return(-1);
+	}
+	
+	soc = &tcp_socket[sochandle];		/* Get referense	*/	
+	
+	switch(soc->state) {
+		case TCP_STATE_LISTENING:
+			tcp_newstate(soc, TCP_STATE_CLOSED);
+			break;
+		
+		case TCP_STATE_SYN_RECEIVED:
+			soc->myflags = TCP_FLAG_ACK | TCP_FLAG_FIN;
+			soc->send_unacked++;
+			soc->send_next++;
+			tcp_sendcontrol(sochandle);
+			tcp_newstate(soc, TCP_STATE_FINW1);
+			break;
+		
+		case TCP_STATE_SYN_SENT:
+		
+			tcp_newstate(soc, TCP_STATE_CLOSED);
+		
+			break;
+		
+		case TCP_STATE_FINW1:
+		case TCP_STATE_FINW2:
+		case TCP_STATE_CLOSING:
+		case TCP_STATE_TIMED_WAIT:
+		case TCP_STATE_LAST_ACK:
+		
+			/* We are closing already	*/
+			
+			break;
+		
+		case TCP_STATE_CONNECTED:
+		
+			/* Is there unacked data?	*/
+			
+			if( (soc->send_unacked == soc->send_next) &&
+				(soc->sndbuf_len == 0)					) {
+				/* There is no unacked data	*/
+				
+				soc->myflags = TCP_FLAG_ACK | TCP_FLAG_FIN;
+				soc->send_next++;
+				tcp_sendcontrol(sochandle);
+				tcp_newstate(soc, TCP_STATE_FINW1);				
+			} else {
+				/* Can't do much but raise pollable flag to soc->flags		*/
+				/* and process it on tcp_poll								*/
+				
+				soc->flags |= TCP_INTFLAGS_CLOSEPENDING;
+				soc->coalesce |= TCP_COALESCE_FLUSH;
+				tcp_wakeup(sochandle);
+				
+				
+				return(sochandle);
+			}
+		
+			break;
+	
+		default:
+			return(-1);
+	}
 	
 	return(sochandle);
 
@@ -679,9 +1312,11 @@ INT8 tcp_getstate (INT8 sochandle)
  *	\date 23.07.2002
  *	\param sochandle handle to the socket to be inspected
  *	\return
- *		\li -1 - not possible to send over a socket (previously sent data is
- *		still not akcnowledged)
- *		\li >0 - it is possible to send data over a socket
+ *		\li -1 - not possible to send over a socket (send window is full of
+ *		data that is still not akcnowledged)
+ *		\li >0 - it is possible to send data over a socket. Value is the
+ *		maximum number of bytes tcp_send() will accept at the moment
+ *		(free space in send buffer if socket has one)
  *
  *	Invoke this function to get information whether it is possible to send
  *	data or not. This may, sometimes, be preffered way of getting this type
@@ -690,6 +1325,7 @@ INT8 tcp_getstate (INT8 sochandle)
 INT16 tcp_checksend (INT8 sochandle)
 {
 	struct tcb* soc;
+	UINT16 room;
 
 	if( NO_OF_TCPSOCKETS < 0 )
 		return(-1);
@@ -702,42 +1338,70 @@ INT16 tcp_checksend (INT8 sochandle)
 		return(-1);
 	}
 	
+	if( sochandle < 0 ) {
+		TCP_DEBUGOUT("Socket handle non-valid\r\n");
+		return(-1);
+	}
+	
 	soc = &tcp_socket[sochandle];		/* Get referense	*/	
 	
 	if(soc->state != TCP_STATE_CONNECTED)
 		return(-1);
+	
+	/* File is sent alone	*/
+	
+	if(soc->file >= 0)
+		return(-1);
+	
+	if(soc->sndbuf >= 0) {
+		room = TCP_SNDBUF_SIZE - soc->sndbuf_len;
+		
+		if(room == 0)
+			return(-1);
+		
+		if(room > 0x7FFF)
+			room = 0x7FFF;
+		
+		return((INT16)room);
+	}
 
-	if(soc->send_unacked == soc->send_next)
-		return(soc->send_mtu);
+	room = tcp_sendroom(soc);
 	
-	return(-1);
+	if(room == 0)
+		return(-1);
+	
+	if(room > soc->send_mtu - MIN_TCP_HLEN)
+		room = soc->send_mtu - MIN_TCP_HLEN;
+	
+	return((INT16)room);
 
 
 }
 
-
-
-/** \brief Reset connection and place socket to closed state
+/** \brief Read data from socket's receive buffer
  *  \ingroup tcp_app_api
- * 	\author 
- *		\li Jari Lahti (jari.lahti@violasystems.com)
- *	\date 21.07.2002
- *	\param sochandle handle to socket to be aborted
+ *	\date 19.10.2026
+ *	\param sochandle handle to the socket to read from
+ *	\param buf pointer to buffer where data is copied
+ *	\param len maximum number of bytes to read
  *	\return
- *		\li -1 - error
- *		\li >=0 - OK (value represents handle to aborted socket)
+ *		\li -1 - Error (invalid socket handle or socket has no receive
+ *		buffer)
+ *		\li >=0 - number of bytes read
  *
- *	Use this function in cases when TCP connection must be immediately closed.
- *	Note that the preffered (more elegant) way of closing the TCP connection
- *	is to invoke tcp_close() which starts a proper closing procedure.
- *	tcp_abort should be used only in cases when it is really necessary to 
- *	immediately and quickly close the connection.
+ *	Sockets with a receive buffer (see #TCP_OPT_RECV_BUFFER) keep the
+ *	received data until application reads it with this function. Data
+ *	received before remote host closed the connection can still be read
+ *	after #TCP_EVENT_CLOSE, until the socket is connected again. Reading
+ *	opens the receive window.
  */
-INT8 tcp_abort (INT8 sochandle)
+INT16 tcp_recv (INT8 sochandle, UINT8* buf, UINT16 len)
 {
 	struct tcb* soc;
-	
-	TCP_DEBUGOUT("FUNCTION: tcp_abort\r\n");
+#if TCP_NO_OF_RCVBUFS > 0
+	UINT8* dat;
+	UINT16 i;
+#endif
 
 	if( NO_OF_TCPSOCKETS < 0 )
 		return(-1);
@@ -755,1745 +1419,5085 @@ INT8 tcp_abort (INT8 sochandle)
 		return(-1);
 	}
 	
-	soc = &tcp_socket[sochandle];		/* Get referense	*/	
-
-	switch (soc->state)	{
-		case TCP_STATE_FREE:
-			return(-1);
-			
-		case TCP_STATE_RESERVED:
-		case TCP_STATE_CLOSED:
-			return(sochandle);
-		
-		case TCP_STATE_TIMED_WAIT:
-		case TCP_STATE_LISTENING:
-			tcp_newstate(soc, TCP_STATE_CLOSED);
-			return(sochandle);
-		
-		case TCP_STATE_SYN_SENT:
-		case TCP_STATE_SYN_RECEIVED:
-		case TCP_STATE_CONNECTED:
-		case TCP_STATE_FINW1:
-		case TCP_STATE_FINW2:
-		case TCP_STATE_CLOSING:
-		case TCP_STATE_LAST_ACK:
+	soc = &tcp_socket[sochandle];		/* Get referense	*/
+	
+	if(soc->rcvbuf < 0)
+		return(-1);
+	
+#if TCP_NO_OF_RCVBUFS > 0
+	dat = tcp_rcvbuf_pool[soc->rcvbuf].data;
+	
+	if(len > soc->rcvbuf_len)
+		len = soc->rcvbuf_len;
+	
+	if(len > 0x7FFF)
+		len = 0x7FFF;
+	
+	for(i=0; i < len; i++) {
+		*buf++ = dat[soc->rcvbuf_start++];
 		
-			soc->myflags = TCP_FLAG_RESET;
-			tcp_sendcontrol(sochandle);
-			tcp_newstate(soc, TCP_STATE_CLOSED);
-			return(sochandle);
-			
-		default:
-			return(-1);
+		if(soc->rcvbuf_start == TCP_RCVBUF_SIZE)
+			soc->rcvbuf_start = 0;
 	}
 	
+	soc->rcvbuf_len -= len;
+	
+	if(len)
+		tcp_setwindow(sochandle, TCP_RCVBUF_SIZE - soc->rcvbuf_len);
+	
+	return((INT16)len);
+#else
+	return(-1);
+#endif
 
-}
-
+}
 
+/** \brief Check how much data can be read from socket
+ *  \ingroup tcp_app_api
+ *	\date 19.10.2026
+ *	\param sochandle handle to the socket to be inspected
+ *	\return
+ *		\li -1 - Error (invalid socket handle or socket has no receive
+ *		buffer)
+ *		\li >=0 - number of bytes tcp_recv() can read at the moment
+ */
+INT16 tcp_checkrecv (INT8 sochandle)
+{
+	struct tcb* soc;
 
-/** \brief Poll TCP sockets periodically
- *	\ingroup periodic_functions
- * 	\author 
- *		\li Jari Lahti (jari.lahti@violasystems.com)
- *	\date 19.07.2002
- *	\warning
- *		\li This function <b>must be</b> invoked periodically from 
- *		the main loop. See main_demo.c for an example.
+	if( NO_OF_TCPSOCKETS < 0 )
+		return(-1);
+	
+	if( NO_OF_TCPSOCKETS == 0 )
+		return(-1);
+	
+	if( sochandle > NO_OF_TCPSOCKETS ) {
+		TCP_DEBUGOUT("Socket handle non-valid\r\n");
+		return(-1);
+	}
+	
+	if( sochandle < 0 ) {
+		TCP_DEBUGOUT("Socket handle non-valid\r\n");
+		return(-1);
+	}
+	
+	soc = &tcp_socket[sochandle];		/* Get referense	*/
+	
+	if(soc->rcvbuf < 0)
+		return(-1);
+	
+	if(soc->rcvbuf_len > 0x7FFF)
+		return(0x7FFF);
+	
+	return((INT16)soc->rcvbuf_len);
+
+}
+
+
+/** \brief Change TCP socket option
+ *  \ingroup tcp_app_api
+ *	\date 19.10.2026
+ *	\param sochandle handle to the socket whose option is changed
+ *	\param opt option to change. Can take one of the following values:
+ *		\li #TCP_OPT_SEND_WINDOW - maximum number of unacknowledged bytes
+ *		on the socket. Value must be between 1 and 65535.
+ *		\li #TCP_OPT_SEND_BUFFER - non-zero value attaches a send buffer
+ *		to the socket, zero returns it to the pool. Fails if there are no
+ *		free buffers or if the socket has unacknowledged data.
+ *		\li #TCP_OPT_RECV_WINDOW - number of bytes application is able
+ *		to receive. If this opens the window considerably, window update
+ *		is sent to remote host on next tcp_poll(). Fails if the socket
+ *		has a receive buffer.
+ *		\li #TCP_OPT_RECV_BUFFER - non-zero value attaches a receive
+ *		buffer to the socket, zero returns it to the pool. Fails if there
+ *		are no free buffers or if the buffer holds unread data.
+ *		\li #TCP_OPT_BACKLOG - number of connections server socket holds
+ *		for tcp_accept() when listening. Value must be between 0 and 127.
+ *	\param value new value of the option
+ *	\return
+ *		\li -1 - Error (invalid socket handle, option or value)
+ *		\li >=0 - OK (handle to socket returned)
  *
- *	This function checks all TCP sockets and performs various actions 
- * 	if timeouts occur. What kind of action is performed is defined by the
- *	state of the TCP socket.
+ *	Invoke this function to change per-socket settings from their default
+ *	values. Options can be changed at any time after the socket was
+ *	obtained with tcp_getsocket().
  */
-void tcp_poll (void)
+INT8 tcp_setopt (INT8 sochandle, UINT8 opt, UINT32 value)
 {
 	struct tcb* soc;
-	static UINT8 handle = 0;
-	UINT8 i;
-	INT32 temp;
-	UINT8 old_retries;
-	
-	for(i=0; i < NO_OF_TCPSOCKETS; i++ ) {
-		
-		if(handle > NO_OF_TCPSOCKETS)
-			handle = 0;
+	UINT8 flag;
 
-		soc = &tcp_socket[handle];
+	if( NO_OF_TCPSOCKETS < 0 )
+		return(-1);
+	
+	if( NO_OF_TCPSOCKETS == 0 )
+		return(-1);
+	
+	if( sochandle > NO_OF_TCPSOCKETS ) {
+		TCP_DEBUGOUT("Socket handle non-valid\r\n");
+		return(-1);
+	}
+	
+	if( sochandle < 0 ) {
+		TCP_DEBUGOUT("Socket handle non-valid\r\n");
+		return(-1);
+	}
+	
+	soc = &tcp_socket[sochandle];		/* Get referense	*/
+	
+	if(soc->state == TCP_STATE_FREE)
+		return(-1);
+	
+	switch(opt) {
+		case TCP_OPT_SEND_WINDOW:
 		
-		switch(soc->state) {
-			case TCP_STATE_FREE:
-			case TCP_STATE_RESERVED:
-			case TCP_STATE_CLOSED:
-			case TCP_STATE_LISTENING:
-				
-				break;
-				
-			case TCP_STATE_CONNECTED:
+			if( (value == 0) || (value > 0xFFFF) )
+				return(-1);
 			
-				/* In CONNECTED State we have					*/ 
-				/* something to do only if we have unacked data	*/
-				/* or if connection has been IDLE too long or 	*/
-				/* unserved close is isuued by user				*/
-				
-				/*if(soc->send_next > soc->send_unacked)
-					temp = soc->send_next - soc->send_unacked;
-				else
-					temp = soc->send_unacked - soc->send_next;
-				*/
-				
-				temp = soc->send_next - soc->send_unacked;
-				
-				/* Unserved Close?			*/
-				
-				if(soc->flags & TCP_INTFLAGS_CLOSEPENDING) {
-					/* Can we send the close now	*/
-					
-					if(temp == 0) {
-						soc->myflags = TCP_FLAG_ACK | TCP_FLAG_FIN;
-						soc->send_next++;
-						tcp_sendcontrol(handle);
-						tcp_newstate(soc, TCP_STATE_FINW1);	
-						soc->flags ^= TCP_INTFLAGS_CLOSEPENDING;
-						
-						handle++;
-						
-						return;		
-						
-					}
-				}
-				
-				/* Socket timeout?			*/
-				
-				if(check_timer(soc->persist_timerh) == 0) {
-				
-					soc->myflags = TCP_FLAG_ACK | TCP_FLAG_FIN;
-					soc->send_next++;
-					tcp_sendcontrol(handle);
-					tcp_newstate(soc, TCP_STATE_FINW1);	
-					
-					/* Inform application	*/
-					
-					soc->event_listener(handle, TCP_EVENT_CLOSE, soc->rem_ip, soc->remport);
-					
-					handle++;
+			soc->send_budget = (UINT16)value;
+			
+			return(sochandle);
 		
-					return;			
-				}	
-				
-				/* Is there unacked data?	*/
-				
-				if(temp == 0)
-					break;
-				
-				/* Is there timeout?					*/
-				
-				if( check_timer(soc->retransmit_timerh) != 0 )
-					break;
-				
-				/* De we have retries left				*/
-				
-				if(soc->retries_left == 0) {
-					/* No retries, must reset	*/
-					
-					TCP_DEBUGOUT("Retries used up, resetting\r\n");
-					
-					soc->myflags = TCP_FLAG_RESET;
-					tcp_sendcontrol(handle);
-					
-					/* Inform application	*/
-
-					soc->event_listener(handle, TCP_EVENT_ABORT, soc->rem_ip, soc->remport);
-				
-					if(soc->type & TCP_TYPE_SERVER )
-						tcp_newstate(soc, TCP_STATE_LISTENING);
-					else
-						tcp_newstate(soc, TCP_STATE_CLOSED);
-					
-					handle++;
+		case TCP_OPT_SEND_BUFFER:
 		
-					return;										
-				}
-				
-				soc->retries_left--;
-				init_timer(soc->retransmit_timerh, TCP_DEF_RETRY_TOUT*TIMERTIC);
-								
-				/* Yep, there is unacked data			*/
-				/* Application should send the old data	*/
-				
-				if(temp>soc->send_mtu)
-					temp = soc->send_mtu;
-				
-				/* Rewind Send Next because the send process will adjust it			*/
-				/* So cheat the tcp_send to think there is no unacked data			*/
-				
-				soc->send_next = soc->send_unacked;
-				
-				/* tcp_send will set the retiries_left to maximum but this is		*/
-				/* retransmitting already so we need to retain it in order to 		*/
-				/* avoid dead-lock													*/
-				
-				old_retries = soc->retries_left;
+			/* Buffer can't be changed while it holds the data or	*/
+			/* while application's data is in flight				*/
+		
+			if( soc->sndbuf_len != 0 )
+				return(-1);
+			
+			if( (soc->state == TCP_STATE_CONNECTED) &&
+				(soc->send_next != soc->send_unacked)	)
+				return(-1);
+			
+			if(value == 0) {
+				tcp_sndbuf_free(soc->sndbuf);
+				soc->sndbuf = -1;
+				soc->coalesce = 0;
+				return(sochandle);
+			}
+			
+			if(soc->sndbuf < 0) {
+				soc->sndbuf = tcp_sndbuf_get();
 				
-				temp = soc->event_listener(handle, TCP_EVENT_REGENERATE, (UINT32)temp, 0);
+				if(soc->sndbuf < 0) {
+					TCP_DEBUGOUT("No free TCP send buffers\r\n");
+					return(-1);
+				}
+			}
 			
-				soc->retries_left = old_retries;
+			soc->sndbuf_start = 0;
 			
-				if(temp <= 0) {
-					
-					/* No data by application, must be something wrong	*/
-					soc->myflags = TCP_FLAG_RESET;
-					tcp_sendcontrol(handle);
-					
-					/* Inform application	*/
-
-					soc->event_listener(handle, TCP_EVENT_ABORT, soc->rem_ip, soc->remport);
-									
-					if(soc->type & TCP_TYPE_SERVER )
-						tcp_newstate(soc, TCP_STATE_LISTENING);
-					else
-						tcp_newstate(soc, TCP_STATE_CLOSED);
-					
-					handle++;
+			return(sochandle);
 		
-					return;					
-					
-				}
-				
-				/* Application has send data	*/
-				
-				handle++;
+		case TCP_OPT_RECV_WINDOW:
 		
-				return;
-				
+			/* Window follows the free space in receive buffer	*/
 			
-			case TCP_STATE_SYN_SENT:
-			case TCP_STATE_SYN_RECEIVED:
+			if(soc->rcvbuf >= 0)
+				return(-1);
 			
-				/* Is there timeout?	*/
-				if( check_timer(soc->retransmit_timerh) != 0 )
-					break;
-					
-				TCP_DEBUGOUT("Timeout\r\n");
-					
-				/* Yep, timeout. Is there reties left?	*/
-				if( soc->retries_left ) {
-					soc->retries_left--;
-					if(soc->state == TCP_STATE_SYN_SENT)
-						init_timer(soc->retransmit_timerh, TCP_SYN_RETRY_TOUT*TIMERTIC);
-					else
-						init_timer(soc->retransmit_timerh, TCP_DEF_RETRY_TOUT*TIMERTIC);
-
-					tcp_sendcontrol(handle);
-					
-					handle++;
+			tcp_setwindow(sochandle, value);
+			
+			return(sochandle);
 		
-					return;				
-				} else {
-					/* Retries used up	*/
-					TCP_DEBUGOUT("Retries used up, resetting\r\n");
-					
-					if(soc->type & TCP_TYPE_SERVER )
-						tcp_newstate(soc, TCP_STATE_LISTENING);
-					else
-						tcp_newstate(soc, TCP_STATE_CLOSED);
-					
-					soc->myflags = TCP_FLAG_RESET;
-					tcp_sendcontrol(handle);
-					
-					/* Inform application	*/
-
-					soc->event_listener(handle, TCP_EVENT_ABORT, soc->rem_ip, soc->remport);
-					
-					handle++;
+		case TCP_OPT_RECV_BUFFER:
 		
-					return;
+			/* Buffer can't be changed while it holds the data	*/
+			
+			if( soc->rcvbuf_len != 0 )
+				return(-1);
+			
+			if(value == 0) {
+				if(soc->rcvbuf >= 0) {
+					tcp_rcvbuf_free(soc->rcvbuf);
+					soc->rcvbuf = -1;
+					tcp_setwindow(sochandle, TCP_DEF_RECV_WINDOW);
 				}
 				
-				break;
-				
-			case TCP_STATE_TIMED_WAIT:
-				
-				/* Is there timeout?	*/
-				
-				if( check_timer(soc->retransmit_timerh) != 0 )
-					break;
-					
-				TCP_DEBUGOUT("Timeout\r\n");
+				return(sochandle);
+			}
+			
+			if(soc->rcvbuf < 0) {
+				soc->rcvbuf = tcp_rcvbuf_get();
 				
-				if(soc->retries_left) {
-					soc->retries_left--;
-					init_timer(soc->retransmit_timerh, TCP_DEF_RETRY_TOUT*TIMERTIC);
-					break;
+				if(soc->rcvbuf < 0) {
+					TCP_DEBUGOUT("No free TCP receive buffers\r\n");
+					return(-1);
 				}
-				
-				if(soc->type & TCP_TYPE_SERVER )
-					tcp_newstate(soc, TCP_STATE_LISTENING);
-				else
-					tcp_newstate(soc, TCP_STATE_CLOSED);
-					
-				break;
+			}
 			
-			case TCP_STATE_LAST_ACK:
-			case TCP_STATE_FINW1:
-			case TCP_STATE_CLOSING:
+			soc->rcvbuf_start = 0;
+			tcp_setwindow(sochandle, TCP_RCVBUF_SIZE);
 			
-				/* Is there timeout?	*/
-				
-				if( check_timer(soc->retransmit_timerh) != 0 )
-					break;
-					
-				TCP_DEBUGOUT("Timeout\r\n");		
-						
-				/* Yep, timeout. Is there reties left?	*/
-				
-				if( soc->retries_left ) {
-					soc->retries_left--;
-					init_timer(soc->retransmit_timerh, TCP_DEF_RETRY_TOUT*TIMERTIC);
-					soc->myflags = TCP_FLAG_FIN | TCP_FLAG_ACK;
-					tcp_sendcontrol(handle);
-					
-					handle++;
+			return(sochandle);
 		
-
-					return;				
-				} else {
-					/* Retries used up	*/
-					TCP_DEBUGOUT("Retries used up, resetting\r\n");
-					
-					if(soc->type & TCP_TYPE_SERVER )
-						tcp_newstate(soc, TCP_STATE_LISTENING);
-					else
-						tcp_newstate(soc, TCP_STATE_CLOSED);
-					
-					soc->myflags = TCP_FLAG_RESET;
-					tcp_sendcontrol(handle);
-					
-					/* Inform application	*/
-
-					soc->event_listener(handle, TCP_EVENT_ABORT, soc->rem_ip, soc->remport);
-					
-					handle++;
+		case TCP_OPT_NAGLE:
+		case TCP_OPT_CORK:
 		
-					return;
-				}			
-				
-				break;
+			/* Only data in send buffer can be held back	*/
 			
-			case TCP_STATE_FINW2:
+			if(soc->sndbuf < 0)
+				return(-1);
 			
-				/* Is there timeout?	*/
-				
-				if( check_timer(soc->retransmit_timerh) != 0 )
-					break;
-					
-				TCP_DEBUGOUT("Timeout\r\n");		
-						
-				/* Yep, timeout. Is there reties left?	*/
-				
-				if( soc->retries_left )	{
-					/* Still keep waiting for FIN	*/
-				
-					soc->retries_left--;
-					init_timer(soc->retransmit_timerh, TCP_DEF_RETRY_TOUT*TIMERTIC);
-					break;			
-				} else {
-					/* Retries used up	*/
-					TCP_DEBUGOUT("Retries used up, resetting\r\n");
-					
-					if(soc->type & TCP_TYPE_SERVER )
-						tcp_newstate(soc, TCP_STATE_LISTENING);
-					else
-						tcp_newstate(soc, TCP_STATE_CLOSED);
-					
-					soc->myflags = TCP_FLAG_RESET;
-					tcp_sendcontrol(handle);
-					
-					/* Inform application	*/
-
-					soc->event_listener(handle, TCP_EVENT_ABORT, soc->rem_ip, soc->remport);
-				
-					handle++;
-		
-					return;
-				}	
-				
-				break;
+			flag = (opt == TCP_OPT_NAGLE) ? TCP_COALESCE_NAGLE : TCP_COALESCE_CORK;
 			
-			default:
-				break;	
+			if(value) {
+				soc->coalesce |= flag;
+				return(sochandle);
+			}
 			
-		}
+			/* Held back data is sent on next poll	*/
+			
+			soc->coalesce &= ~flag;
+			
+			if(soc->coalesce & TCP_COALESCE_HELD) {
+				soc->coalesce |= TCP_COALESCE_FLUSH;
+				tcp_wakeup(sochandle);
+			}
+			
+			return(sochandle);
 		
-		/* Go to next socket if there was no event	*/
+		case TCP_OPT_BACKLOG:
+		
+			if( (soc->type & TCP_TYPE_SERVER) == 0 )
+				return(-1);
+			
+			if(value > 0x7F)
+				return(-1);
+			
+			soc->backlog = (UINT8)value;
+			
+			return(sochandle);
 		
-		handle++;
+		default:
 		
+			TCP_DEBUGOUT("Unknown TCP socket option\r\n");
+			return(-1);
 	}
-	
-}
-
 
+}
 
-/** \brief Initialize TCP module
- *	\ingroup core_initializer
- * 	\author 
- *		\li Jari Lahti (jari.lahti@violasystems.com)
- *	\date 21.07.2002
- *	\return
- *		\li -1 - error
- *		\li >0 - number of sockets initialized
- *	\warning 
- *		\li This function <b>must</b> be invoked at startup before any
- *		other TCP functions are invoked.
- *
- *	This function initializes all sockets and corresponding tcbs to known
- *	state. Timers are also allocated for each socket and everything is
- *	brought to a predefined state.
+/** \brief Change amount of data socket can receive
+ *	\date 19.10.2026
+ *	\param sochandle handle to the socket whose window is changed
+ *	\param wnd number of bytes application is able to receive
  *
+ *	If this opens the window considerably on a connected socket a
+ *	window update is sent to remote host on next tcp_poll().
  */
-INT8 tcp_init (void)
+void tcp_setwindow (INT8 sochandle, UINT32 wnd)
 {
-	UINT16 i;
-	INT16 h;
 	struct tcb* soc;
+	UINT32 mss;
+	
+	soc = &tcp_socket[sochandle];
+	soc->rcv_wnd = wnd;
+	
+	if(soc->state != TCP_STATE_CONNECTED)
+		return;
+	
+	/* Tell remote host if window was closed or if right edge	*/
+	/* moves at least one segment (RFC 1122)					*/
+	
+	mss = soc->send_mtu - MIN_TCP_HLEN;
 	
+	if( ((soc->rcv_adv == soc->receive_next) && (wnd != 0)) ||
+		((INT32)(soc->receive_next + wnd - soc->rcv_adv) >= (INT32)mss) ) {
+		soc->flags |= TCP_INTFLAGS_WNDUPDATE;
+		tcp_wakeup(sochandle);
+	}
+
+}
+
+
+
+/** \brief Get TCP socket statistics
+ *  \ingroup tcp_app_api
+ *	\date 19.10.2026
+ *	\param sochandle handle to the socket to be queried
+ *	\param st pointer to structure where statistics are stored
+ *	\return
+ *		\li -1 - Error (invalid socket handle)
+ *		\li >=0 - OK (handle to socket returned)
+ *
+ *	Invoke this function to get round-trip time estimates and current
+ *	retransmission time-out of the socket. See tcp_sockstats for
+ *	details.
+ */
+INT8 tcp_getstats (INT8 sochandle, struct tcp_sockstats* st)
+{
+	struct tcb* soc;
+
 	if( NO_OF_TCPSOCKETS < 0 )
 		return(-1);
 	
 	if( NO_OF_TCPSOCKETS == 0 )
-		return(0);
-	
-	TCP_DEBUGOUT("Initializing TCP");
-	
-	for(i=0; i < NO_OF_TCPSOCKETS; i++) {
-		soc = &tcp_socket[i];			/* Get Socket	*/
-		h = -1;
-		
-		soc->state = TCP_STATE_FREE;
-		soc->type = TCP_TYPE_NONE;
-		soc->flags = 0;
-		soc->rem_ip = 0;
-		soc->remport = 0;
-		soc->locport = 0;
-		soc->myflags = 0;
-		soc->send_mtu = TCP_DEF_MTU;
-		soc->tos = 0;
-		soc->tout = 0;
-		soc->event_listener = 0;
-		
-		/* Reserve Timers	*/
-		
-		h = get_timer();
-		
-		/*
-		if( h < 0 ) {
-			TCP_DEBUGOUT("\n\rERROR:Error getting timer for TCP Socket!\n\r");
-			return(-1);
-		}
-		*/
-		
-		init_timer(h,0);					/* No timeout	*/
-		
-		soc->persist_timerh = h;
-		
-		h = get_timer();
-		
-		/*
-		if( h < 0 ) {
-			TCP_DEBUGOUT("\n\rERROR:Error getting timer for TCP Socket!\n\r");
-			return(-1);
-		}
-		*/
-		
-		init_timer(h,0);					/* No timeout	*/
-		
-		soc->retransmit_timerh = h;
-		
-		soc->retries_left = 0;		 
-		
-		TCP_DEBUGOUT(".");
-		
+		return(-1);
 	
+	if( sochandle > NO_OF_TCPSOCKETS ) {
+		TCP_DEBUGOUT("Socket handle non-valid\r\n");
+		return(-1);
 	}
 	
-	TCP_DEBUGOUT("\n\rTCP Initialized\n\r");
+	if( sochandle < 0 ) {
+		TCP_DEBUGOUT("Socket handle non-valid\r\n");
+		return(-1);
+	}
 	
-	/* Return number of sockets initialized	*/
+	soc = &tcp_socket[sochandle];		/* Get referense	*/
 	
-	return(i+1);
+	st->srtt = soc->srtt;
+	st->rttvar = soc->rttvar;
+	st->rto = (UINT32)soc->rto * (1000 / TIMERTIC);
+	st->timeouts = soc->timeouts;
+	st->fast_retransmits = soc->fast_retransmits;
+	st->cwnd = soc->cwnd;
+	st->ssthresh = soc->ssthresh;
+	st->rexmit_bytes = soc->rexmit_bytes;
 	
+	return(sochandle);
 
 }
 
 
+/** \brief Get TCP connection establishment statistics
+ *  \ingroup tcp_app_api
+ *	\date 19.10.2026
+ *	\param st pointer to structure where statistics are stored
+ *
+ *	Invoke this function to see how many connections are half-open and
+ *	how often connection requests have been answered with SYN cookies
+ *	(see #TCP_SYNCOOKIE_HALFOPEN). See tcp_synstats for details.
+ */
+void tcp_getsynstats (struct tcp_synstats* st)
+{
+	*st = tcp_syncounters;
 
+}
 
-/*******************************************************************************/
-/*******	TCP Internal functions										********/
-/*******************************************************************************/
 
 
-/** \brief Check and process the received TCP frame
- *	\ingroup periodic_functions
+/** \brief Reset connection and place socket to closed state
+ *  \ingroup tcp_app_api
  * 	\author 
  *		\li Jari Lahti (jari.lahti@violasystems.com)
- *	\date 12.07.2002
- *	\param frame pointer to received ip_frame structure
- *	\param len length of data contained in IP datagram (in bytes)
- *	\return 
- *		\li -1 - Error (packet not OK, or not TCP,or something else)
- *		\li >0 - Packet OK
+ *	\date 21.07.2002
+ *	\param sochandle handle to socket to be aborted
+ *	\return
+ *		\li -1 - error
+ *		\li >=0 - OK (value represents handle to aborted socket)
  *
- *	Invoke this function to process received TCP frames. See main_demo.c for
- *	an example on how to accomplish this.
+ *	Use this function in cases when TCP connection must be immediately closed.
+ *	Note that the preffered (more elegant) way of closing the TCP connection
+ *	is to invoke tcp_close() which starts a proper closing procedure.
+ *	tcp_abort should be used only in cases when it is really necessary to 
+ *	immediately and quickly close the connection.
  */
-INT16 process_tcp_in (struct ip_frame* frame, UINT16 len)
+INT8 tcp_abort (INT8 sochandle)
 {
 	struct tcb* soc;
-	UINT16 hlen;
-	UINT8 olen;
-	UINT16 dlen;
-	UINT32 diff;
-	UINT16 i;
-	INT8 sochandle;	
-	INT16 temp;
-	
-	/* Is this TCP?	*/
 	
-	TCP_DEBUGOUT("Processing TCP...\n\r");
-	
-	if( frame->protocol != IP_TCP ) {
-		TCP_DEBUGOUT("ERROR: The protocol is not TCP\n\r");
-		return(-1);
-	}
-	
-	/* Calculate checksum for received packet	*/
+	TCP_DEBUGOUT("FUNCTION: tcp_abort\r\n");
 
-	
-	NETWORK_RECEIVE_INITIALIZE(frame->buf_index);
-	
-	if( tcp_check_cs(frame, len) == 1) {
-		TCP_DEBUGOUT("TCP Checksum OK\n\r");
-	} else {
-		TCP_DEBUGOUT("ERROR:TCP Checksum failed\r\n");
+	if( NO_OF_TCPSOCKETS < 0 )
 		return(-1);
-	} 
-
-	/* Get the header	*/
-	
-	NETWORK_RECEIVE_INITIALIZE(frame->buf_index);
-	
-	received_tcp_packet.sport = ((UINT16)RECEIVE_NETWORK_B()) << 8;
-	received_tcp_packet.sport |= RECEIVE_NETWORK_B();
-	
-	received_tcp_packet.dport = ((UINT16)RECEIVE_NETWORK_B()) << 8;
-	received_tcp_packet.dport |= RECEIVE_NETWORK_B();
-	
-	received_tcp_packet.seqno = (((UINT32)RECEIVE_NETWORK_B()) << 24);
-	received_tcp_packet.seqno |= (((UINT32)RECEIVE_NETWORK_B()) << 16);
-	received_tcp_packet.seqno |= (((UINT32)RECEIVE_NETWORK_B()) << 8);
-	received_tcp_packet.seqno |= RECEIVE_NETWORK_B();
-	
-	received_tcp_packet.ackno = (((UINT32)RECEIVE_NETWORK_B()) << 24);
-	received_tcp_packet.ackno |= (((UINT32)RECEIVE_NETWORK_B()) << 16);
-	received_tcp_packet.ackno |= (((UINT32)RECEIVE_NETWORK_B()) << 8);
-	received_tcp_packet.ackno |= RECEIVE_NETWORK_B();
-
-	received_tcp_packet.hlen_flags = ((UINT16)RECEIVE_NETWORK_B()) << 8;
-	received_tcp_packet.hlen_flags |= RECEIVE_NETWORK_B();
-	
-	received_tcp_packet.window = ((UINT16)RECEIVE_NETWORK_B()) << 8;
-	received_tcp_packet.window |= RECEIVE_NETWORK_B();
-	
-	received_tcp_packet.checksum = ((UINT16)RECEIVE_NETWORK_B()) << 8;
-	received_tcp_packet.checksum |= RECEIVE_NETWORK_B();
-	
-	received_tcp_packet.urgent = ((UINT16)RECEIVE_NETWORK_B()) << 8;
-	received_tcp_packet.urgent |= RECEIVE_NETWORK_B();
-	
-	/* Little check for options	*/
-	
-	hlen = received_tcp_packet.hlen_flags & 0xF000;
-	hlen >>= 10;
 	
-	if( hlen < MIN_TCP_HLEN ) {
-		TCP_DEBUGOUT("ERROR: Received TCP Header too short\r\n");
+	if( NO_OF_TCPSOCKETS == 0 )
 		return(-1);
-	}
-	
-	if(hlen == MIN_TCP_HLEN)
-		TCP_DEBUGOUT("TCP does not contain options\r\n");
 	
-	olen = hlen - MIN_TCP_HLEN;
-	
-	if( olen > MAX_TCP_OPTLEN ) {
-		TCP_DEBUGOUT("ERROR: Received TCP header contains too long option field\r\n");
+	if( sochandle > NO_OF_TCPSOCKETS ) {
+		TCP_DEBUGOUT("Socket handle non-valid\r\n");
 		return(-1);
 	}
 	
-	/* Calculate data length	*/
-	
-	if( hlen > len ) {
-		TCP_DEBUGOUT("ERROR: TCP header longer than packet\r\n");
+	if( sochandle < 0 ) {
+		TCP_DEBUGOUT("Socket handle non-valid\r\n");
 		return(-1);
 	}
 	
-	dlen = len - hlen - olen;
-	
-	/* Get options (if any)	*/
-	
-	for(i=0; i<olen;i++)
-		received_tcp_packet.opt[i] = RECEIVE_NETWORK_B();
+	soc = &tcp_socket[sochandle];		/* Get referense	*/	
+
+	switch (soc->state)	{
+		case TCP_STATE_FREE:
+			return(-1);
+			
+		case TCP_STATE_RESERVED:
+		case TCP_STATE_CLOSED:
+			return(sochandle);
 		
-	/* Try to find rigth socket to process with		*/
-	
-	sochandle = tcp_mapsocket(frame, &received_tcp_packet);
-	
-	if(sochandle < 0) {
-		TCP_DEBUGOUT("ERROR: Processing TCP packet failed\r\n");
-		tcp_sendreset(&received_tcp_packet, frame->sip);
-		return(-1);
+		case TCP_STATE_TIMED_WAIT:
+		case TCP_STATE_LISTENING:
+			tcp_newstate(soc, TCP_STATE_CLOSED);
+			return(sochandle);
+		
+		case TCP_STATE_SYN_SENT:
+		case TCP_STATE_SYN_RECEIVED:
+		case TCP_STATE_CONNECTED:
+		case TCP_STATE_FINW1:
+		case TCP_STATE_FINW2:
+		case TCP_STATE_CLOSING:
+		case TCP_STATE_LAST_ACK:
+		
+			soc->myflags = TCP_FLAG_RESET;
+			tcp_sendcontrol(sochandle);
+			tcp_newstate(soc, TCP_STATE_CLOSED);
+			return(sochandle);
+			
+		default:
+			return(-1);
 	}
 	
-	received_tcp_packet.buf_index = frame->buf_index + hlen;
-	NETWORK_RECEIVE_INITIALIZE(received_tcp_packet.buf_index);
-	
+
+}
+
+
+
+/** \brief Poll TCP sockets periodically
+ *	\ingroup periodic_functions
+ * 	\author 
+ *		\li Jari Lahti (jari.lahti@violasystems.com)
+ *	\date 19.07.2002
+ *	\warning
+ *		\li This function <b>must be</b> invoked periodically from 
+ *		the main loop. See main_demo.c for an example.
+ *
+ *	This function serves TCP sockets that are ready: a timer of the
+ *	socket has expired, a packet was received for it or the application
+ *	left something for TCP to do. Sockets are served in the order they
+ *	became ready, at most #TCP_POLL_BUDGET sockets per call. When no
+ *	socket is ready the function returns at once.
+ */
+void tcp_poll (void)
+{
+	INT8 handle;
+	UINT8 n;
 	
+	tcp_tw_age();
 	
-	/* Get socket reference	*/
+	/* Sockets becoming ready meanwhile are served on next call	*/
 	
-	soc = &tcp_socket[sochandle];
+	n = tcp_nready;
 	
-	/* Process the packet on TCP State Machine		*/
+	if(n > TCP_POLL_BUDGET)
+		n = TCP_POLL_BUDGET;
 	
-	switch(soc->state) {
-		case TCP_STATE_CONNECTED:
+	while(n--) {
+		OS_EnterCritical();
 		
-			TCP_DEBUGOUT("CONNECTED State\r\n");
-			
-			/* Check for RESET	*/
-			
-			if(received_tcp_packet.hlen_flags & TCP_FLAG_RESET)	{
-				TCP_DEBUGOUT("ERROR:Reset received\r\n");
+		handle = tcp_readyq[tcp_readyq_head];
+		tcp_readyq_head = (tcp_readyq_head + 1) % NO_OF_TCPSOCKETS;
+		tcp_nready--;
+		tcp_socket[handle].ready = FALSE;
+		
+		OS_ExitCritical();
+		
+		/* Socket that had something to do may have more	*/
+		
+		if( tcp_service(handle) )
+			tcp_wakeup(handle);
+	}
 
-				/* Inform application	*/
+}
 
-				soc->event_listener(sochandle, TCP_EVENT_ABORT, soc->rem_ip, soc->remport);				
-				
-				if(soc->type & TCP_TYPE_SERVER)
-					tcp_newstate(soc, TCP_STATE_LISTENING);
-				else
-					tcp_newstate(soc, TCP_STATE_CLOSED);
-					
-				return(-1);
-			}
+
+/** \brief Perform pending actions of TCP socket
+ * 	\author 
+ *		\li Jari Lahti (jari.lahti@violasystems.com)
+ *	\date 19.07.2002
+ *	\param handle handle of socket to serve
+ *	\return
+ *		\li 0 - Nothing was due
+ *		\li 1 - Packet was sent or state changed
+ *
+ *	Checks the timers of the socket and performs various actions if
+ *	timeouts occur. What kind of action is performed is defined by the
+ *	state of the TCP socket. At most one packet is sent per call.
+ */
+UINT8 tcp_service (INT8 handle)
+{
+	struct tcb* soc;
+	INT32 temp;
+	
+	soc = &tcp_socket[handle];
+	
+	switch(soc->state) {
+		case TCP_STATE_FREE:
+		case TCP_STATE_RESERVED:
+		case TCP_STATE_LISTENING:
 			
-			/* Check for SYN (If the peer didn't get our SYN+ACK or ACK)	*/
+			break;
+		
+		case TCP_STATE_CLOSED:
+		
+			/* Return connection nobody accepted to the pool	*/
 			
-			if( received_tcp_packet.hlen_flags & TCP_FLAG_SYN )	{
-				/* Is it the SYN+ACK we have already ACKed but maybe ACK lost?	*/
+			if(soc->parent >= 0)
+				tcp_releasesocket(handle);
+			
+			break;
+			
+		case TCP_STATE_CONNECTED:
+		
+			/* In CONNECTED State we have					*/ 
+			/* something to do only if we have unacked data	*/
+			/* or if connection has been IDLE too long or 	*/
+			/* unserved close is isuued by user				*/
+			
+			/*if(soc->send_next > soc->send_unacked)
+				temp = soc->send_next - soc->send_unacked;
+			else
+				temp = soc->send_unacked - soc->send_next;
+			*/
+			
+			temp = soc->send_next - soc->send_unacked;
+			
+			/* Unserved Close?			*/
+			
+			if(soc->flags & TCP_INTFLAGS_CLOSEPENDING) {
+				/* Can we send the close now	*/
 				
-				if( received_tcp_packet.hlen_flags & TCP_FLAG_ACK )	{
-					/* It's SYN+ACK but how about sequence	*/
+				if( (temp == 0) && (soc->sndbuf_len == 0) ) {
+					soc->myflags = TCP_FLAG_ACK | TCP_FLAG_FIN;
+					soc->send_next++;
+					tcp_sendcontrol(handle);
+					tcp_newstate(soc, TCP_STATE_FINW1);	
+					soc->flags ^= TCP_INTFLAGS_CLOSEPENDING;
 					
-					if( (received_tcp_packet.seqno + 1) == soc->receive_next ) {
+					return(1);		
 					
-						if( received_tcp_packet.ackno == soc->send_next ) {
-						
-							TCP_DEBUGOUT("Received SYN+ACK again\r\n");
-							
-							/* ACK the SYN	*/
-							soc->myflags = TCP_FLAG_ACK;
-							tcp_sendcontrol(sochandle);
-							return(0);
-						}
-						
-					}
-				
-				 /* It is maybe SYN again so it haven't get our SYN + ACK	*/
-				 /* Let our retransmission handle it						*/
-				 
-				 return(0);
-				
-				
 				}
-			
 			}
 			
-			/* Do we have unacked data?		*/
+			/* Socket timeout?			*/
 			
-			if( soc->send_unacked != soc->send_next ) {
+			if(check_timer(soc->persist_timerh) == 0) {
 			
-				/* Yep, is the ACK valid?	*/
-				
-				if( (received_tcp_packet.hlen_flags & TCP_FLAG_ACK) == 0) {
-				
-					TCP_DEBUGOUT("Packet without ACK and unacked data. Packet not processed\r\n");
-					return(0);
-				}
-				
-				if( received_tcp_packet.ackno == soc->send_next ) {
-				
-					/* We don't have unacked data now	*/
-				
-					soc->send_unacked = soc->send_next;
+				soc->myflags = TCP_FLAG_ACK | TCP_FLAG_FIN;
+				soc->send_next++;
+				tcp_sendcontrol(handle);
+				tcp_newstate(soc, TCP_STATE_FINW1);	
 				
-					/* Inform application	*/
+				/* Inform application	*/
 				
-					soc->event_listener(sochandle, TCP_EVENT_ACK, soc->rem_ip, soc->remport);
+				soc->event_listener(handle, TCP_EVENT_CLOSE, soc->rem_ip, soc->remport);
 				
-				}
-
+				return(1);			
+			}	
 			
-			}
+			/* Held back data to be flushed?	*/
 			
-			/* Is the sequence OK	*/
+			if(soc->coalesce & (TCP_COALESCE_FLUSH | TCP_COALESCE_HELD))
+				tcp_sndbuf_output(handle);
 			
-			if(soc->receive_next != received_tcp_packet.seqno)
-			{
-				/* Out of range, inform what we except	*/
+			/* Window opened by application or delayed ACK due?	*/
 			
-				DEBUGOUT("Too big sequence number received\r\n");
-				
+			if( (soc->flags & TCP_INTFLAGS_WNDUPDATE) ||
+				((soc->flags & TCP_INTFLAGS_DELACK) &&
+				 (check_timer(soc->delack_timerh) == 0))	) {
 				soc->myflags = TCP_FLAG_ACK;
-				tcp_sendcontrol(sochandle);
-				return(0);
+				tcp_sendcontrol(handle);
+				
+				return(1);
 			}
 			
-			/* Generate data event to application	*/
-				
-			soc->event_listener(sochandle, TCP_EVENT_DATA, dlen, 0);
-				
-			soc->receive_next += dlen;			
-					
-			/* Is the FIN flag set?	*/
+			/* Is there unacked data?	*/
 			
-			if( received_tcp_packet.hlen_flags & TCP_FLAG_FIN )	{
-				TCP_DEBUGOUT("Other end want's to close\r\n");
-				
-				/* Inform application if we don't have unacked data	*/
-				
-				if( soc->send_unacked == soc->send_next) {
-				
-					soc->event_listener(sochandle, TCP_EVENT_CLOSE, soc->rem_ip, soc->remport);
-				
-					/* ACK FIN and set our own FIN	*/
-				
-					soc->receive_next++;
-					soc->send_next++;
-					soc->myflags = TCP_FLAG_ACK | TCP_FLAG_FIN;
-				
-					tcp_newstate(soc, TCP_STATE_LAST_ACK);
-					tcp_sendcontrol(sochandle);
-				
-					return(0);
-				}
-			}
+			if(temp == 0) {
 			
-			/* ACK the data if there was it	*/
+				/* Buffered data waiting for the window to open?	*/
+				
+				if(soc->sndbuf_len)
+					tcp_sndbuf_output(handle);
 			
-			if(dlen) {
-				soc->myflags = TCP_FLAG_ACK;
-				tcp_sendcontrol(sochandle);
+				break;
 			}
 			
-			tcp_newstate(soc, TCP_STATE_CONNECTED);			
-			
-
-			return(0);
+			/* Is there timeout?					*/
 			
-		
-			break;
-	
-		case TCP_STATE_FREE:
+			if( check_timer(soc->retransmit_timerh) != 0 )
+				break;
 			
-			/* Reset connection	*/
-			tcp_sendreset(&received_tcp_packet, frame->sip);
-			return(-1);
-		
-			break;
-		
-		case TCP_STATE_CLOSED:
+			/* De we have retries left				*/
 			
-			/* Reset connection	*/
-			tcp_sendreset(&received_tcp_packet, frame->sip);
-			return(-1);		
-		
-			break;
-		
-		case TCP_STATE_LISTENING:
-		
-			TCP_DEBUGOUT("LISTENING State...\r\n");
-		
-			/* Check Flags	*/
+			if(soc->retries_left == 0) {
+				/* No retries, must reset	*/
+				
+				TCP_DEBUGOUT("Retries used up, resetting\r\n");
+				
+				soc->myflags = TCP_FLAG_RESET;
+				tcp_sendcontrol(handle);
+				
+				/* Inform application	*/
+
+				soc->event_listener(handle, TCP_EVENT_ABORT, soc->rem_ip, soc->remport);
 			
-			if(received_tcp_packet.hlen_flags & TCP_FLAG_RESET) {
-				TCP_DEBUGOUT("ERROR:Reset received\r\n");
-				tcp_newstate(soc, TCP_STATE_LISTENING);
-				return(-1);
+				if(soc->type & TCP_TYPE_SERVER )
+					tcp_newstate(soc, TCP_STATE_LISTENING);
+				else
+					tcp_newstate(soc, TCP_STATE_CLOSED);
+				
+				return(1);										
 			}
 			
-			if(received_tcp_packet.hlen_flags & TCP_FLAG_ACK) {
-				TCP_DEBUGOUT("ERROR:Ack received\r\n");
-				tcp_newstate(soc, TCP_STATE_LISTENING);
-				/* Reset connection	*/
-				tcp_sendreset(&received_tcp_packet, frame->sip);
-				return(-1);	
-			}
+			soc->retries_left--;
+			soc->timeouts++;
+			tcp_rtt_backoff(soc);
+			init_timer(soc->retransmit_timerh, soc->rto);
 			
-			if((received_tcp_packet.hlen_flags & TCP_FLAG_SYN) == 0) {
-				TCP_DEBUGOUT("ERROR:No SYN set on packet\r\n");
-				tcp_newstate(soc, TCP_STATE_LISTENING);
-				/* Reset connection	*/
-				tcp_sendreset(&received_tcp_packet, frame->sip);
-				return(-1);
-			}
+			/* Time-out ends fast recovery	*/
 			
-			/* OK, SYN received	*/
+			soc->dupacks = 0;
+			soc->flags &= ~TCP_INTFLAGS_RECOVERY;
+			tcp_cc_loss(soc, 1);
 			
-			/* Inform application and see if accepted	*/
+			/* Remote host may have discarded selectively	*/
+			/* acknowledged data (RFC 2018)					*/
 			
-			temp = (INT16)soc->event_listener(sochandle, TCP_EVENT_CONREQ, soc->rem_ip, soc->remport);
+			soc->nsacked = 0;
 			
-			if( temp == -1)	{
-				TCP_DEBUGOUT("Application disregarded connection request\r\n");
-				tcp_sendreset(&received_tcp_packet, frame->sip);
-				return(-1);
-			}
+			/* Data in send buffer or file? Send it again starting	*/
+			/* from the oldest unacknowledged byte (go-back-N)		*/
 			
-			if( temp == -2 ) {
-				TCP_DEBUGOUT("Application wants to think about accepting conreq\r\n");
+			if( (soc->sndbuf >= 0) || (soc->file >= 0) ) {
+				soc->send_next = soc->send_unacked;
+				tcp_sndbuf_output(handle);
+				
 				return(1);
 			}
+							
+			/* Yep, there is unacked data			*/
+			/* Application should send the old data	*/
 			
-			/* The connection request was accepted	*/
-			
-			TCP_DEBUGOUT("Next state SYN_RECEIVED\r\n");
-			if(soc->flags & TCP_INTFLAGS_CLOSEPENDING)
-				soc->flags ^= TCP_INTFLAGS_CLOSEPENDING;
-			tcp_newstate(soc, TCP_STATE_SYN_RECEIVED);
-			soc->receive_next = received_tcp_packet.seqno + 1;	/* Ack SYN		*/
-			soc->send_unacked = tcp_initseq();
-			
-			soc->myflags = TCP_FLAG_SYN | TCP_FLAG_ACK;
-			tcp_sendcontrol(sochandle);
-			soc->send_next = soc->send_unacked + 1;
-			
-			return(1);
-			
-			break;
-			
-		case TCP_STATE_SYN_RECEIVED:
+			temp = tcp_regenerate(handle);
 		
-			TCP_DEBUGOUT("SYN_RECEIVED State...\r\n");
-			
-			/* Check Flags	*/
-			
-			if(received_tcp_packet.hlen_flags & TCP_FLAG_RESET)	{
-				TCP_DEBUGOUT("ERROR:Reset received\r\n");
-				
-				/* Inform application	*/
+			if(temp <= 0) {
 				
-				soc->event_listener(sochandle, TCP_EVENT_ABORT, soc->rem_ip, soc->remport);
+				/* No data by application, must be something wrong	*/
+				soc->myflags = TCP_FLAG_RESET;
+				tcp_sendcontrol(handle);
 				
-				if(soc->type & TCP_TYPE_SERVER)
+				/* Inform application	*/
+
+				soc->event_listener(handle, TCP_EVENT_ABORT, soc->rem_ip, soc->remport);
+								
+				if(soc->type & TCP_TYPE_SERVER )
 					tcp_newstate(soc, TCP_STATE_LISTENING);
 				else
 					tcp_newstate(soc, TCP_STATE_CLOSED);
-					
-				return(-1);
+				
+				return(1);					
+				
 			}
 			
-			/* Is it SYN+ACK (if we are the because of simultaneous open)	*/
+			/* Application has send data	*/
 			
-			if( (received_tcp_packet.hlen_flags & TCP_FLAG_SYN) &&
-				(received_tcp_packet.hlen_flags & TCP_FLAG_ACK)	) {			
-				
-				if( received_tcp_packet.ackno != soc->send_next ) {
-					TCP_DEBUGOUT("SYN+ACK received but wrong Ack\n\r");
-					return(-1);
-				}
-				
-				TCP_DEBUGOUT("SYN+ACK received, this side established\n\r");
+			return(1);
+			
+		
+		case TCP_STATE_SYN_SENT:
+		case TCP_STATE_SYN_RECEIVED:
+		
+			/* Is there timeout?	*/
+			if( check_timer(soc->retransmit_timerh) != 0 )
+				break;
 				
-				/* Get peer's seq number	*/
+			TCP_DEBUGOUT("Timeout\r\n");
 				
-				soc->receive_next =  received_tcp_packet.seqno;
-				soc->receive_next++;							/* ACK SYN	*/
+			/* Yep, timeout. Is there reties left?	*/
+			if( soc->retries_left ) {
+				soc->retries_left--;
+				tcp_rtt_backoff(soc);
+				init_timer(soc->retransmit_timerh, soc->rto);
+
+				tcp_sendcontrol(handle);
 				
-				/* We have no unacked data	*/
+				return(1);				
+			} else {
+				/* Retries used up	*/
+				TCP_DEBUGOUT("Retries used up, resetting\r\n");
 				
-				soc->send_unacked = soc->send_next;
+				if(soc->type & TCP_TYPE_SERVER )
+					tcp_newstate(soc, TCP_STATE_LISTENING);
+				else
+					tcp_newstate(soc, TCP_STATE_CLOSED);
 				
-				tcp_newstate(soc, TCP_STATE_CONNECTED);
-				soc->myflags = TCP_FLAG_ACK;
-				tcp_sendcontrol(sochandle);
+				soc->myflags = TCP_FLAG_RESET;
+				tcp_sendcontrol(handle);
 				
 				/* Inform application	*/
+
+				soc->event_listener(handle, TCP_EVENT_ABORT, soc->rem_ip, soc->remport);
 				
-				soc->event_listener(sochandle, TCP_EVENT_CONNECTED, soc->rem_ip, soc->remport);
-				
-				return(0);					
-								
+				return(1);
 			}
 			
-			/* Is it ACK?		*/
-			
-			if( received_tcp_packet.hlen_flags & TCP_FLAG_ACK )	{
-				if( received_tcp_packet.ackno != soc->send_next ) {
-					TCP_DEBUGOUT("ACK received but wrong Ack\n\r");
-					return(-1);
-				}
-				
-				if( received_tcp_packet.seqno != soc->receive_next ) {
-					TCP_DEBUGOUT("ACK received but Wrong SEQ number\n\r");
-					return(-1);
-				}
-				
-				TCP_DEBUGOUT("ACK received, this side CONNECTED\r\n");
-				
-				/* We have no unacked data	*/
-				
-				soc->send_unacked = soc->send_next;
-				
-				tcp_newstate(soc, TCP_STATE_CONNECTED);
-
-				/* Inform application	*/
-				
-				soc->event_listener(sochandle, TCP_EVENT_CONNECTED, soc->rem_ip, soc->remport);
-								
-				return(0);
-					
-			}
-			
-			/* Is it SYN?		*/
-			
-			if( received_tcp_packet.hlen_flags & TCP_FLAG_SYN ) {
-				TCP_DEBUGOUT("Repeated SYN\r\n");
-				return(0);
-			}
-			
-			/* We didn't understood this one, keep on trying but info with RESET	*/
-			
-			TCP_DEBUGOUT("Unrecognized packet\n\r");
-			
-			tcp_sendreset(&received_tcp_packet, frame->sip);
-			
-			return(-1);
-			
 			break;
 			
-		case TCP_STATE_SYN_SENT:
-		
-			TCP_DEBUGOUT("SYN_SENT State\r\n");
+		case TCP_STATE_TIMED_WAIT:
 			
-			/* Check for RESET	*/
+			/* Is there timeout?	*/
 			
-			if(received_tcp_packet.hlen_flags & TCP_FLAG_RESET) {
-				TCP_DEBUGOUT("ERROR:Reset received\r\n");
+			if( check_timer(soc->retransmit_timerh) != 0 )
+				break;
 				
-				/* Inform application	*/
-
-				soc->event_listener(sochandle, TCP_EVENT_ABORT, soc->rem_ip, soc->remport);
-								
-				if(soc->type & TCP_TYPE_SERVER)
-					tcp_newstate(soc, TCP_STATE_LISTENING);
-				else
-					tcp_newstate(soc, TCP_STATE_CLOSED);
-					
-				return(-1);
-			}
-			
-			/* Is it SYN+ACK?	*/
+			TCP_DEBUGOUT("Timeout\r\n");
 			
-			if( (received_tcp_packet.hlen_flags & TCP_FLAG_SYN) &&
-				(received_tcp_packet.hlen_flags & TCP_FLAG_ACK)	) {
-				/* Rigth ACK?	*/
-				
-				if( received_tcp_packet.ackno != soc->send_next ) {
-					TCP_DEBUGOUT("SYN+ACK received but wrong Ack\n\r");
-					return(-1);
-				}
-				
-				TCP_DEBUGOUT("SYN+ACK received, this side established\n\r");
-				
-				/* Get peer's seq number	*/
-				
-				soc->receive_next =  received_tcp_packet.seqno;
-				soc->receive_next++;							/* ACK SYN	*/
-				
-				/* We have no unacked data	*/
-				
-				soc->send_unacked = soc->send_next;
-				
-				tcp_newstate(soc, TCP_STATE_CONNECTED);
-				soc->myflags = TCP_FLAG_ACK;
-				tcp_sendcontrol(sochandle);
-				
-				/* Inform application	*/
-
-				soc->event_listener(sochandle, TCP_EVENT_CONNECTED, soc->rem_ip, soc->remport);
-								
-				return(0);			
-				
+			if(soc->retries_left) {
+				soc->retries_left--;
+				init_timer(soc->retransmit_timerh, TCP_DEF_RETRY_TOUT*TIMERTIC);
+				break;
 			}
 			
-			/* Is it SYN (simultaneous open)	*/
-			
-			if(received_tcp_packet.hlen_flags & TCP_FLAG_SYN) {
-				TCP_DEBUGOUT("Simultaneous open, next SYN_RECEIVED\r\n");
-			
-				/* Get peer's seq number	*/
-				
-				soc->receive_next =  received_tcp_packet.seqno;
-				soc->receive_next++;							/* ACK SYN	*/				
-				
-				tcp_newstate(soc, TCP_STATE_SYN_RECEIVED);
-				soc->myflags = TCP_FLAG_SYN | TCP_FLAG_ACK;
-				tcp_sendcontrol(sochandle);
+			if(soc->type & TCP_TYPE_SERVER )
+				tcp_newstate(soc, TCP_STATE_LISTENING);
+			else
+				tcp_newstate(soc, TCP_STATE_CLOSED);
 				
-				return(0);
-			
-			}
-			
-			/* This is something we didn't understood, maybe the other peer has	*/
-			/* still old connection on or something								*/
-			TCP_DEBUGOUT("TCP packet out of nowhere received...\r\n");
-			tcp_sendreset(&received_tcp_packet, frame->sip);
-			
-			return(-1);
-		
 			break;
 		
+		case TCP_STATE_LAST_ACK:
 		case TCP_STATE_FINW1:
+		case TCP_STATE_CLOSING:
 		
-			TCP_DEBUGOUT("FINW1 State\r\n");
-			
-			/* Check for RESET	*/
+			/* Is there timeout?	*/
 			
-			if(received_tcp_packet.hlen_flags & TCP_FLAG_RESET) {
-				TCP_DEBUGOUT("ERROR:Reset received\r\n");
+			if( check_timer(soc->retransmit_timerh) != 0 )
+				break;
 				
-				/* Inform application	*/
-
-				soc->event_listener(sochandle, TCP_EVENT_ABORT, soc->rem_ip, soc->remport);
-								
-				if(soc->type & TCP_TYPE_SERVER)
-					tcp_newstate(soc, TCP_STATE_LISTENING);
-				else
-					tcp_newstate(soc, TCP_STATE_CLOSED);
+			TCP_DEBUGOUT("Timeout\r\n");		
 					
-				return(-1);
-			}
+			/* Yep, timeout. Is there reties left?	*/
 			
-			/* Is it FIN+ACK?			*/
-			
-			if( (received_tcp_packet.hlen_flags & TCP_FLAG_FIN) &&
-				(received_tcp_packet.hlen_flags & TCP_FLAG_ACK)	) {
-				/* Rigth ACK?	*/
-				
-				if( received_tcp_packet.ackno != soc->send_next ) {
-					TCP_DEBUGOUT("FIN+ACK received but wrong Ack\n\r");
-					return(-1);
-				}
-				
-				TCP_DEBUGOUT("FIN+ACK received, next TIMED_WAIT\n\r");
-				
-				/* ACK FIN and all data	*/
-				
-				soc->receive_next = received_tcp_packet.seqno;
-				soc->receive_next++;
-				soc->receive_next += dlen;
-				
-				/* We have no unacked data	*/
-				
-				soc->send_unacked = soc->send_next;
+			if( soc->retries_left ) {
+				soc->retries_left--;
+				tcp_rtt_backoff(soc);
+				init_timer(soc->retransmit_timerh, soc->rto);
+				soc->myflags = TCP_FLAG_FIN | TCP_FLAG_ACK;
+				tcp_sendcontrol(handle);
 				
-				tcp_newstate(soc, TCP_STATE_TIMED_WAIT);
-				soc->myflags = TCP_FLAG_ACK;
-				tcp_sendcontrol(sochandle);
-							
-				return(0);
-			
-			}
-			
-			/* Is it just FIN	*/
-			
-			if( received_tcp_packet.hlen_flags & TCP_FLAG_FIN	) {
+				return(1);				
+			} else {
+				/* Retries used up	*/
+				TCP_DEBUGOUT("Retries used up, resetting\r\n");
 				
-				TCP_DEBUGOUT("Simultaneous close, next CLOSING\n\r");
+				if(soc->type & TCP_TYPE_SERVER )
+					tcp_newstate(soc, TCP_STATE_LISTENING);
+				else
+					tcp_newstate(soc, TCP_STATE_CLOSED);
 				
-				/* ACK FIN and all data	*/
+				soc->myflags = TCP_FLAG_RESET;
+				tcp_sendcontrol(handle);
 				
-				soc->receive_next = received_tcp_packet.seqno;
-				soc->receive_next++;
-				soc->receive_next += dlen;
+				/* Inform application	*/
+
+				soc->event_listener(handle, TCP_EVENT_ABORT, soc->rem_ip, soc->remport);
 				
-				tcp_newstate(soc, TCP_STATE_CLOSING);
-				soc->myflags = TCP_FLAG_ACK;
-				tcp_sendcontrol(sochandle);			
-				return(0);
-			
+				return(1);
 			}			
 			
-			/* Is it just ACK?	*/
-			
-			if( received_tcp_packet.hlen_flags & TCP_FLAG_ACK	) {
-				/* Rigth ACK?	*/
-				
-				if( received_tcp_packet.ackno != soc->send_next ) {
-					TCP_DEBUGOUT("ACK received but wrong Ack\n\r");
-					return(-1);
-				}
-				
-				TCP_DEBUGOUT("Our FIN is ACKed but peer don't agree to disconnect yet\r\n");
-				TCP_DEBUGOUT("Next FINW2\r\n");
-				
-				/* We have no unacked data	*/
-				
-				soc->send_unacked = soc->send_next;
-				
-				tcp_newstate(soc, TCP_STATE_FINW2);
-				
-				return(0);
-							
-			}
-						
 			break;
-			
+		
 		case TCP_STATE_FINW2:
 		
-			TCP_DEBUGOUT("FINW2 State\r\n");
-			
-			/* Check for RESET	*/
+			/* Is there timeout?	*/
 			
-			if(received_tcp_packet.hlen_flags & TCP_FLAG_RESET) {
-				TCP_DEBUGOUT("ERROR:Reset received\r\n");
+			if( check_timer(soc->retransmit_timerh) != 0 )
+				break;
 				
-				/* Inform application	*/
-
-				soc->event_listener(sochandle, TCP_EVENT_ABORT, soc->rem_ip, soc->remport);				
+			TCP_DEBUGOUT("Timeout\r\n");		
+					
+			/* Yep, timeout. Is there reties left?	*/
+			
+			if( soc->retries_left )	{
+				/* Still keep waiting for FIN	*/
+			
+				soc->retries_left--;
+				init_timer(soc->retransmit_timerh, TCP_DEF_RETRY_TOUT*TIMERTIC);
+				break;			
+			} else {
+				/* Retries used up	*/
+				TCP_DEBUGOUT("Retries used up, resetting\r\n");
 				
-				if(soc->type & TCP_TYPE_SERVER)
+				if(soc->type & TCP_TYPE_SERVER )
 					tcp_newstate(soc, TCP_STATE_LISTENING);
 				else
 					tcp_newstate(soc, TCP_STATE_CLOSED);
-					
-				return(-1);
-			}			
-		
-			/* Do we finally get FIN?	*/
-		
-			if( received_tcp_packet.hlen_flags & TCP_FLAG_FIN	) {
-				
-				TCP_DEBUGOUT("FIN received, next TIMED_WAIT\n\r");
-				
-				/* ACK FIN and all data	*/
 				
-				soc->receive_next = received_tcp_packet.seqno;
-				soc->receive_next++;
-				soc->receive_next += dlen;
+				soc->myflags = TCP_FLAG_RESET;
+				tcp_sendcontrol(handle);
 				
-				tcp_newstate(soc, TCP_STATE_TIMED_WAIT);
-				soc->myflags = TCP_FLAG_ACK;
-				tcp_sendcontrol(sochandle);			
-				return(0);
+				/* Inform application	*/
+
+				soc->event_listener(handle, TCP_EVENT_ABORT, soc->rem_ip, soc->remport);
 			
-			}		
-		
-			break;
+				return(1);
+			}	
+			
+			break;
+		
+		default:
+			break;	
+		
+	}
+	
+	return(0);
+	
+}
+
+
+/** \brief Put socket to the queue of sockets tcp_poll() serves
+ *	\date 19.10.2026
+ *	\param sochandle handle of socket
+ *
+ *	Invoked by the timer pool when a timer of the socket expires, that
+ *	is, from timer interrupt. Use tcp_wakeup() elsewhere.
+ */
+void tcp_ready (UINT8 sochandle)
+{
+	struct tcb* soc;
+	
+	soc = &tcp_socket[sochandle];
+	
+	if(soc->ready)
+		return;
+	
+	soc->ready = TRUE;
+	tcp_readyq[(tcp_readyq_head + tcp_nready) % NO_OF_TCPSOCKETS] = (INT8)sochandle;
+	tcp_nready++;
+
+}
+
+
+/** \brief Have tcp_poll() serve a socket
+ *	\date 19.10.2026
+ *	\param sochandle handle of socket
+ *
+ *	Invoked when something that tcp_poll() has to act on happens to the
+ *	socket other than its timer expiring.
+ */
+void tcp_wakeup (INT8 sochandle)
+{
+	if( (sochandle < 0) || (sochandle >= NO_OF_TCPSOCKETS) )
+		return;
+	
+	OS_EnterCritical();
+	
+	tcp_ready((UINT8)sochandle);
+	
+	OS_ExitCritical();
+
+}
+
+
+
+/** \brief Initialize TCP module
+ *	\ingroup core_initializer
+ * 	\author 
+ *		\li Jari Lahti (jari.lahti@violasystems.com)
+ *	\date 21.07.2002
+ *	\return
+ *		\li -1 - error
+ *		\li >0 - number of sockets initialized
+ *	\warning 
+ *		\li This function <b>must</b> be invoked at startup before any
+ *		other TCP functions are invoked.
+ *
+ *	This function initializes all sockets and corresponding tcbs to known
+ *	state. Timers are also allocated for each socket and everything is
+ *	brought to a predefined state.
+ *
+ */
+INT8 tcp_init (void)
+{
+	UINT16 i;
+	INT16 h;
+	struct tcb* soc;
+	
+	if( NO_OF_TCPSOCKETS < 0 )
+		return(-1);
+	
+	if( NO_OF_TCPSOCKETS == 0 )
+		return(0);
+	
+	TCP_DEBUGOUT("Initializing TCP");
+	
+#if TCP_NO_OF_SNDBUFS > 0
+
+	/* All send buffers are free	*/
+	
+	for(i=0; i < TCP_NO_OF_SNDBUFS; i++)
+		tcp_sndbuf_pool[i].free = TRUE;
+
+#endif
+
+#if TCP_NO_OF_REGIONS > 0
+
+	/* No storage regions registered	*/
+	
+	for(i=0; i < TCP_NO_OF_REGIONS; i++)
+		tcp_region[i].base = 0;
+
+#endif
+
+#if TCP_NO_OF_REASMBUFS > 0
+
+	/* All reassembly buffers are free	*/
+	
+	for(i=0; i < TCP_NO_OF_REASMBUFS; i++)
+		tcp_reasm_pool[i].free = TRUE;
+
+#endif
+
+#if TCP_NO_OF_RCVBUFS > 0
+
+	/* All receive buffers are free	*/
+	
+	for(i=0; i < TCP_NO_OF_RCVBUFS; i++)
+		tcp_rcvbuf_pool[i].free = TRUE;
+
+#endif
+
+	/* Lookup tables are empty	*/
+	
+	for(i=0; i < TCP_HASH_SIZE; i++)
+		tcp_conn_hash[i] = -1;
+	
+	for(i=0; i < TCP_LISTEN_HASH_SIZE; i++)
+		tcp_listen_hash[i] = -1;
+	
+	tcp_syncounters.halfopen = 0;
+	tcp_syncounters.cookies_sent = 0;
+	tcp_syncounters.cookies_ok = 0;
+	tcp_syncounters.cookies_invalid = 0;
+	tcp_cookie_secret = 0;
+	tcp_readyq_head = 0;
+	tcp_nready = 0;
+
+#if TCP_NO_OF_TWRECS > 0
+
+	/* All TIME_WAIT records are free	*/
+	
+	for(i=0; i < TCP_HASH_SIZE; i++)
+		tcp_tw_hash[i] = -1;
+	
+	for(i=0; i < TCP_TW_SLOTS; i++)
+		tcp_tw_wheel[i] = -1;
+	
+	for(i=0; i < TCP_NO_OF_TWRECS; i++)
+		tcp_tw_pool[i].wheel_next = (INT8)(i + 1);
+	
+	tcp_tw_pool[TCP_NO_OF_TWRECS - 1].wheel_next = -1;
+	tcp_tw_freelist = 0;
+	tcp_tw_now = 0;
+	
+	tcp_tw_timerh = get_timer();
+	init_timer(tcp_tw_timerh, TIMERTIC);
+
+#endif
+
+	for(i=0; i < TCP_PORTMAP_SIZE; i++)
+		tcp_portuse[i] = 0;
+	
+	for(i=0; i < NO_OF_TCPSOCKETS; i++) {
+		soc = &tcp_socket[i];			/* Get Socket	*/
+		h = -1;
+		
+		soc->state = TCP_STATE_FREE;
+		soc->type = TCP_TYPE_NONE;
+		soc->flags = 0;
+		soc->rem_ip = 0;
+		soc->remport = 0;
+		soc->locport = 0;
+		soc->myflags = 0;
+		soc->send_mtu = TCP_DEF_MTU;
+		soc->tos = 0;
+		soc->tout = 0;
+		soc->send_window = 0;
+		soc->send_budget = TCP_DEF_SEND_WINDOW;
+		soc->rcv_wnd = TCP_DEF_RECV_WINDOW;
+		soc->rcv_adv = 0;
+		soc->rcv_wscale = 0;
+		soc->snd_wscale = 0;
+		soc->last_ack_sent = 0;
+		soc->ts_recent = 0;
+		soc->ts_recent_age = 0;
+		soc->sndbuf = -1;
+		soc->sndbuf_len = 0;
+		soc->file = -1;
+		soc->file_rest = 0;
+		soc->rcvbuf = -1;
+		soc->rcvbuf_len = 0;
+		soc->coalesce = 0;
+		soc->nsacked = 0;
+		soc->rexmit_high = 0;
+		soc->rexmit_bytes = 0;
+		soc->reasm = -1;
+		soc->reasm_seq = 0;
+		soc->nreasm = 0;
+		soc->hash_next = -1;
+		soc->hash_bucket = 0;
+		soc->backlog = 0;
+		soc->npending = 0;
+		soc->acceptq = -1;
+		soc->parent = -1;
+		soc->qnext = -1;
+		soc->ready = FALSE;
+		soc->rto = TCP_INIT_RETRY_TOUT*TIMERTIC;
+		soc->cc = &tcp_cc_newreno;
+		soc->cwnd = 0;
+		soc->ssthresh = 0;
+		soc->event_listener = 0;
+		
+		/* Reserve Timers	*/
+		
+		h = get_timer();
+		
+		/*
+		if( h < 0 ) {
+			TCP_DEBUGOUT("\n\rERROR:Error getting timer for TCP Socket!\n\r");
+			return(-1);
+		}
+		*/
+		
+		init_timer(h,0);					/* No timeout	*/
+		notify_timer(h, tcp_ready, (UINT8)i);
+		
+		soc->persist_timerh = h;
+		
+		h = get_timer();
+		
+		/*
+		if( h < 0 ) {
+			TCP_DEBUGOUT("\n\rERROR:Error getting timer for TCP Socket!\n\r");
+			return(-1);
+		}
+		*/
+		
+		init_timer(h,0);					/* No timeout	*/
+		notify_timer(h, tcp_ready, (UINT8)i);
+		
+		soc->retransmit_timerh = h;
+		
+		h = get_timer();
+		init_timer(h,0);					/* No timeout	*/
+		notify_timer(h, tcp_ready, (UINT8)i);
+		
+		soc->delack_timerh = h;
+		
+		h = get_timer();
+		init_timer(h,0);					/* No timeout	*/
+		notify_timer(h, tcp_ready, (UINT8)i);
+		
+		soc->flush_timerh = h;
+		
+		soc->retries_left = 0;		 
+		
+		TCP_DEBUGOUT(".");
+		
+	
+	}
+	
+	TCP_DEBUGOUT("\n\rTCP Initialized\n\r");
+	
+	/* Return number of sockets initialized	*/
+	
+	return(i+1);
+	
+
+}
+
+
+
+
+/*******************************************************************************/
+/*******	TCP Internal functions										********/
+/*******************************************************************************/
+
+
+/** \brief Check and process the received TCP frame
+ *	\ingroup periodic_functions
+ * 	\author 
+ *		\li Jari Lahti (jari.lahti@violasystems.com)
+ *	\date 12.07.2002
+ *	\param frame pointer to received ip_frame structure
+ *	\param len length of data contained in IP datagram (in bytes)
+ *	\return 
+ *		\li -1 - Error (packet not OK, or not TCP,or something else)
+ *		\li >0 - Packet OK
+ *
+ *	Invoke this function to process received TCP frames. See main_demo.c for
+ *	an example on how to accomplish this.
+ */
+INT16 process_tcp_in (struct ip_frame* frame, UINT16 len)
+{
+	struct tcb* soc;
+	UINT16 hlen;
+	UINT8 olen;
+	UINT16 dlen;
+	UINT32 diff;
+	INT8 sochandle;	
+	INT16 temp;
+	UINT16 inflight;
+	UINT32 limit;
+	UINT8 fastrexmit;
+	UINT32 swnd;
+	UINT32 wnd;
+	UINT8 acknow;
+	UINT32 seq;
+	UINT8 sacked;
+	UINT8 hasts;
+	UINT32 tsval;
+	UINT32 tsecr;
+	
+	/* Is this TCP?	*/
+	
+	TCP_DEBUGOUT("Processing TCP...\n\r");
+	
+	if( frame->protocol != IP_TCP ) {
+		TCP_DEBUGOUT("ERROR: The protocol is not TCP\n\r");
+		return(-1);
+	}
+	
+	if( len < MIN_TCP_HLEN ) {
+		TCP_DEBUGOUT("ERROR: Received TCP packet too short\r\n");
+		return(-1);
+	}
+
+	/* Get the header. It is read from network only once, checksum	*/
+	/* is calculated over the copy once options are read as well		*/
+	
+	NETWORK_RECEIVE_INITIALIZE(frame->buf_index);
+	
+	RECEIVE_NETWORK_BUF(tcp_tempbuf, MIN_TCP_HLEN);
+	
+	received_tcp_packet.sport = ((UINT16)tcp_tempbuf[0] << 8) | tcp_tempbuf[1];
+	received_tcp_packet.dport = ((UINT16)tcp_tempbuf[2] << 8) | tcp_tempbuf[3];
+	
+	received_tcp_packet.seqno = ((UINT32)tcp_tempbuf[4] << 24) | ((UINT32)tcp_tempbuf[5] << 16) |
+								((UINT32)tcp_tempbuf[6] << 8) | tcp_tempbuf[7];
+	
+	received_tcp_packet.ackno = ((UINT32)tcp_tempbuf[8] << 24) | ((UINT32)tcp_tempbuf[9] << 16) |
+								((UINT32)tcp_tempbuf[10] << 8) | tcp_tempbuf[11];
+	
+	received_tcp_packet.hlen_flags = ((UINT16)tcp_tempbuf[12] << 8) | tcp_tempbuf[13];
+	received_tcp_packet.window = ((UINT16)tcp_tempbuf[14] << 8) | tcp_tempbuf[15];
+	received_tcp_packet.checksum = ((UINT16)tcp_tempbuf[16] << 8) | tcp_tempbuf[17];
+	received_tcp_packet.urgent = ((UINT16)tcp_tempbuf[18] << 8) | tcp_tempbuf[19];
+	
+	/* Little check for options	*/
+	
+	hlen = received_tcp_packet.hlen_flags & 0xF000;
+	hlen >>= 10;
+	
+	if( hlen < MIN_TCP_HLEN ) {
+		TCP_DEBUGOUT("ERROR: Received TCP Header too short\r\n");
+		return(-1);
+	}
+	
+	if(hlen == MIN_TCP_HLEN)
+		TCP_DEBUGOUT("TCP does not contain options\r\n");
+	
+	olen = hlen - MIN_TCP_HLEN;
+	
+	if( olen > MAX_TCP_OPTLEN ) {
+		TCP_DEBUGOUT("ERROR: Received TCP header contains too long option field\r\n");
+		return(-1);
+	}
+	
+	/* Calculate data length	*/
+	
+	if( hlen > len ) {
+		TCP_DEBUGOUT("ERROR: TCP header longer than packet\r\n");
+		return(-1);
+	}
+	
+	dlen = len - hlen;
+	
+	/* Get options (if any)	*/
+	
+	if(olen)
+		RECEIVE_NETWORK_BUF(received_tcp_packet.opt, olen);
+	
+	/* Calculate checksum for received packet	*/
+	
+	if( tcp_check_cs(frame, len, olen) == 1) {
+		TCP_DEBUGOUT("TCP Checksum OK\n\r");
+	} else {
+		TCP_DEBUGOUT("ERROR:TCP Checksum failed\r\n");
+		return(-1);
+	} 
+		
+	/* Try to find rigth socket to process with		*/
+	
+	sochandle = tcp_mapsocket(frame, &received_tcp_packet);
+	
+	if(sochandle < 0) {
+		TCP_DEBUGOUT("ERROR: Processing TCP packet failed\r\n");
+		
+		/* Connection request to a full listening socket is dropped	*/
+		
+		if(sochandle == -1)
+			tcp_sendreset(&received_tcp_packet, frame->sip);
+		
+		return(-1);
+	}
+	
+	/* Acknowledgment may let pending close or buffered data proceed	*/
+	
+	tcp_wakeup(sochandle);
+	
+	received_tcp_packet.buf_index = frame->buf_index + hlen;
+	NETWORK_RECEIVE_INITIALIZE(received_tcp_packet.buf_index);
+	
+	fastrexmit = 0;
+	acknow = 0;
+	
+	
+	
+	/* Get socket reference	*/
+	
+	soc = &tcp_socket[sochandle];
+	
+	/* Window in segments other than SYN is scaled	*/
+	
+	swnd = received_tcp_packet.window;
+	
+	if( ((received_tcp_packet.hlen_flags & TCP_FLAG_SYN) == 0) &&
+		(soc->flags & TCP_INTFLAGS_WSCALE)							)
+		swnd <<= soc->snd_wscale;
+	
+	/* Established connection receiving what it expects takes a	*/
+	/* shortcut past the state machine							*/
+	
+	if( (soc->state == TCP_STATE_CONNECTED) &&
+		tcp_fastpath(sochandle, dlen, olen, swnd) )
+		return(0);
+	
+	/* Process the packet on TCP State Machine		*/
+	
+	switch(soc->state) {
+		case TCP_STATE_CONNECTED:
+		
+			TCP_DEBUGOUT("CONNECTED State\r\n");
+			
+			/* Check for RESET	*/
+			
+			if(received_tcp_packet.hlen_flags & TCP_FLAG_RESET)	{
+				TCP_DEBUGOUT("ERROR:Reset received\r\n");
+
+				/* Inform application	*/
+
+				soc->event_listener(sochandle, TCP_EVENT_ABORT, soc->rem_ip, soc->remport);				
+				
+				if(soc->type & TCP_TYPE_SERVER)
+					tcp_newstate(soc, TCP_STATE_LISTENING);
+				else
+					tcp_newstate(soc, TCP_STATE_CLOSED);
+					
+				return(-1);
+			}
+			
+			/* Check for SYN (If the peer didn't get our SYN+ACK or ACK)	*/
+			
+			if( received_tcp_packet.hlen_flags & TCP_FLAG_SYN )	{
+				/* Is it the SYN+ACK we have already ACKed but maybe ACK lost?	*/
+				
+				if( received_tcp_packet.hlen_flags & TCP_FLAG_ACK )	{
+					/* It's SYN+ACK but how about sequence	*/
+					
+					if( (received_tcp_packet.seqno + 1) == soc->receive_next ) {
+					
+						if( received_tcp_packet.ackno == soc->send_next ) {
+						
+							TCP_DEBUGOUT("Received SYN+ACK again\r\n");
+							
+							/* ACK the SYN	*/
+							soc->myflags = TCP_FLAG_ACK;
+							tcp_sendcontrol(sochandle);
+							return(0);
+						}
+						
+					}
+				
+				 /* It is maybe SYN again so it haven't get our SYN + ACK	*/
+				 /* Let our retransmission handle it						*/
+				 
+				 return(0);
+				
+				
+				}
+			
+			}
+			
+			/* Segment with timestamp older than the last one is an old	*/
+			/* duplicate, possibly from earlier wrap of sequence numbers	*/
+			/* (PAWS, RFC 7323). Segments without timestamp are accepted	*/
+			
+			hasts = 0;
+			
+			if( olen && (soc->flags & TCP_INTFLAGS_TSTAMP) )
+				hasts = tcp_gettimestamp(olen, &tsval, &tsecr);
+			
+			if( hasts && ((INT32)(tsval - soc->ts_recent) < 0) &&
+				((clock_ms() - soc->ts_recent_age) < TCP_PAWS_IDLE) ) {
+				TCP_DEBUGOUT("Old timestamp, segment dropped\r\n");
+				
+				soc->myflags = TCP_FLAG_ACK;
+				tcp_sendcontrol(sochandle);
+				return(0);
+			}
+			
+			/* Process the acknowledgment	*/
+			
+			if( received_tcp_packet.hlen_flags & TCP_FLAG_ACK ) {
+			
+				/* ACK is valid if it's between oldest unacked byte and	*/
+				/* next byte to be sent. It is cumulative so it may		*/
+				/* acknowledge several packets at once					*/
+				
+				/* Data may be acknowledged even after send next was		*/
+				/* rewound for retransmission								*/
+				
+				diff = received_tcp_packet.ackno - soc->send_unacked;
+				inflight = soc->send_next - soc->send_unacked;
+				limit = soc->send_max - soc->send_unacked;
+				
+				if( diff <= limit ) {
+				
+					/* Remember what remote host has selectively acknowledged	*/
+					
+					sacked = 0;
+					
+					if( olen && (soc->flags & TCP_INTFLAGS_SACK) &&
+						((soc->sndbuf >= 0) || (soc->file >= 0)) )
+						sacked = tcp_sack_update(soc, olen);
+				
+					/* Duplicate ACK (RFC 5681) tells that a segment after	*/
+					/* the oldest unacknowledged byte arrived. ACK with SACK	*/
+					/* blocks counts even if window changed (RFC 6675). In	*/
+					/* recovery it lets the next known hole to be			*/
+					/* retransmitted or new data to be sent					*/
+					
+					if( (diff == 0) && (dlen == 0) && (limit != 0) &&
+						((swnd == soc->send_window) || sacked) &&
+						((received_tcp_packet.hlen_flags & TCP_FLAG_FIN) == 0) ) {
+						
+						if(soc->flags & TCP_INTFLAGS_RECOVERY) {
+							if( tcp_sack_hole(soc, &seq) )
+								fastrexmit = 1;
+							else
+								tcp_cc_dupack(soc);
+						} else if(soc->dupacks < TCP_DUPACK_THRESHOLD) {
+							if(++soc->dupacks == TCP_DUPACK_THRESHOLD)
+								fastrexmit = 1;
+						}
+					}
+					
+					/* Enough data selectively acknowledged after the	*/
+					/* oldest unacknowledged byte tells it is lost even	*/
+					/* if duplicate ACKs were lost or not sent			*/
+					
+					if( sacked && ((soc->flags & TCP_INTFLAGS_RECOVERY) == 0) &&
+						tcp_sack_lost(soc) )
+						fastrexmit = 1;
+				
+					/* Take the window from every valid ACK	*/
+					
+					soc->send_window = swnd;
+					
+					/* Application regenerates data from the oldest		*/
+					/* unacknowledged byte on, so without send buffer		*/
+					/* only data sent again since rewind is acknowledged.	*/
+					/* The rest is acknowledged when application resends it	*/
+					
+					if( (soc->sndbuf < 0) && (soc->file < 0) && (diff > inflight) ) {
+						diff = inflight;
+						received_tcp_packet.ackno = soc->send_next;
+					}
+				
+					if( diff ) {
+						if( tcp_newack(sochandle, diff, hasts ? tsecr : 0) )
+							fastrexmit = 1;
+					}
+				}
+			
+			} else {
+				
+				if( soc->send_unacked != soc->send_next ) {
+					TCP_DEBUGOUT("Packet without ACK and unacked data. Packet not processed\r\n");
+					return(0);
+				}
+			
+			}
+			
+			/* Is the sequence OK	*/
+			
+			if(soc->receive_next != received_tcp_packet.seqno)
+			{
+				/* Out of range, inform what we except. Data that	*/
+				/* arrived ahead of a lost segment is kept until the	*/
+				/* segment is retransmitted								*/
+			
+				DEBUGOUT("Too big sequence number received\r\n");
+				
+				if( dlen && ((INT32)(received_tcp_packet.seqno - soc->receive_next) > 0) )
+					tcp_reasm_store(soc, dlen);
+				
+				if(fastrexmit)
+					tcp_fastretransmit(sochandle);
+				
+				soc->myflags = TCP_FLAG_ACK;
+				tcp_sendcontrol(sochandle);
+				return(0);
+			}
+			
+			/* Remember timestamp to echo. When ACK is delayed the	*/
+			/* timestamp of the earliest unacknowledged segment is	*/
+			/* echoed												*/
+			
+			if( hasts && ((INT32)(tsval - soc->ts_recent) >= 0) &&
+				((INT32)(received_tcp_packet.seqno - soc->last_ack_sent) <= 0) ) {
+				soc->ts_recent = tsval;
+				soc->ts_recent_age = clock_ms();
+			}
+			
+			/* Accept only the data that fits in the window we have	*/
+			/* advertised. Rest of it (and FIN after it) is dropped	*/
+			
+			wnd = soc->rcv_adv - soc->receive_next;
+			
+			if( (INT32)wnd < 0 )
+				wnd = 0;
+			
+			if( dlen > wnd ) {
+				TCP_DEBUGOUT("Data exceeds receive window\r\n");
+				
+				dlen = (UINT16)wnd;
+				received_tcp_packet.hlen_flags &= ~TCP_FLAG_FIN;
+				acknow = 1;
+			}
+			
+			/* Generate data event to application	*/
+				
+			tcp_deliver(sochandle, dlen);
+				
+			soc->receive_next += dlen;			
+			
+			/* Segment filled a gap? Give the data kept after it to	*/
+			/* application as well and ACK at once (RFC 5681)		*/
+			
+			if( dlen && soc->nreasm ) {
+				tcp_reasm_deliver(sochandle);
+				acknow = 1;
+			}
+					
+			/* Is the FIN flag set?	*/
+			
+			if( received_tcp_packet.hlen_flags & TCP_FLAG_FIN )	{
+				TCP_DEBUGOUT("Other end want's to close\r\n");
+				
+				/* Inform application if we don't have unacked data	*/
+				
+				if( (soc->send_unacked == soc->send_next) &&
+					(soc->sndbuf_len == 0)					) {
+				
+					soc->event_listener(sochandle, TCP_EVENT_CLOSE, soc->rem_ip, soc->remport);
+				
+					/* ACK FIN and set our own FIN	*/
+				
+					soc->receive_next++;
+					soc->send_next++;
+					soc->myflags = TCP_FLAG_ACK | TCP_FLAG_FIN;
+				
+					tcp_newstate(soc, TCP_STATE_LAST_ACK);
+					tcp_sendcontrol(sochandle);
+				
+					return(0);
+				}
+			}
+			
+			/* Retransmit the lost segment now that data is read	*/
+			
+			if(fastrexmit)
+				tcp_fastretransmit(sochandle);
+			
+			/* Send buffered data and ACK received data	*/
+			
+			tcp_output(sochandle, dlen, acknow);
+			
+			/* Restart idle timer. Retransmission timer is left alone		*/
+			/* so that duplicate ACKs don't delay retransmission			*/
+			
+			init_timer(soc->persist_timerh, soc->tout);
+			
+
+			return(0);
+			
+		
+			break;
+	
+		case TCP_STATE_FREE:
+			
+			/* Reset connection	*/
+			tcp_sendreset(&received_tcp_packet, frame->sip);
+			return(-1);
+		
+			break;
+		
+		case TCP_STATE_CLOSED:
+			
+			/* Reset connection	*/
+			tcp_sendreset(&received_tcp_packet, frame->sip);
+			return(-1);		
+		
+			break;
+		
+		case TCP_STATE_LISTENING:
+		
+			TCP_DEBUGOUT("LISTENING State...\r\n");
+		
+			/* Check Flags	*/
+			
+			if(received_tcp_packet.hlen_flags & TCP_FLAG_RESET) {
+				TCP_DEBUGOUT("ERROR:Reset received\r\n");
+				tcp_newstate(soc, TCP_STATE_LISTENING);
+				return(-1);
+			}
+			
+			/* ACK is passed to listening socket only if it brings back	*/
+			/* a valid SYN cookie (see tcp_mapsocket())					*/
+			
+			if(received_tcp_packet.hlen_flags & TCP_FLAG_ACK) {
+				TCP_DEBUGOUT("ACK with SYN cookie received\r\n");
+			} else if((received_tcp_packet.hlen_flags & TCP_FLAG_SYN) == 0) {
+				TCP_DEBUGOUT("ERROR:No SYN set on packet\r\n");
+				tcp_newstate(soc, TCP_STATE_LISTENING);
+				/* Reset connection	*/
+				tcp_sendreset(&received_tcp_packet, frame->sip);
+				return(-1);
+			}
+			
+			/* OK, SYN or SYN cookie received	*/
+			
+			/* Inform application and see if accepted	*/
+			
+			temp = (INT16)soc->event_listener(sochandle, TCP_EVENT_CONREQ, soc->rem_ip, soc->remport);
+			
+			if( temp == -1)	{
+				TCP_DEBUGOUT("Application disregarded connection request\r\n");
+				tcp_sendreset(&received_tcp_packet, frame->sip);
+				
+				if(soc->parent >= 0) {
+					tcp_newstate(soc, TCP_STATE_CLOSED);
+					tcp_releasesocket(sochandle);
+				}
+				
+				return(-1);
+			}
+			
+			if( temp == -2 ) {
+				TCP_DEBUGOUT("Application wants to think about accepting conreq\r\n");
+				
+				/* Retransmitted SYN gets a new socket	*/
+				
+				if(soc->parent >= 0) {
+					tcp_newstate(soc, TCP_STATE_CLOSED);
+					tcp_releasesocket(sochandle);
+				}
+				
+				return(1);
+			}
+			
+			/* The connection request was accepted	*/
+			
+			TCP_DEBUGOUT("Next state SYN_RECEIVED\r\n");
+			if(soc->flags & TCP_INTFLAGS_CLOSEPENDING)
+				soc->flags ^= TCP_INTFLAGS_CLOSEPENDING;
+			
+			tcp_rtt_init(soc);
+			tcp_newstate(soc, TCP_STATE_SYN_RECEIVED);
+			
+			if((received_tcp_packet.hlen_flags & TCP_FLAG_ACK) == 0) {
+				tcp_getoptions(soc, olen);
+				soc->receive_next = received_tcp_packet.seqno + 1;	/* Ack SYN		*/
+				soc->send_unacked = tcp_initseq();
+				soc->send_window = swnd;
+				
+				soc->myflags = TCP_FLAG_SYN | TCP_FLAG_ACK;
+				tcp_sendcontrol(sochandle);
+				soc->send_next = soc->send_unacked + 1;
+				
+				return(1);
+			}
+			
+			/* Restore the state SYN+ACK carrying the cookie would have	*/
+			/* left and handle the ACK in SYN_RECEIVED state. No options	*/
+			/* except MSS were sent with the cookie. Time SYN+ACK was		*/
+			/* sent isn't known so the ACK gives no round-trip time		*/
+			
+			tcp_syncounters.cookies_ok++;
+			
+			soc->flags &= ~TCP_INTFLAGS_RTTTIMING;
+			soc->flags &= ~(TCP_INTFLAGS_WSCALE | TCP_INTFLAGS_SACK | TCP_INTFLAGS_TSTAMP);
+			soc->snd_wscale = 0;
+			soc->rcv_wscale = 0;
+			soc->send_mtu = tcp_cookie_mss[((received_tcp_packet.ackno - 1) >> 24) & 0x07] + MIN_TCP_HLEN;
+			soc->receive_next = received_tcp_packet.seqno;
+			soc->rcv_adv = soc->receive_next + (soc->rcv_wnd > 0xFFFF ? 0xFFFF : soc->rcv_wnd);
+			soc->send_unacked = received_tcp_packet.ackno - 1;
+			soc->send_next = received_tcp_packet.ackno;
+			swnd = received_tcp_packet.window;
+			
+			/* Fall through	*/
+			
+		case TCP_STATE_SYN_RECEIVED:
+		
+			TCP_DEBUGOUT("SYN_RECEIVED State...\r\n");
+			
+			/* Check Flags	*/
+			
+			if(received_tcp_packet.hlen_flags & TCP_FLAG_RESET)	{
+				TCP_DEBUGOUT("ERROR:Reset received\r\n");
+				
+				/* Inform application	*/
+				
+				soc->event_listener(sochandle, TCP_EVENT_ABORT, soc->rem_ip, soc->remport);
+				
+				if(soc->type & TCP_TYPE_SERVER)
+					tcp_newstate(soc, TCP_STATE_LISTENING);
+				else
+					tcp_newstate(soc, TCP_STATE_CLOSED);
+					
+				return(-1);
+			}
+			
+			/* Is it SYN+ACK (if we are the because of simultaneous open)	*/
+			
+			if( (received_tcp_packet.hlen_flags & TCP_FLAG_SYN) &&
+				(received_tcp_packet.hlen_flags & TCP_FLAG_ACK)	) {			
+				
+				if( received_tcp_packet.ackno != soc->send_next ) {
+					TCP_DEBUGOUT("SYN+ACK received but wrong Ack\n\r");
+					return(-1);
+				}
+				
+				TCP_DEBUGOUT("SYN+ACK received, this side established\n\r");
+				
+				/* Get peer's seq number	*/
+				
+				soc->receive_next =  received_tcp_packet.seqno;
+				soc->receive_next++;							/* ACK SYN	*/
+				
+				/* We have no unacked data	*/
+				
+				soc->send_unacked = soc->send_next;
+				soc->send_window = swnd;
+				
+				/* SYN acknowledged, take the first round-trip time	*/
+				
+				if(soc->flags & TCP_INTFLAGS_RTTTIMING)
+					tcp_rtt_sample(soc);
+				
+				tcp_newstate(soc, TCP_STATE_CONNECTED);
+				soc->myflags = TCP_FLAG_ACK;
+				tcp_sendcontrol(sochandle);
+				
+				/* Inform application	*/
+				
+				soc->event_listener(sochandle, TCP_EVENT_CONNECTED, soc->rem_ip, soc->remport);
+				
+				return(0);					
+								
+			}
+			
+			/* Is it ACK?		*/
+			
+			if( received_tcp_packet.hlen_flags & TCP_FLAG_ACK )	{
+				if( received_tcp_packet.ackno != soc->send_next ) {
+					TCP_DEBUGOUT("ACK received but wrong Ack\n\r");
+					return(-1);
+				}
+				
+				if( received_tcp_packet.seqno != soc->receive_next ) {
+					TCP_DEBUGOUT("ACK received but Wrong SEQ number\n\r");
+					return(-1);
+				}
+				
+				TCP_DEBUGOUT("ACK received, this side CONNECTED\r\n");
+				
+				/* We have no unacked data	*/
+				
+				soc->send_unacked = soc->send_next;
+				soc->send_window = swnd;
+				
+				/* SYN acknowledged, take the first round-trip time	*/
+				
+				if(soc->flags & TCP_INTFLAGS_RTTTIMING)
+					tcp_rtt_sample(soc);
+				
+				tcp_newstate(soc, TCP_STATE_CONNECTED);
+
+				/* Inform application	*/
+				
+				soc->event_listener(sochandle, TCP_EVENT_CONNECTED, soc->rem_ip, soc->remport);
+				
+				/* Data sent with the ACK (always when the ACK that brought	*/
+				/* back a SYN cookie was lost) is processed once connected	*/
+				
+				if( dlen && (soc->state == TCP_STATE_CONNECTED) )
+					return(process_tcp_in(frame, len));
+								
+				return(0);
+					
+			}
+			
+			/* Is it SYN?		*/
+			
+			if( received_tcp_packet.hlen_flags & TCP_FLAG_SYN ) {
+				TCP_DEBUGOUT("Repeated SYN\r\n");
+				return(0);
+			}
+			
+			/* We didn't understood this one, keep on trying but info with RESET	*/
+			
+			TCP_DEBUGOUT("Unrecognized packet\n\r");
+			
+			tcp_sendreset(&received_tcp_packet, frame->sip);
+			
+			return(-1);
+			
+			break;
+			
+		case TCP_STATE_SYN_SENT:
+		
+			TCP_DEBUGOUT("SYN_SENT State\r\n");
+			
+			/* Check for RESET	*/
+			
+			if(received_tcp_packet.hlen_flags & TCP_FLAG_RESET) {
+				TCP_DEBUGOUT("ERROR:Reset received\r\n");
+				
+				/* Inform application	*/
+
+				soc->event_listener(sochandle, TCP_EVENT_ABORT, soc->rem_ip, soc->remport);
+								
+				if(soc->type & TCP_TYPE_SERVER)
+					tcp_newstate(soc, TCP_STATE_LISTENING);
+				else
+					tcp_newstate(soc, TCP_STATE_CLOSED);
+					
+				return(-1);
+			}
+			
+			/* Is it SYN+ACK?	*/
+			
+			if( (received_tcp_packet.hlen_flags & TCP_FLAG_SYN) &&
+				(received_tcp_packet.hlen_flags & TCP_FLAG_ACK)	) {
+				/* Rigth ACK?	*/
+				
+				if( received_tcp_packet.ackno != soc->send_next ) {
+					TCP_DEBUGOUT("SYN+ACK received but wrong Ack\n\r");
+					return(-1);
+				}
+				
+				TCP_DEBUGOUT("SYN+ACK received, this side established\n\r");
+				
+				tcp_getoptions(soc, olen);
+				
+				/* Get peer's seq number	*/
+				
+				soc->receive_next =  received_tcp_packet.seqno;
+				soc->receive_next++;							/* ACK SYN	*/
+				soc->rcv_adv = soc->receive_next;
+				
+				/* We have no unacked data	*/
+				
+				soc->send_unacked = soc->send_next;
+				soc->send_window = swnd;
+				
+				/* SYN acknowledged, take the first round-trip time	*/
+				
+				if(soc->flags & TCP_INTFLAGS_RTTTIMING)
+					tcp_rtt_sample(soc);
+				
+				tcp_newstate(soc, TCP_STATE_CONNECTED);
+				soc->myflags = TCP_FLAG_ACK;
+				tcp_sendcontrol(sochandle);
+				
+				/* Inform application	*/
+
+				soc->event_listener(sochandle, TCP_EVENT_CONNECTED, soc->rem_ip, soc->remport);
+								
+				return(0);			
+				
+			}
+			
+			/* Is it SYN (simultaneous open)	*/
+			
+			if(received_tcp_packet.hlen_flags & TCP_FLAG_SYN) {
+				TCP_DEBUGOUT("Simultaneous open, next SYN_RECEIVED\r\n");
+			
+				tcp_getoptions(soc, olen);
+			
+				/* Get peer's seq number	*/
+				
+				soc->receive_next =  received_tcp_packet.seqno;
+				soc->receive_next++;							/* ACK SYN	*/				
+				soc->send_window = swnd;
+				
+				tcp_newstate(soc, TCP_STATE_SYN_RECEIVED);
+				soc->myflags = TCP_FLAG_SYN | TCP_FLAG_ACK;
+				tcp_sendcontrol(sochandle);
+				
+				return(0);
+			
+			}
+			
+			/* This is something we didn't understood, maybe the other peer has	*/
+			/* still old connection on or something								*/
+			TCP_DEBUGOUT("TCP packet out of nowhere received...\r\n");
+			tcp_sendreset(&received_tcp_packet, frame->sip);
+			
+			return(-1);
+		
+			break;
+		
+		case TCP_STATE_FINW1:
+		
+			TCP_DEBUGOUT("FINW1 State\r\n");
+			
+			/* Check for RESET	*/
+			
+			if(received_tcp_packet.hlen_flags & TCP_FLAG_RESET) {
+				TCP_DEBUGOUT("ERROR:Reset received\r\n");
+				
+				/* Inform application	*/
+
+				soc->event_listener(sochandle, TCP_EVENT_ABORT, soc->rem_ip, soc->remport);
+								
+				if(soc->type & TCP_TYPE_SERVER)
+					tcp_newstate(soc, TCP_STATE_LISTENING);
+				else
+					tcp_newstate(soc, TCP_STATE_CLOSED);
+					
+				return(-1);
+			}
+			
+			/* Is it FIN+ACK?			*/
+			
+			if( (received_tcp_packet.hlen_flags & TCP_FLAG_FIN) &&
+				(received_tcp_packet.hlen_flags & TCP_FLAG_ACK)	) {
+				/* Rigth ACK?	*/
+				
+				if( received_tcp_packet.ackno != soc->send_next ) {
+					TCP_DEBUGOUT("FIN+ACK received but wrong Ack\n\r");
+					return(-1);
+				}
+				
+				TCP_DEBUGOUT("FIN+ACK received, next TIMED_WAIT\n\r");
+				
+				/* ACK FIN and all data	*/
+				
+				soc->receive_next = received_tcp_packet.seqno;
+				soc->receive_next++;
+				soc->receive_next += dlen;
+				
+				/* We have no unacked data	*/
+				
+				soc->send_unacked = soc->send_next;
+				
+				soc->myflags = TCP_FLAG_ACK;
+				tcp_sendcontrol(sochandle);
+				tcp_timewait(soc);
+							
+				return(0);
+			
+			}
+			
+			/* Is it just FIN	*/
+			
+			if( received_tcp_packet.hlen_flags & TCP_FLAG_FIN	) {
+				
+				TCP_DEBUGOUT("Simultaneous close, next CLOSING\n\r");
+				
+				/* ACK FIN and all data	*/
+				
+				soc->receive_next = received_tcp_packet.seqno;
+				soc->receive_next++;
+				soc->receive_next += dlen;
+				
+				tcp_newstate(soc, TCP_STATE_CLOSING);
+				soc->myflags = TCP_FLAG_ACK;
+				tcp_sendcontrol(sochandle);			
+				return(0);
+			
+			}			
+			
+			/* Is it just ACK?	*/
+			
+			if( received_tcp_packet.hlen_flags & TCP_FLAG_ACK	) {
+				/* Rigth ACK?	*/
+				
+				if( received_tcp_packet.ackno != soc->send_next ) {
+					TCP_DEBUGOUT("ACK received but wrong Ack\n\r");
+					return(-1);
+				}
+				
+				TCP_DEBUGOUT("Our FIN is ACKed but peer don't agree to disconnect yet\r\n");
+				TCP_DEBUGOUT("Next FINW2\r\n");
+				
+				/* We have no unacked data	*/
+				
+				soc->send_unacked = soc->send_next;
+				
+				tcp_newstate(soc, TCP_STATE_FINW2);
+				
+				return(0);
+							
+			}
+						
+			break;
+			
+		case TCP_STATE_FINW2:
+		
+			TCP_DEBUGOUT("FINW2 State\r\n");
+			
+			/* Check for RESET	*/
+			
+			if(received_tcp_packet.hlen_flags & TCP_FLAG_RESET) {
+				TCP_DEBUGOUT("ERROR:Reset received\r\n");
+				
+				/* Inform application	*/
+
+				soc->event_listener(sochandle, TCP_EVENT_ABORT, soc->rem_ip, soc->remport);				
+				
+				if(soc->type & TCP_TYPE_SERVER)
+					tcp_newstate(soc, TCP_STATE_LISTENING);
+				else
+					tcp_newstate(soc, TCP_STATE_CLOSED);
+					
+				return(-1);
+			}			
+		
+			/* Do we finally get FIN?	*/
+		
+			if( received_tcp_packet.hlen_flags & TCP_FLAG_FIN	) {
+				
+				TCP_DEBUGOUT("FIN received, next TIMED_WAIT\n\r");
+				
+				/* ACK FIN and all data	*/
+				
+				soc->receive_next = received_tcp_packet.seqno;
+				soc->receive_next++;
+				soc->receive_next += dlen;
+				
+				soc->myflags = TCP_FLAG_ACK;
+				tcp_sendcontrol(sochandle);
+				tcp_timewait(soc);
+				return(0);
+			
+			}		
+		
+			break;
+			
+		case TCP_STATE_CLOSING:
+		
+			TCP_DEBUGOUT("CLOSING State...\r\n");
+			
+			/* Check for RESET	*/
+			
+			if(received_tcp_packet.hlen_flags & TCP_FLAG_RESET)	{
+				TCP_DEBUGOUT("ERROR:Reset received\r\n");
+
+				/* Inform application	*/
+
+				soc->event_listener(sochandle, TCP_EVENT_ABORT, soc->rem_ip, soc->remport);				
+				
+				if(soc->type & TCP_TYPE_SERVER)
+					tcp_newstate(soc, TCP_STATE_LISTENING);
+				else
+					tcp_newstate(soc, TCP_STATE_CLOSED);
+					
+				return(-1);
+			}			
+			
+			/* Is it ACK?			*/
+			
+			if( received_tcp_packet.hlen_flags & TCP_FLAG_ACK	) {
+				/* Rigth ACK?	*/
+				
+				if( received_tcp_packet.ackno != soc->send_next ) {
+					TCP_DEBUGOUT("ACK received but wrong Ack\n\r");
+					return(-1);
+				}
+				
+				TCP_DEBUGOUT("Our FIN is ACKed and peer wants to close too\r\n");
+				TCP_DEBUGOUT("Next TIMED_WAIT\r\n");
+
+				/* We have no unacked data	*/
+				
+				soc->send_unacked = soc->send_next;
+				
+				tcp_timewait(soc);
+				
+				return(0);
+							
+			}
+	
+			/* Is it repeated FIN?	*/
+			
+			if( received_tcp_packet.hlen_flags & TCP_FLAG_FIN	) {
+				
+				TCP_DEBUGOUT("Repeated FIN, repeat ACK\n\r");
+				
+				/* ACK FIN and all data	*/
+				
+				soc->receive_next = received_tcp_packet.seqno;
+				soc->receive_next++;
+				soc->receive_next += dlen;
+				
+				soc->myflags = TCP_FLAG_ACK;
+				tcp_sendcontrol(sochandle);			
+			
+				return(0);
+			
+			}
+
+		
+			break;
+		
+		case TCP_STATE_LAST_ACK:
+		
+			TCP_DEBUGOUT("LAST_ACK State...\r\n");
+			
+			/* Check for RESET	*/
+			
+			if(received_tcp_packet.hlen_flags & TCP_FLAG_RESET) {
+				TCP_DEBUGOUT("ERROR:Reset received\r\n");
+				
+				/* Inform application	*/
+
+				soc->event_listener(sochandle, TCP_EVENT_ABORT, soc->rem_ip, soc->remport);				
+				
+				if(soc->type & TCP_TYPE_SERVER)
+					tcp_newstate(soc, TCP_STATE_LISTENING);
+				else
+					tcp_newstate(soc, TCP_STATE_CLOSED);
+					
+				return(-1);
+			}			
+			
+			/* Is it ACK?	*/
+			
+			if( received_tcp_packet.hlen_flags & TCP_FLAG_ACK	) {
+				/* Rigth ACK?	*/
+				
+				if( received_tcp_packet.ackno != soc->send_next ) {
+					TCP_DEBUGOUT("ACK received but wrong Ack\n\r");
+					return(-1);
+				}
+				
+				TCP_DEBUGOUT("Last ACK received, next LISTENING or CLOSED\r\n");
+				
+				/* We have no unacked data	*/
+				
+				soc->send_unacked = soc->send_next;				
+				
+				if(soc->type & TCP_TYPE_SERVER)
+					tcp_newstate(soc, TCP_STATE_LISTENING);
+				else
+					tcp_newstate(soc, TCP_STATE_CLOSED);
+												
+				return(0);
+							
+			}			
+
+			/* Is it repeated FIN?	*/
+			
+			if( received_tcp_packet.hlen_flags & TCP_FLAG_FIN	) {
+				
+				TCP_DEBUGOUT("Repeated FIN, repeat ACK\n\r");
+				
+				/* ACK FIN and all data	*/
+				
+				soc->receive_next = received_tcp_packet.seqno;
+				soc->receive_next++;
+				soc->receive_next += dlen;
+					
+				soc->myflags = TCP_FLAG_FIN | TCP_FLAG_ACK;
+				tcp_sendcontrol(sochandle);
+							
+				return(0);
+			
+			}			
+			
+		
+			break;
+			
+		case TCP_STATE_TIMED_WAIT:
+		
+			TCP_DEBUGOUT("TIMED_WAIT State...\r\n");
+			
+			/* Check for RESET	*/
+			
+			if(received_tcp_packet.hlen_flags & TCP_FLAG_RESET) {
+				TCP_DEBUGOUT("ERROR:Reset received\r\n");
+
+				/* Inform application	*/
+
+				soc->event_listener(sochandle, TCP_EVENT_ABORT, soc->rem_ip, soc->remport);				
+				
+				if(soc->type & TCP_TYPE_SERVER)
+					tcp_newstate(soc, TCP_STATE_LISTENING);
+				else
+					tcp_newstate(soc, TCP_STATE_CLOSED);
+					
+				return(-1);
+			}			
+			
+			/* Is it repeated FIN?	*/
+			
+			if( received_tcp_packet.hlen_flags & TCP_FLAG_FIN	) {
+				
+				TCP_DEBUGOUT("Repeated FIN, repeat ACK\n\r");
+				
+				/* ACK FIN and all data	*/
+				
+				soc->receive_next = received_tcp_packet.seqno;
+				soc->receive_next++;
+				soc->receive_next += dlen;
+					
+				soc->myflags = TCP_FLAG_ACK;
+				tcp_sendcontrol(sochandle);
+							
+				return(0);
+			
+			}
+		
+			
+		
+			break;
+	
+	
+		default:
+		
+			TCP_DEBUGOUT("ERROR:TCP State machine in unknown state!!\r\n");
+			
+			tcp_sendreset(&received_tcp_packet, frame->sip);
+			
+			RESET_SYSTEM();
+	
+	}
+	
+	TCP_DEBUGOUT("Should not be there!\r\n");
+	
+	return(-1);
+		
+}
+
+
+/** \brief Process segment that was predicted
+ *	\date 19.10.2026
+ *	\param sochandle handle of CONNECTED socket the segment is for
+ *	\param dlen amount of data in segment
+ *	\param olen length of options in segment
+ *	\param swnd send window advertised in segment (scaled)
+ *	\return
+ *		\li 0 - Segment must go through the state machine
+ *		\li 1 - Segment was processed
+ *
+ *	Header prediction (Van Jacobson). Most segments of an established
+ *	connection acknowledge new data and/or carry the data expected
+ *	next, nothing else changes. Such segments are recognized
+ *	with a few comparisons and processed without the rest of the checks
+ *	made by the state machine. Timestamp option is the only option
+ *	expected and it must be in the layout recommended by RFC 7323
+ *	(appendix A), so options are not parsed.
+ */
+UINT8 tcp_fastpath (INT8 sochandle, UINT16 dlen, UINT8 olen, UINT32 swnd)
+{
+	struct tcb* soc;
+	UINT8* opt;
+	UINT32 diff;
+	UINT32 tsval;
+	UINT32 tsecr;
+	
+	soc = &tcp_socket[sochandle];
+	
+	/* Plain ACK with the next sequence number and no recovery or	*/
+	/* retransmission going on										*/
+	
+	if( (received_tcp_packet.hlen_flags & (TCP_FLAG_URGENT | TCP_FLAG_ACK | TCP_FLAG_RESET | 
+										   TCP_FLAG_SYN | TCP_FLAG_FIN)) != TCP_FLAG_ACK )
+		return(0);
+	
+	if( (received_tcp_packet.seqno != soc->receive_next) ||
+		(soc->send_next != soc->send_max) ||
+		(soc->flags & TCP_INTFLAGS_RECOVERY) ||
+		soc->nreasm									)
+		return(0);
+	
+	/* Timestamp alone if timestamps are in use, no options otherwise	*/
+	
+	tsval = 0;
+	tsecr = 0;
+	
+	if(soc->flags & TCP_INTFLAGS_TSTAMP) {
+		opt = received_tcp_packet.opt;
+		
+		if( (olen != TCP_DATA_OPTLEN) ||
+			(opt[0] != TCP_OPTKIND_NOP) || (opt[1] != TCP_OPTKIND_NOP) ||
+			(opt[2] != TCP_OPTKIND_TSTAMP) || (opt[3] != TCP_OPTLEN_TSTAMP) )
+			return(0);
+		
+		tsval = ((UINT32)opt[4] << 24) | ((UINT32)opt[5] << 16) |
+				((UINT32)opt[6] << 8) | opt[7];
+		tsecr = ((UINT32)opt[8] << 24) | ((UINT32)opt[9] << 16) |
+				((UINT32)opt[10] << 8) | opt[11];
+		
+		/* Older timestamp is left for PAWS check	*/
+		
+		if( (INT32)(tsval - soc->ts_recent) < 0 )
+			return(0);
+	
+	} else if(olen)
+		return(0);
+	
+	/* New data acknowledged, data that fits in the window or both	*/
+	
+	diff = received_tcp_packet.ackno - soc->send_unacked;
+	
+	if( diff > (UINT32)(soc->send_next - soc->send_unacked) )
+		return(0);
+	
+	if( (diff == 0) && (dlen == 0) )
+		return(0);
+	
+	if( (INT32)(soc->rcv_adv - soc->receive_next) < (INT32)dlen )
+		return(0);
+	
+	TCP_DEBUGOUT("Segment predicted\r\n");
+	
+	if( (soc->flags & TCP_INTFLAGS_TSTAMP) &&
+		((INT32)(received_tcp_packet.seqno - soc->last_ack_sent) <= 0) ) {
+		soc->ts_recent = tsval;
+		soc->ts_recent_age = clock_ms();
+	}
+	
+	soc->send_window = swnd;
+	
+	if(diff)
+		tcp_newack(sochandle, diff, tsecr);
+	
+	if(dlen) {
+		tcp_deliver(sochandle, dlen);
+		soc->receive_next += dlen;
+	}
+	
+	tcp_output(sochandle, dlen, 0);
+	
+	init_timer(soc->persist_timerh, soc->tout);
+	
+	return(1);
+
+}
+
+
+/** \brief Process acknowledgment of new data
+ *	\date 19.10.2026
+ *	\param sochandle handle of CONNECTED socket
+ *	\param diff number of bytes acknowledged
+ *	\param tsecr timestamp echoed by remote host or 0 if none
+ *	\return
+ *		\li 0 - Nothing to retransmit
+ *		\li 1 - Partial ACK in fast recovery, next lost segment
+ *		should be retransmitted
+ *
+ *	Advances the oldest unacknowledged byte, updates congestion
+ *	control and round-trip time, releases the data from send buffer
+ *	and restarts the retransmission timer. Application is informed
+ *	when all data is acknowledged.
+ */
+UINT8 tcp_newack (INT8 sochandle, UINT32 diff, UINT32 tsecr)
+{
+	struct tcb* soc;
+	UINT32 inflight;
+	UINT32 more;
+	UINT8 rexmit;
+	
+	TCP_DEBUGOUT("New data acknowledged\r\n");
+	
+	soc = &tcp_socket[sochandle];
+	
+	rexmit = 0;
+	inflight = soc->send_next - soc->send_unacked;
+	
+	soc->send_unacked += diff;
+	soc->dupacks = 0;
+	
+	if(soc->nsacked)
+		tcp_sack_trim(soc);
+	
+	/* In fast recovery every partial ACK reveals the	*/
+	/* next lost segment (NewReno, RFC 6582)			*/
+	
+	if( (soc->flags & TCP_INTFLAGS_RECOVERY) &&
+		((INT32)(soc->send_unacked - soc->recover) >= 0) ) {
+		soc->flags &= ~TCP_INTFLAGS_RECOVERY;
+		tcp_cc_recovered(soc);
+	} else {
+		if(soc->flags & TCP_INTFLAGS_RECOVERY)
+			rexmit = 1;
+		
+		tcp_cc_ack(soc, diff);
+	}
+	
+	if( diff > inflight )
+		soc->send_next = soc->send_unacked;
+	
+	/* Release acknowledged data from send buffer. Sent part of	*/
+	/* file is replaced with more of the file until it has all	*/
+	/* been acknowledged										*/
+	
+	if(soc->file >= 0) {
+		soc->sndbuf_len -= (UINT16)diff;
+		soc->file_pos += diff;
+		
+		more = 0x7FFF - soc->sndbuf_len;
+		
+		if(more > soc->file_rest)
+			more = soc->file_rest;
+		
+		soc->sndbuf_len += (UINT16)more;
+		soc->file_rest -= more;
+		
+		if(soc->sndbuf_len == 0)
+			soc->file = -1;
+	} else if(soc->sndbuf >= 0) {
+		soc->sndbuf_len -= (UINT16)diff;
+		soc->sndbuf_start += (UINT16)diff;
+		
+		if(soc->sndbuf_start >= TCP_SNDBUF_SIZE)
+			soc->sndbuf_start -= TCP_SNDBUF_SIZE;
+	}
+	
+	/* Echoed timestamp gives round-trip time on every	*/
+	/* ACK, retransmissions included (RFC 7323).		*/
+	/* Otherwise wait for the timed segment				*/
+	
+	if( tsecr && ((clock_ms() - tsecr) < TCP_MAX_RTO) ) {
+		soc->flags &= ~TCP_INTFLAGS_RTTTIMING;
+		tcp_rtt_update(soc, (clock_ms() - tsecr) * 1000);
+	} else if( (soc->flags & TCP_INTFLAGS_RTTTIMING) &&
+		((INT32)(soc->send_unacked - soc->rtt_seq) >= 0) )
+		tcp_rtt_sample(soc);
+	
+	/* Progress, restart retransmission timer	*/
+	
+	soc->retries_left = TCP_DEF_RETRIES;
+	init_timer(soc->retransmit_timerh, soc->rto);
+	
+	/* Inform application if all data is acknowledged	*/
+
+	if( (soc->send_unacked == soc->send_next) &&
+		(soc->sndbuf_len == 0)					)
+		soc->event_listener(sochandle, TCP_EVENT_ACK, soc->rem_ip, soc->remport);
+	
+	return(rexmit);
+
+}
+
+
+/** \brief Send buffered data and acknowledge received data
+ *	\date 19.10.2026
+ *	\param sochandle handle of CONNECTED socket
+ *	\param dlen amount of data just received
+ *	\param acknow nonzero if ACK must not be delayed
+ *
+ *	Sends the data in send buffer the window now allows, data packets
+ *	acknowledge the received data as well. Otherwise ACK is delayed in
+ *	hope that application answers and ACK goes with the answer, but
+ *	every second segment is ACKed immediately (RFC 1122).
+ */
+void tcp_output (INT8 sochandle, UINT16 dlen, UINT8 acknow)
+{
+	struct tcb* soc;
+	
+	soc = &tcp_socket[sochandle];
+	
+	if( (soc->sndbuf_len) && tcp_sndbuf_output(sochandle) )
+		dlen = 0;
+	
+	if( acknow || (dlen && (TCP_DELACK_TIME == 0)) ||
+		(dlen && (soc->flags & TCP_INTFLAGS_DELACK))	) {
+		soc->myflags = TCP_FLAG_ACK;
+		tcp_sendcontrol(sochandle);
+	} else if(dlen) {
+		soc->flags |= TCP_INTFLAGS_DELACK;
+		init_timer(soc->delack_timerh, (TCP_DELACK_TIME * (UINT32)TIMERTIC + 999) / 1000);
+	}
+
+}
+
+
+/** \brief Create and send TCP packet
+ * 	\author 
+ *		\li Jari Lahti (jari.lahti@violasystems.com)
+ *	\date 16.07.2002
+ *	\param sockethandle handle to processed socket
+ *	\param buf pointer to data buffer (where TCP header will be stored).
+ *		Data, if any, starts #TCP_APP_OFFSET bytes after it
+ *	\param blen buffer length in bytes
+ *	\param dlen length of data in bytes
+ *	\return 
+ *		\li -1 - Error
+ *		\li >0 - Packet OK
+ *
+ *	Based on data supplied as function parameters and data stored in 
+ *	socket's tcb, TCP header is created in buffer, checksum is calculated
+ *	and packet is forwarded to lower layers (IP).
+ *
+ */
+INT16 process_tcp_out (INT8 sockethandle, UINT8* buf, UINT16 blen, UINT16 dlen)
+{
+	struct ip_iovec iov;
+	
+	TCP_DEBUGOUT("Entering to send TCP packet\r\n");
+	
+	if( sockethandle < 0 ) {
+		TCP_DEBUGOUT("ERROR:Socket Handle not valid (<0)\r\n");
+		return(-1);
+	}
+	
+	if( sockethandle > NO_OF_TCPSOCKETS ) {
+		TCP_DEBUGOUT("ERROR:Socket Handle not valid (>NO_OF_TCPSOCKETS)\r\n");
+		return(-1);
+	}
+	
+	if( (dlen + TCP_APP_OFFSET) > blen ) {
+		TCP_DEBUGOUT("ERROR:Transmit buffer too small for TCP header\r\n");
+		return(-1);
+	} 
+	
+	/* Header is built to the space reserved before data	*/
+	
+	iov.data = buf + TCP_APP_OFFSET;
+	iov.len = dlen;
+	
+	if(dlen)
+		blen = TCP_APP_OFFSET;
+	
+	return( tcp_sendseg(sockethandle, buf, blen, &iov, dlen ? 1 : 0) );
+
+}
+
+
+/** \brief Create and send TCP segment from several buffers
+ *	\date 19.10.2026
+ *	\param sockethandle handle to processed socket
+ *	\param hdr buffer where TCP header and options are built
+ *	\param hlen size of hdr in bytes. If it can't hold all options
+ *		control packet carries no options
+ *	\param iov pieces of data carried in the segment
+ *	\param cnt number of pieces (0 for control packets)
+ *	\return
+ *		\li -1 - Error
+ *		\li >=0 - Packet OK
+ *
+ *	TCP header is built in hdr and checksum is computed over it and the
+ *	data pieces, which are then handed to IP layer as they are, so data
+ *	doesn't need to be contiguous nor have room for the header.
+ */
+INT16 tcp_sendseg (INT8 sockethandle, UINT8* hdr, UINT16 hlen, struct ip_iovec* iov, UINT8 cnt)
+{
+	struct tcb* soc;
+	UINT16 cs;
+	UINT8 cs_cnt;
+	UINT16 i;
+	UINT16 dlen;
+	UINT8* buf;
+	UINT32 seq;
+	UINT8 olen;
+	UINT16 wnd;
+	
+	if( (sockethandle < 0) || (sockethandle > NO_OF_TCPSOCKETS) ) {
+		TCP_DEBUGOUT("ERROR:Socket Handle not valid\r\n");
+		return(-1);
+	}
+	
+	if(hlen < MIN_TCP_HLEN + TCP_DATA_OPTLEN) {
+		TCP_DEBUGOUT("ERROR:Header buffer too small\r\n");
+		return(-1);
+	}
+	
+	soc = &tcp_socket[sockethandle];				/* Get socket	*/
+	
+	dlen = 0;
+	
+	for(i=0; i < cnt; i++)
+		dlen += iov[i].len;
+	
+	if( (dlen + MIN_TCP_HLEN) > soc->send_mtu ) {
+		TCP_DEBUGOUT("ERROR:Send MTU exceeded\r\n");
+		return(-1);
+	}
+	
+	/* SYN and FIN occupy the oldest unacknowledged sequence number.	*/
+	/* Data packets were already added to send_next by tcp_send and		*/
+	/* other control packets carry the next sequence number				*/
+	
+	if( soc->myflags & (TCP_FLAG_SYN | TCP_FLAG_FIN) )
+		seq = soc->send_unacked;
+	else
+		seq = soc->send_next - dlen;
+	
+	/* Data packets carry only timestamp option	*/
+	
+	olen = 0;
+	
+	if(dlen) {
+		if(soc->flags & TCP_INTFLAGS_TSTAMP)
+			olen = TCP_DATA_OPTLEN;
+		
+		if(olen)
+			tcp_putoptions(soc, hdr + MIN_TCP_HLEN, olen);
+	} else if(hlen >= MIN_TCP_HLEN + MAX_TCP_OPTLEN)
+		olen = tcp_putoptions(soc, hdr + MIN_TCP_HLEN, MAX_TCP_OPTLEN);
+	
+	wnd = tcp_recvwindow(soc);
+	
+	/* This acknowledges everything received	*/
+	
+	if(soc->myflags & TCP_FLAG_ACK) {
+		soc->flags &= ~TCP_INTFLAGS_DELACK;
+		soc->last_ack_sent = soc->receive_next;
+	}
+	
+	/* Assemble TCP header to buffer	*/
+	
+	buf = hdr;
+	
+	*buf++ = (UINT8)(soc->locport >> 8);
+	*buf++ = (UINT8)soc->locport;
+	*buf++ = (UINT8)(soc->remport >> 8);
+	*buf++ = (UINT8)soc->remport;
+	*buf++ = (UINT8)(seq >>24);
+	*buf++ = (UINT8)(seq >>16);
+	*buf++ = (UINT8)(seq >>8);
+	*buf++ = (UINT8)(seq);
+	*buf++ = (UINT8)(soc->receive_next >>24);
+	*buf++ = (UINT8)(soc->receive_next >>16);
+	*buf++ = (UINT8)(soc->receive_next >>8);
+	*buf++ = (UINT8)(soc->receive_next);
+	*buf =	(MIN_TCP_HLEN + olen) >> 2;
+	*buf <<= 4;
+	buf++;
+	*buf++ = soc->myflags;
+	*buf++ = (UINT8)(wnd >> 8);
+	*buf++ = (UINT8)wnd;
+	*buf++ = 0;								/* Checksum	*/
+	*buf++ = 0;
+	*buf++ = 0;								/* Urgent	*/
+	*buf++ = 0;
+	
+	 
+	/* Calculate checksum	*/
+	
+	cs = 0;
+	cs_cnt = 0;
+	
+	/* Do it firstly to IP pseudo header	*/
+	
+	cs = ip_checksum(cs, (UINT8)(localmachine.localip >> 24), cs_cnt++);	
+	cs = ip_checksum(cs, (UINT8)(localmachine.localip >> 16), cs_cnt++);
+	cs = ip_checksum(cs, (UINT8)(localmachine.localip >> 8), cs_cnt++);
+	cs = ip_checksum(cs, (UINT8)localmachine.localip, cs_cnt++);
+	
+	cs = ip_checksum(cs, (UINT8)(soc->rem_ip >> 24), cs_cnt++);	
+	cs = ip_checksum(cs, (UINT8)(soc->rem_ip >> 16), cs_cnt++);
+	cs = ip_checksum(cs, (UINT8)(soc->rem_ip >> 8), cs_cnt++);
+	cs = ip_checksum(cs, (UINT8)soc->rem_ip, cs_cnt++);	
+	
+	cs = ip_checksum(cs, 0, cs_cnt++);
+	
+	cs = ip_checksum(cs, (UINT8)IP_TCP, cs_cnt++);
+		
+	cs = ip_checksum(cs, (UINT8)((dlen + MIN_TCP_HLEN + olen) >> 8), cs_cnt++);
+	cs = ip_checksum(cs, (UINT8)(dlen + MIN_TCP_HLEN + olen), cs_cnt++);
+	
+	/* Go to TCP header + data. Header length is a multiple of four	*/
+	/* so data starts at even offset, but a piece of odd length makes	*/
+	/* the next one start at odd offset where its bytes are added with	*/
+	/* swapped significance												*/
+	
+	cs = ip_checksum_buf(cs, hdr, MIN_TCP_HLEN + olen);
+	
+	cs_cnt = 0;
+	
+	for(i=0; i < cnt; i++) {
+		if(cs_cnt & 0x01) {
+			cs = (cs << 8) | (cs >> 8);
+			cs = ip_checksum_buf(cs, iov[i].data, iov[i].len);
+			cs = (cs << 8) | (cs >> 8);
+		} else
+			cs = ip_checksum_buf(cs, iov[i].data, iov[i].len);
+		
+		cs_cnt += (UINT8)iov[i].len;
+	}
+		
+	cs = ~ cs;
+
+#if 0
+	/* Is the padding required?	*/
+	
+	if(dlen & 0x01) {
+		TCP_DEBUGOUT("Padding required\r\n");
+		*buf = 0;
+		dlen++;
+	}
+#endif
+	
+	/* Save checksum in correct place	*/
+	
+	buf = hdr + 16;
+	*buf++ = (UINT8)(cs >> 8);
+	*buf = (UINT8)cs;
+	
+	/* Send it to IP	*/
+	
+	TCP_DEBUGOUT("Sending TCP...\r\n");
+	
+	process_ip_outv(soc->rem_ip, IP_TCP, soc->tos, 100, hdr, MIN_TCP_HLEN + olen, iov, cnt);
+	
+	TCP_DEBUGOUT("TCP packet sent\r\n");
+	
+	return(0);
+	
+
+}
+
+
+
+/** \brief Send a TCP control packet (no data)
+ * 	\author 
+ *		\li Jari Lahti (jari.lahti@violasystems.com)
+ *	\date 17.07.2002
+ *	\param sockethandle handle to socket
+ *
+ *	This function is used to initiate sending of a control (no data) TCP 
+ *	packet. Important thing in these packets are the flags and sequence
+ *	numbers they carry.
+ *
+ */
+void tcp_sendcontrol (INT8 sockethandle)
+{
+	UINT8 i;
+
+	
+	TCP_DEBUGOUT("Entering to send TCP control packet\r\n");
+	
+	kick_WD();
+	
+	if( sockethandle < 0 ) {
+		TCP_DEBUGOUT("ERROR:Socket Handle not valid (<0)\r\n");
+		return;
+	}
+	
+	if( sockethandle > NO_OF_TCPSOCKETS ) {
+		TCP_DEBUGOUT("ERROR:Socket Handle not valid (>NO_OF_TCPSOCKETS)\r\n");
+		return;
+	}
+	
+	process_tcp_out(sockethandle, &tcp_tempbuf[0], MIN_TCP_HLEN + MAX_TCP_OPTLEN + 1, 0);
+	
+	return;
+	
+	
+}
+
+/** \brief Send a reset (RST) packet to remote host
+ * 	\author 
+ *		\li Jari Lahti (jari.lahti@violasystems.com)
+ *		\li Vladan Jovanovic (vladan.jovanovic@violasystems.com)
+ *	\date 20.08.2002
+ *	\param frame pointer to received TCP packet
+ *	\param remip remote IP address of packet
+ *
+ *	Uses socket #NO_OF_TCPSOCKETS to send a RESET packet to peer. 
+ *	This function is used when we are establishing connection but
+ *	we receive something else than SYN or SYN+ACK when it's
+ *	possible that the peer has still old connection on which
+ *	needs to be resetted without canceling the connection establishment
+ *	on process.
+ */
+void tcp_sendreset (struct tcp_frame *frame, UINT32 remip)
+{
+	struct tcb* soc;
+
+	soc = &tcp_socket[NO_OF_TCPSOCKETS];				/* Get socket	*/
+
+
+	/* Is this itself a reset packet?	*/
+	
+	if( frame->hlen_flags & TCP_FLAG_RESET )
+		return;
+
+	/* Set temporary tcb variables	*/
+	
+	soc->rem_ip = remip;
+	soc->remport = frame->sport;
+	soc->locport = frame->dport;
+	soc->tos = 0;
+	
+	/* Does the packet have ACK flag set?	*/
+	
+	if( frame->hlen_flags & TCP_FLAG_ACK ) {
+		/* Jup, use it as our seq	*/
+		
+		soc->send_unacked = frame->ackno;
+		soc->myflags = TCP_FLAG_RESET;	
+		soc->receive_next = frame->seqno;
+	} else {
+		soc->send_unacked = 0;
+		soc->myflags = TCP_FLAG_RESET | TCP_FLAG_ACK;	
+		soc->receive_next = frame->seqno+1;
+	}
+	
+	soc->send_next = soc->send_unacked;
+		
+	
+	soc->send_mtu = TCP_DEF_MTU;
+	
+	tcp_sendcontrol(NO_OF_TCPSOCKETS);
+
+}
+
+
+/** \brief Get and return initial sequence number
+ * 	\author 
+ *		\li Jari Lahti (jari.lahti@violasystems.com)
+ *	\date 17.07.2002
+ *	\return UINT32 number containing initial sequence number to be used
+ *
+ *	This function returns initial sequence number to be used in a TCP 
+ *	connection. For now, initial sequence number is selected based on
+ *	base_timer value, which should be solid enough choice.
+ *
+ */
+UINT32 tcp_initseq (void)
+{
+
+	TCP_DEBUGOUT("Calculating initial sequence number\r\n");
+	
+	return( ( (UINT32)base_timer << 24) | 0x00FFFFFF );
+
+}
+
+/** \brief Try to match received TCP packet to a socket
+ * 	\author 
+ *		\li Jari Lahti (jari.lahti@violasystems.com)
+ *	\date 12.07.2002
+ *	\param ipframe pointer to received IP frame
+ *	\param tcpframe pointer to received TCP frame to be mapped
+ *	\return
+ *		\li -1 - Error (no resources or no socket found)
+ *		\li -2 - Connection request to listening socket whose backlog
+ *		is full or that was answered with SYN cookie, or packet of a
+ *		connection in TIME_WAIT
+ *		\li >=0 - Handle to mapped socket
+ *
+ *	Function looks up the connection this TCP packet is intended for.
+ *	Connection request (SYN) that doesn't belong to any connection is
+ *	given to a socket listening on the destination port, as is an ACK
+ *	that brings back a valid SYN cookie.
+ *
+ */
+INT8 tcp_mapsocket (struct ip_frame* ipframe, struct tcp_frame* tcpframe)
+{
+	struct tcb* soc;
+	INT8 i;
+
+	
+	/* Check if there is already connection on	*/
+	
+	i = tcp_conn_hash[tcp_hash(ipframe->sip, tcpframe->sport, tcpframe->dport)];
+	
+	for( ; i >= 0; i = soc->hash_next) {
+		soc = &tcp_socket[i];					/* Get socket	*/
+		
+		if(soc->remport != tcpframe->sport)
+			continue;						
+		if(soc->locport != tcpframe->dport)
+			continue;						
+		if(soc->rem_ip != ipframe->sip)	
+			continue;						
+		
+		/* There is connection on already	*/
+		
+		TCP_DEBUGOUT("Active connection socket found\r\n");
+		
+		return(i);
+	}
+	
+	/* Connection may have been closed recently	*/
+	
+	if( tcp_tw_input(ipframe, tcpframe) )
+		return(-2);
+	
+	/* Allocate listening one if SYN packet (Connection Request) or	*/
+	/* ACK completing handshake that was answered with SYN cookie		*/
+	
+	TCP_DEBUGOUT("No active connection, checking if SYN packet\r\n");
+	
+	/* Is it SYN or ACK?	*/
+	
+	if( (tcpframe->hlen_flags & (TCP_FLAG_SYN | TCP_FLAG_ACK)) == 0 )
+		return(-1);
+	if( (tcpframe->hlen_flags & (TCP_FLAG_SYN | TCP_FLAG_ACK)) == (TCP_FLAG_SYN | TCP_FLAG_ACK) )
+		return(-1);
+	if( tcpframe->hlen_flags & TCP_FLAG_RESET )
+		return(-1);
+	if( tcpframe->hlen_flags & TCP_FLAG_FIN )
+		return(-1);
+	
+	TCP_DEBUGOUT("Trying to allocate listening one for SYN packet\r\n");
+	
+	/* Search listening sockets	*/
+	
+	i = tcp_listen_hash[tcpframe->dport & (TCP_LISTEN_HASH_SIZE - 1)];
+	
+	for( ; i >= 0; i = soc->hash_next) {
+		soc = &tcp_socket[i];				/* Get socket	*/
+		
+		if(soc->locport != tcpframe->dport)
+			continue;
+		
+		if( (tcpframe->hlen_flags & TCP_FLAG_ACK) == 0 ) {
+			/* Don't allocate socket for connection request if too many	*/
+			/* are held by half-open connections or backlog is full		*/
 			
-		case TCP_STATE_CLOSING:
+			if( (TCP_SYNCOOKIE_HALFOPEN <= NO_OF_TCPSOCKETS) &&
+				((tcp_syncounters.halfopen >= TCP_SYNCOOKIE_HALFOPEN) ||
+				 (soc->backlog && (soc->npending >= soc->backlog))) ) {
+				tcp_sendcookie(soc, ipframe, tcpframe);
+				return(-2);
+			}
+		} else {
+			/* No cookies sent, just a stray ACK	*/
+			
+			if(tcp_cookie_secret == 0)
+				return(-1);
+			
+			if( tcp_cookie_check(ipframe, tcpframe) == 0 ) {
+				TCP_DEBUGOUT("Invalid SYN cookie\r\n");
+				tcp_syncounters.cookies_invalid++;
+				return(-1);
+			}
+		}
 		
-			TCP_DEBUGOUT("CLOSING State...\r\n");
+		/* Listening socket with a backlog stays listening, connection	*/
+		/* gets a socket of its own									*/
+		
+		if(soc->backlog) {
+			i = tcp_spawn(i);
 			
-			/* Check for RESET	*/
+			if(i < 0)
+				return(-2);
 			
-			if(received_tcp_packet.hlen_flags & TCP_FLAG_RESET)	{
-				TCP_DEBUGOUT("ERROR:Reset received\r\n");
+			soc = &tcp_socket[i];
+		}
+		
+		/* Bind it	*/
+		
+		soc->rem_ip = ipframe->sip;
+		soc->remport = tcpframe->sport;
+		
+		TCP_DEBUGOUT("Allocated new socket\r\n");
+		
+		return(i);
+		
+	}
+	
+	/* No success	*/
+	
+	TCP_DEBUGOUT("ERROR:No socket found or allocated for TCP packet\r\n");
+	
+	return(-1);
+
+}
+
+
+/** \brief Calculate connection lookup table bucket
+ *	\date 19.10.2026
+ *	\param ip remote IP address
+ *	\param rport remote TCP port
+ *	\param lport local TCP port
+ *	\return Index to #tcp_conn_hash
+ *
+ *	Folds the connection identifiers to the size of the lookup table.
+ *	Remote port is mixed in with a rotation so that many connections
+ *	from the same host to the same local port spread over the buckets.
+ */
+UINT8 tcp_hash (UINT32 ip, UINT16 rport, UINT16 lport)
+{
+	UINT16 h;
+	
+	h = (UINT16)(ip >> 16) ^ (UINT16)ip ^ lport;
+	h ^= (rport << 3) | (rport >> 13);
+	h ^= h >> 8;
+	h ^= h >> 4;
+	
+	return( (UINT8)(h & (TCP_HASH_SIZE - 1)) );
+
+}
+
+
+/** \brief Link TCP socket to lookup table matching it's state
+ *	\date 19.10.2026
+ *	\param soc pointer to socket structure we're working with
+ *
+ *	Removes the socket from the lookup table bucket it is currently
+ *	linked to and, depending on the socket state, links it to
+ *	#tcp_listen_hash (LISTENING), #tcp_conn_hash (connection in
+ *	progress or established) or nowhere. Invoked whenever state or
+ *	connection identifiers of the socket change.
+ */
+void tcp_rehash (struct tcb* soc)
+{
+	INT8 sochandle;
+	INT8* prev;
+	
+	sochandle = (INT8)(soc - tcp_socket);
+	
+	/* Temporary socket used for resets is never linked	*/
+	
+	if( sochandle >= NO_OF_TCPSOCKETS )
+		return;
+	
+	/* Unlink from current bucket	*/
+	
+	prev = soc->hash_bucket;
+	
+	if( prev != 0 ) {
+		while( *prev != sochandle )
+			prev = &tcp_socket[*prev].hash_next;
+		
+		*prev = soc->hash_next;
+	}
+	
+	soc->hash_next = -1;
+	soc->hash_bucket = 0;
+	
+	/* Link to the new one	*/
+	
+	if( soc->state == TCP_STATE_LISTENING )
+		prev = &tcp_listen_hash[soc->locport & (TCP_LISTEN_HASH_SIZE - 1)];
+	else if( soc->state > TCP_STATE_LISTENING )
+		prev = &tcp_conn_hash[tcp_hash(soc->rem_ip, soc->remport, soc->locport)];
+	else
+		return;
+	
+	soc->hash_next = *prev;
+	soc->hash_bucket = prev;
+	*prev = sochandle;
+
+}
+
+
+/** \brief Allocate socket for connection request to listening socket
+ *	\date 19.10.2026
+ *	\param sochandle handle of listening socket with a backlog
+ *	\return
+ *		\li -1 - Backlog full or no free sockets
+ *		\li >=0 - Handle of the new socket
+ *
+ *	New socket gets the event listener, type and options of the
+ *	listening socket but it closes instead of returning to listening
+ *	state. It is put to listening state without linking it to lookup
+ *	table so that process_tcp_in() handles the SYN as usual.
+ */
+INT8 tcp_spawn (INT8 sochandle)
+{
+	struct tcb* lsoc;
+	struct tcb* soc;
+	INT8 i;
+	
+	lsoc = &tcp_socket[sochandle];
+	
+	if(lsoc->npending >= lsoc->backlog) {
+		TCP_DEBUGOUT("Listening socket backlog full\r\n");
+		return(-1);
+	}
+	
+	i = tcp_getsocket((UINT8)(lsoc->type & ~TCP_TYPE_SERVER), lsoc->tos, 0, lsoc->event_listener);
+	
+	if(i < 0)
+		return(-1);
+	
+	soc = &tcp_socket[i];
+	
+	soc->tout = lsoc->tout;
+	soc->cc = lsoc->cc;
+	soc->send_budget = lsoc->send_budget;
+	soc->rcv_wnd = lsoc->rcv_wnd;
+	
+	if(lsoc->sndbuf >= 0) {
+		soc->sndbuf = tcp_sndbuf_get();
+		soc->sndbuf_start = 0;
+		
+		if(soc->sndbuf >= 0)
+			soc->coalesce = lsoc->coalesce & (TCP_COALESCE_NAGLE | TCP_COALESCE_CORK);
+	}
+	
+	/* Application reads with tcp_recv() so it can't do without	*/
+	/* receive buffer												*/
+	
+	if(lsoc->rcvbuf >= 0) {
+		soc->rcvbuf = tcp_rcvbuf_get();
+		
+		if(soc->rcvbuf < 0) {
+			TCP_DEBUGOUT("No free TCP receive buffers\r\n");
+			tcp_releasesocket(i);
+			return(-1);
+		}
+	}
+	
+	soc->state = TCP_STATE_LISTENING;
+	tcp_setlocport(soc, lsoc->locport);
+	soc->send_unacked = 0;
+	soc->myflags = 0;
+	soc->send_next = 0xFFFFFFFF;
+	soc->send_mtu = TCP_DEF_MTU;
+	soc->receive_next = 0;
+	soc->retries_left = 0;
+	soc->parent = sochandle;
+	soc->qnext = -1;
+	
+	lsoc->npending++;
+	
+	return(i);
+
+}
+
+
+/** \brief Detach connection from listening socket
+ *	\date 19.10.2026
+ *	\param soc pointer to socket structure we're working with
+ *
+ *	Removes the connection from accept queue of the listening socket it
+ *	was created by and frees its place in the backlog. Does nothing if
+ *	the connection was already accepted.
+ */
+void tcp_unqueue (struct tcb* soc)
+{
+	struct tcb* lsoc;
+	INT8* prev;
+	
+	if(soc->parent < 0)
+		return;
+	
+	lsoc = &tcp_socket[soc->parent];
+	
+	for(prev = &lsoc->acceptq; *prev >= 0; prev = &tcp_socket[*prev].qnext) {
+		if(&tcp_socket[*prev] == soc) {
+			*prev = soc->qnext;
+			break;
+		}
+	}
+	
+	lsoc->npending--;
+	soc->parent = -1;
+	soc->qnext = -1;
+
+}
+
+
+/** \brief Calculate SYN cookie hash
+ *	\date 19.10.2026
+ *	\param ip remote IP address
+ *	\param rport remote TCP port
+ *	\param lport local TCP port
+ *	\param rseq initial sequence number of remote host
+ *	\param tm time and MSS index encoded in the upper byte of cookie
+ *	\return 24-bit hash stored in the lower bits of cookie
+ */
+UINT32 tcp_cookie (UINT32 ip, UINT16 rport, UINT16 lport, UINT32 rseq, UINT8 tm)
+{
+	UINT32 h;
+	
+	h = mix32(tcp_cookie_secret ^ ip);
+	h = mix32(h ^ (((UINT32)rport << 16) | lport));
+	h = mix32(h ^ rseq);
+	h = mix32(h ^ tm);
+	
+	return(h & 0x00FFFFFF);
+
+}
+
+
+/** \brief Check SYN cookie returned by remote host
+ *	\date 19.10.2026
+ *	\param ipframe pointer to received IP frame
+ *	\param tcpframe pointer to received TCP frame carrying ACK
+ *	\return
+ *		\li 0 - Cookie invalid or expired
+ *		\li 1 - Cookie valid
+ *
+ *	Acknowledgment number minus one is the cookie sent by
+ *	tcp_sendcookie(). Its time field must be current or the previous
+ *	one, so cookies are valid for 65 to 131 seconds.
+ */
+UINT8 tcp_cookie_check (struct ip_frame* ipframe, struct tcp_frame* tcpframe)
+{
+	UINT32 cookie;
+	UINT8 age;
+	
+	if(tcp_cookie_secret == 0)
+		return(0);
+	
+	cookie = tcpframe->ackno - 1;
+	
+	age = ((UINT8)(clock_ms() >> 16) - (UINT8)(cookie >> 27)) & 0x1F;
+	
+	if(age > 1)
+		return(0);
+	
+	if( (cookie & 0x00FFFFFF) != tcp_cookie(ipframe->sip, tcpframe->sport, tcpframe->dport, 
+											tcpframe->seqno - 1, (UINT8)(cookie >> 24)) )
+		return(0);
+	
+	return(1);
+
+}
+
+
+/** \brief Answer connection request with SYN cookie
+ *	\date 19.10.2026
+ *	\param lsoc listening socket connection request is for
+ *	\param ipframe pointer to received IP frame
+ *	\param tcpframe pointer to received TCP frame carrying SYN
+ *
+ *	Sends SYN+ACK from the temporary socket without storing anything
+ *	about the connection. Initial sequence number is the cookie: five
+ *	bits of time in 65 second units, three bits of MSS index
+ *	(#tcp_cookie_mss) and 24 bits of hash over them, the connection
+ *	identifiers and remote host's sequence number.
+ */
+void tcp_sendcookie (struct tcb* lsoc, struct ip_frame* ipframe, struct tcp_frame* tcpframe)
+{
+	struct tcb* soc;
+	UINT16 mss;
+	UINT8 tm;
+	
+	soc = &tcp_socket[NO_OF_TCPSOCKETS];				/* Get socket	*/
+	
+	if(tcp_cookie_secret == 0)
+		tcp_cookie_secret = mix32(clock_us() ^ localmachine.localip) | 1;
+	
+	soc->rem_ip = ipframe->sip;
+	soc->remport = tcpframe->sport;
+	soc->locport = tcpframe->dport;
+	soc->tos = 0;
+	
+	/* Only MSS can be encoded, don't agree on other options	*/
+	
+	tcp_getoptions(soc, (UINT8)(((tcpframe->hlen_flags >> 12) << 2) - MIN_TCP_HLEN));
+	
+	mss = soc->send_mtu - MIN_TCP_HLEN;
+	
+	if(soc->flags & TCP_INTFLAGS_TSTAMP)
+		mss += TCP_DATA_OPTLEN;
+	
+	soc->flags = 0;
+	soc->send_mtu = TCP_DEF_MTU;
+	
+	for(tm = 7; (tm > 0) && (tcp_cookie_mss[tm] > mss); tm--)
+		;
+	
+	tm |= (UINT8)(clock_ms() >> 16) << 3;
+	
+	soc->send_unacked = ((UINT32)tm << 24) |
+						tcp_cookie(soc->rem_ip, soc->remport, soc->locport, tcpframe->seqno, tm);
+	soc->send_next = soc->send_unacked;
+	soc->receive_next = tcpframe->seqno + 1;
+	soc->rcv_wnd = lsoc->rcv_wnd;
+	soc->myflags = TCP_FLAG_SYN | TCP_FLAG_ACK;
+	
+	tcp_sendcontrol(NO_OF_TCPSOCKETS);
+	
+	soc->rcv_wnd = 0;
+	
+	tcp_syncounters.cookies_sent++;
+
+}
+
+
+/** \brief Move connection entering TIME_WAIT to a compact record
+ *	\date 19.10.2026
+ *	\param soc pointer to socket structure we're working with
+ *
+ *	Stores connection identifiers and sequence numbers in a TIME_WAIT
+ *	record and returns the socket to LISTENING or CLOSED state so that
+ *	it can be used again right away. Without records
+ *	(#TCP_NO_OF_TWRECS is zero) the socket itself waits in TIMED_WAIT
+ *	state.
+ */
+void tcp_timewait (struct tcb* soc)
+{
+#if TCP_NO_OF_TWRECS > 0
+	struct tcp_twrec* tw;
+	INT8* prev;
+	INT8 i;
+	
+	i = tcp_tw_get();
+	tw = &tcp_tw_pool[i];
+	
+	tw->rem_ip = soc->rem_ip;
+	tw->remport = soc->remport;
+	tw->locport = soc->locport;
+	tw->send_next = soc->send_next;
+	tw->receive_next = soc->receive_next;
+	
+	prev = &tcp_tw_hash[tcp_hash(tw->rem_ip, tw->remport, tw->locport)];
+	tw->hash_next = *prev;
+	*prev = i;
+	
+	/* Slot behind the current one is reached last	*/
+	
+	tw->slot = (tcp_tw_now + TCP_TW_SLOTS - 1) % TCP_TW_SLOTS;
+	tw->wheel_next = tcp_tw_wheel[tw->slot];
+	tcp_tw_wheel[tw->slot] = i;
+	
+	TCP_DEBUGOUT("Connection moved to TIME_WAIT record\r\n");
+	
+	if(soc->type & TCP_TYPE_SERVER)
+		tcp_newstate(soc, TCP_STATE_LISTENING);
+	else
+		tcp_newstate(soc, TCP_STATE_CLOSED);
+#else
+	tcp_newstate(soc, TCP_STATE_TIMED_WAIT);
+#endif
+
+}
+
+
+/** \brief Obtain a TIME_WAIT record
+ *	\date 19.10.2026
+ *	\return
+ *		\li -1 - TIME_WAIT records are disabled
+ *		\li >=0 - index to #tcp_tw_pool
+ *
+ *	If all records are in use the one closest to expiry is released
+ *	and returned.
+ */
+INT8 tcp_tw_get (void)
+{
+#if TCP_NO_OF_TWRECS > 0
+	INT8 i;
+	UINT8 s;
+	
+	if(tcp_tw_freelist < 0) {
+		TCP_DEBUGOUT("TIME_WAIT records full, reusing oldest\r\n");
+		
+		s = tcp_tw_now;
+		
+		do {
+			s = (s + 1) % TCP_TW_SLOTS;
+		} while(tcp_tw_wheel[s] < 0);
+		
+		tcp_tw_free(tcp_tw_wheel[s]);
+	}
+	
+	i = tcp_tw_freelist;
+	tcp_tw_freelist = tcp_tw_pool[i].wheel_next;
+	
+	return(i);
+#else
+	return(-1);
+#endif
+
+}
+
+
+/** \brief Release TIME_WAIT record
+ *	\date 19.10.2026
+ *	\param nbr index of record being released
+ *
+ *	Record is removed from the lookup table and timer wheel and put to
+ *	the free list.
+ */
+void tcp_tw_free (INT8 nbr)
+{
+#if TCP_NO_OF_TWRECS > 0
+	struct tcp_twrec* tw;
+	INT8* prev;
+	
+	tw = &tcp_tw_pool[nbr];
+	
+	prev = &tcp_tw_hash[tcp_hash(tw->rem_ip, tw->remport, tw->locport)];
+	
+	while(*prev != nbr)
+		prev = &tcp_tw_pool[*prev].hash_next;
+	
+	*prev = tw->hash_next;
+	
+	prev = &tcp_tw_wheel[tw->slot];
+	
+	while(*prev != nbr)
+		prev = &tcp_tw_pool[*prev].wheel_next;
+	
+	*prev = tw->wheel_next;
+	
+	tw->wheel_next = tcp_tw_freelist;
+	tcp_tw_freelist = nbr;
+#endif
+
+}
+
+
+/** \brief Process TCP packet of a connection in TIME_WAIT
+ *	\date 19.10.2026
+ *	\param ipframe pointer to received IP frame
+ *	\param tcpframe pointer to received TCP frame
+ *	\return
+ *		\li 0 - No connection in TIME_WAIT, or new connection request
+ *		may reuse the identifiers of one
+ *		\li 1 - Packet belongs to connection in TIME_WAIT and was
+ *		processed
+ *
+ *	Retransmitted FIN is acknowledged from the temporary socket, reset
+ *	ends the waiting. Other packets are ignored.
+ */
+UINT8 tcp_tw_input (struct ip_frame* ipframe, struct tcp_frame* tcpframe)
+{
+#if TCP_NO_OF_TWRECS > 0
+	struct tcp_twrec* tw;
+	struct tcb* soc;
+	INT8 i;
+	
+	i = tcp_tw_hash[tcp_hash(ipframe->sip, tcpframe->sport, tcpframe->dport)];
+	
+	for( ; i >= 0; i = tw->hash_next) {
+		tw = &tcp_tw_pool[i];
+		
+		if(tw->remport != tcpframe->sport)
+			continue;
+		if(tw->locport != tcpframe->dport)
+			continue;
+		if(tw->rem_ip != ipframe->sip)
+			continue;
+		
+		break;
+	}
+	
+	if(i < 0)
+		return(0);
+	
+	TCP_DEBUGOUT("Packet for connection in TIME_WAIT\r\n");
+	
+	if(tcpframe->hlen_flags & TCP_FLAG_RESET) {
+		tcp_tw_free(i);
+		return(1);
+	}
+	
+	/* Connection request beyond the old sequence numbers opens a new	*/
+	/* connection (RFC 1122, 4.2.2.13)									*/
+	
+	if( (tcpframe->hlen_flags & (TCP_FLAG_SYN | TCP_FLAG_ACK)) == TCP_FLAG_SYN ) {
+		if( (INT32)(tcpframe->seqno - tw->receive_next) <= 0 )
+			return(1);
+		
+		tcp_tw_free(i);
+		return(0);
+	}
+	
+	if( (tcpframe->hlen_flags & TCP_FLAG_FIN) == 0 )
+		return(1);
+	
+	TCP_DEBUGOUT("Repeated FIN, repeat ACK\r\n");
+	
+	soc = &tcp_socket[NO_OF_TCPSOCKETS];				/* Get socket	*/
+	
+	soc->rem_ip = tw->rem_ip;
+	soc->remport = tw->remport;
+	soc->locport = tw->locport;
+	soc->tos = 0;
+	soc->send_unacked = tw->send_next;
+	soc->send_next = tw->send_next;
+	soc->receive_next = tw->receive_next;
+	soc->send_mtu = TCP_DEF_MTU;
+	soc->myflags = TCP_FLAG_ACK;
+	
+	tcp_sendcontrol(NO_OF_TCPSOCKETS);
+	
+	return(1);
+#else
+	return(0);
+#endif
 
-				/* Inform application	*/
+}
 
-				soc->event_listener(sochandle, TCP_EVENT_ABORT, soc->rem_ip, soc->remport);				
-				
-				if(soc->type & TCP_TYPE_SERVER)
-					tcp_newstate(soc, TCP_STATE_LISTENING);
-				else
-					tcp_newstate(soc, TCP_STATE_CLOSED);
-					
-				return(-1);
-			}			
-			
-			/* Is it ACK?			*/
-			
-			if( received_tcp_packet.hlen_flags & TCP_FLAG_ACK	) {
-				/* Rigth ACK?	*/
-				
-				if( received_tcp_packet.ackno != soc->send_next ) {
-					TCP_DEBUGOUT("ACK received but wrong Ack\n\r");
-					return(-1);
-				}
-				
-				TCP_DEBUGOUT("Our FIN is ACKed and peer wants to close too\r\n");
-				TCP_DEBUGOUT("Next TIMED_WAIT\r\n");
 
-				/* We have no unacked data	*/
-				
-				soc->send_unacked = soc->send_next;
-				
-				tcp_newstate(soc, TCP_STATE_TIMED_WAIT);
-				
-				return(0);
-							
-			}
+/** \brief Release TIME_WAIT records that have expired
+ *	\date 19.10.2026
+ *
+ *	Invoked from tcp_poll(). Turns the timer wheel once a second and
+ *	releases the records in the slot reached.
+ */
+void tcp_tw_age (void)
+{
+#if TCP_NO_OF_TWRECS > 0
+	if( check_timer(tcp_tw_timerh) != 0 )
+		return;
 	
-			/* Is it repeated FIN?	*/
+	init_timer(tcp_tw_timerh, TIMERTIC);
+	
+	tcp_tw_now = (tcp_tw_now + 1) % TCP_TW_SLOTS;
+	
+	while(tcp_tw_wheel[tcp_tw_now] >= 0)
+		tcp_tw_free(tcp_tw_wheel[tcp_tw_now]);
+#endif
+
+}
+
+
+/** \brief Change TCP socket state and reinitialize timers
+ * 	\author 
+ *		\li Jari Lahti (jari.lahti@violasystems.com)
+ *	\date 18.07.2002
+ *	\param soc pointer to socket structure we're working with
+ *	\param nstate new socket state
+ *
+ *	This function is used for every state-change that occurs in the TCP
+ *	sockets so as to provide correct timers/retransmittions that ensure
+ *	TCP connection is lasting.
+ */
+void tcp_newstate (struct tcb* soc, UINT8 nstate)
+{
+	INT8* prev;
+	
+	if(soc->state == TCP_STATE_SYN_RECEIVED)
+		tcp_syncounters.halfopen--;
+	
+	if(nstate == TCP_STATE_SYN_RECEIVED)
+		tcp_syncounters.halfopen++;
+	
+	soc->state = nstate;
+	soc->retries_left = TCP_DEF_RETRIES;
+	
+	tcp_rehash(soc);
+	tcp_wakeup((INT8)(soc - tcp_socket));
+	
+	/* Send and reassembly buffers and delayed ACK belong to established	*/
+	/* connection only														*/
+	
+	if(nstate != TCP_STATE_CONNECTED) {
+		soc->sndbuf_len = 0;
+		soc->file = -1;
+		soc->file_rest = 0;
+		soc->flags &= ~TCP_INTFLAGS_DELACK;
+		soc->coalesce &= ~(TCP_COALESCE_FLUSH | TCP_COALESCE_HELD);
+		tcp_reasm_clear(soc);
+	}
+	
+	/* Unread data of previous connection is dropped when a new one	*/
+	/* is being established											*/
+	
+	if( (soc->rcvbuf >= 0) &&
+		((nstate == TCP_STATE_SYN_SENT) || (nstate == TCP_STATE_SYN_RECEIVED)) ) {
+		soc->rcvbuf_start = 0;
+		soc->rcvbuf_len = 0;
+		soc->rcv_wnd = TCP_RCVBUF_SIZE;
+	}
+
+	/* In some states we don't want to wait for many retries (e.g. TIMED_WAIT)	*/
+	
+	switch(soc->state) {
+		case TCP_STATE_TIMED_WAIT:
+			soc->retries_left = 0;
+			break;
+		
+		case TCP_STATE_SYN_SENT:	
+			soc->retries_left = TCP_CON_ATTEMPTS;
+			break;
+		
+		case TCP_STATE_CONNECTED:
+			/* Nothing sent yet after SYN	*/
+			soc->send_max = soc->send_next;
+			soc->rexmit_high = soc->send_next;
+			soc->nsacked = 0;
+			tcp_cc_init(soc);
 			
-			if( received_tcp_packet.hlen_flags & TCP_FLAG_FIN	) {
-				
-				TCP_DEBUGOUT("Repeated FIN, repeat ACK\n\r");
-				
-				/* ACK FIN and all data	*/
+			/* Queue connection to be accepted	*/
+			
+			if(soc->parent >= 0) {
+				prev = &tcp_socket[soc->parent].acceptq;
 				
-				soc->receive_next = received_tcp_packet.seqno;
-				soc->receive_next++;
-				soc->receive_next += dlen;
+				while(*prev >= 0)
+					prev = &tcp_socket[*prev].qnext;
 				
-				soc->myflags = TCP_FLAG_ACK;
-				tcp_sendcontrol(sochandle);			
-			
-				return(0);
-			
+				*prev = (INT8)(soc - tcp_socket);
+				soc->qnext = -1;
 			}
+			
+			break;
 
-		
+		case TCP_STATE_LAST_ACK:
+		case TCP_STATE_FINW1:
+		case TCP_STATE_FINW2:
+		case TCP_STATE_CLOSING:
+			soc->retries_left = 1;
 			break;
 		
-		case TCP_STATE_LAST_ACK:
+		default:
+			break;
+	
+	}
+	
+	
+	/* KeepAlive timer	*/
+	if(soc->state == TCP_STATE_CONNECTED)
+		init_timer(soc->persist_timerh, soc->tout);
+	
+	/* Retransmit timer. Waiting in closing states doesn't depend	*/
+	/* on round-trip time											*/
+	
+	if( (soc->state == TCP_STATE_TIMED_WAIT) ||
+		(soc->state == TCP_STATE_FINW2)			)
+		init_timer(soc->retransmit_timerh, TCP_DEF_RETRY_TOUT*TIMERTIC);
+	else
+		init_timer(soc->retransmit_timerh, soc->rto);
+	
+	return;
+
+
+}
+
+/** \brief Return amount of data that can be sent on a socket
+ *	\date 19.10.2026
+ *	\param soc pointer to socket structure we're working with
+ *	\return Number of bytes that still fit in the send window
+ *
+ *	Send window is the smallest of the window advertised by the remote
+ *	host, the socket's own limit for unacknowledged data and the
+ *	congestion window. If remote host
+ *	has closed its window and nothing is in flight one byte is allowed so
+ *	that window is probed and the opening of the window isn't missed
+ *	if the window update from remote host gets lost.
+ */
+UINT16 tcp_sendroom (struct tcb* soc)
+{
+	UINT32 wnd;
+	UINT32 inflight;
+	
+	wnd = soc->send_window;
+	
+	if(wnd > soc->send_budget)
+		wnd = soc->send_budget;
+	
+	if(wnd > soc->cwnd)
+		wnd = soc->cwnd;
+	
+	inflight = soc->send_next - soc->send_unacked;
+	
+	if( (wnd == 0) && (inflight == 0) )
+		return(1);
+	
+	if(inflight >= wnd)
+		return(0);
+	
+	return((UINT16)(wnd - inflight));
+
+}
+
+/** \brief Calculate window to be advertised to remote host
+ *	\date 19.10.2026
+ *	\param soc pointer to socket structure we're working with
+ *	\return Value for the window field of TCP header
+ *
+ *	Window is the amount of data application said it can receive
+ *	(#TCP_OPT_RECV_WINDOW), but right edge of the window already
+ *	advertised is never moved back (RFC 793). Window in SYN packets is
+ *	never scaled, in other packets it is scaled if remote host agreed
+ *	to window scaling. Right edge of the advertised window is stored
+ *	for checking the received data.
+ */
+UINT16 tcp_recvwindow (struct tcb* soc)
+{
+	UINT32 wnd;
+	UINT8 shift;
+	
+	soc->flags &= ~TCP_INTFLAGS_WNDUPDATE;
+	
+	shift = 0;
+	
+	if(soc->myflags & TCP_FLAG_SYN)
+		soc->rcv_adv = soc->receive_next;
+	else if(soc->flags & TCP_INTFLAGS_WSCALE)
+		shift = soc->rcv_wscale;
+	
+	wnd = soc->rcv_wnd;
+	
+	if( (INT32)(soc->receive_next + wnd - soc->rcv_adv) < 0 )
+		wnd = soc->rcv_adv - soc->receive_next;
+	
+	wnd >>= shift;
+	
+	if(wnd > 0xFFFF)
+		wnd = 0xFFFF;
+	
+	if( (INT32)(soc->receive_next + (wnd << shift) - soc->rcv_adv) > 0 )
+		soc->rcv_adv = soc->receive_next + (wnd << shift);
+	
+	return((UINT16)wnd);
+
+}
+
+/** \brief Write TCP options to header of outgoing packet
+ *	\date 19.10.2026
+ *	\param soc pointer to socket structure we're working with
+ *	\param buf pointer to buffer just after the fixed TCP header
+ *	\param room maximum length of options
+ *	\return Length of options written (multiple of four)
+ *
+ *	Most options are needed only in SYN packets. Maximum segment size we
+ *	can receive is always sent. Window scale is offered in
+ *	our SYN and included in SYN+ACK only if remote host offered it
+ *	(RFC 7323). Scale is the smallest that makes the application's
+ *	receive window fit into 16 bits. Selective acknowledgments (RFC 2018)
+ *	and timestamps are permitted the same way. Once timestamps are in
+ *	use they are sent in every packet, padded to #TCP_DATA_OPTLEN bytes.
+ *	Ranges of out-of-order data are reported in SACK option as far as
+ *	there is room for them.
+ */
+UINT8 tcp_putoptions (struct tcb* soc, UINT8* buf, UINT8 room)
+{
+	UINT8 olen;
+	UINT8 s;
+	UINT32 ts;
+	UINT32 seq;
+	UINT8 n;
+	UINT8 i;
+	
+	olen = 0;
+	
+	if( soc->myflags & TCP_FLAG_SYN ) {
+		buf[olen++] = TCP_OPTKIND_MSS;
+		buf[olen++] = TCP_OPTLEN_MSS;
+		buf[olen++] = (UINT8)((TCP_MAX_MTU - MIN_TCP_HLEN) >> 8);
+		buf[olen++] = (UINT8)(TCP_MAX_MTU - MIN_TCP_HLEN);
 		
-			TCP_DEBUGOUT("LAST_ACK State...\r\n");
+		if( ((soc->myflags & TCP_FLAG_ACK) == 0) ||
+			(soc->flags & TCP_INTFLAGS_WSCALE)		) {
 			
-			/* Check for RESET	*/
+			for(s = 0; (s < TCP_MAX_WSCALE) && ((soc->rcv_wnd >> s) > 0xFFFF); s++)
+				;
 			
-			if(received_tcp_packet.hlen_flags & TCP_FLAG_RESET) {
-				TCP_DEBUGOUT("ERROR:Reset received\r\n");
-				
-				/* Inform application	*/
-
-				soc->event_listener(sochandle, TCP_EVENT_ABORT, soc->rem_ip, soc->remport);				
-				
-				if(soc->type & TCP_TYPE_SERVER)
-					tcp_newstate(soc, TCP_STATE_LISTENING);
-				else
-					tcp_newstate(soc, TCP_STATE_CLOSED);
-					
-				return(-1);
-			}			
+			soc->rcv_wscale = s;
 			
-			/* Is it ACK?	*/
+			buf[olen++] = TCP_OPTKIND_NOP;
+			buf[olen++] = TCP_OPTKIND_WSCALE;
+			buf[olen++] = TCP_OPTLEN_WSCALE;
+			buf[olen++] = s;
+		}
+		
+		if( ((soc->myflags & TCP_FLAG_ACK) == 0) ||
+			(soc->flags & TCP_INTFLAGS_SACK)		) {
+			buf[olen++] = TCP_OPTKIND_NOP;
+			buf[olen++] = TCP_OPTKIND_NOP;
+			buf[olen++] = TCP_OPTKIND_SACKPERM;
+			buf[olen++] = TCP_OPTLEN_SACKPERM;
+		}
+	}
+	
+	/* Timestamp is offered in our SYN and sent in other packets	*/
+	/* if remote host agreed to use them. Echo field is zero in	*/
+	/* SYN since nothing has been received yet						*/
+	
+	if( ((soc->myflags & (TCP_FLAG_SYN | TCP_FLAG_ACK)) == TCP_FLAG_SYN) ||
+		(soc->flags & TCP_INTFLAGS_TSTAMP)								) {
+		ts = clock_ms();
+		
+		buf[olen++] = TCP_OPTKIND_NOP;
+		buf[olen++] = TCP_OPTKIND_NOP;
+		buf[olen++] = TCP_OPTKIND_TSTAMP;
+		buf[olen++] = TCP_OPTLEN_TSTAMP;
+		buf[olen++] = (UINT8)(ts >> 24);
+		buf[olen++] = (UINT8)(ts >> 16);
+		buf[olen++] = (UINT8)(ts >> 8);
+		buf[olen++] = (UINT8)ts;
+		
+		ts = 0;
+		
+		if(soc->myflags & TCP_FLAG_ACK)
+			ts = soc->ts_recent;
+		
+		buf[olen++] = (UINT8)(ts >> 24);
+		buf[olen++] = (UINT8)(ts >> 16);
+		buf[olen++] = (UINT8)(ts >> 8);
+		buf[olen++] = (UINT8)ts;
+	}
+	
+	/* Most recently received range first (RFC 2018)	*/
+	
+	if( (soc->flags & TCP_INTFLAGS_SACK) && soc->nreasm &&
+		((soc->myflags & TCP_FLAG_SYN) == 0) && (olen + 12 <= room) ) {
+		n = (room - olen - 4) >> 3;
+		
+		if(n > soc->nreasm)
+			n = soc->nreasm;
+		
+		buf[olen++] = TCP_OPTKIND_NOP;
+		buf[olen++] = TCP_OPTKIND_NOP;
+		buf[olen++] = TCP_OPTKIND_SACK;
+		buf[olen++] = 2 + (n << 3);
+		
+		for(i = 0; i < n; i++) {
+			seq = soc->reasm_blk[i].start;
+			buf[olen++] = (UINT8)(seq >> 24);
+			buf[olen++] = (UINT8)(seq >> 16);
+			buf[olen++] = (UINT8)(seq >> 8);
+			buf[olen++] = (UINT8)seq;
 			
-			if( received_tcp_packet.hlen_flags & TCP_FLAG_ACK	) {
-				/* Rigth ACK?	*/
-				
-				if( received_tcp_packet.ackno != soc->send_next ) {
-					TCP_DEBUGOUT("ACK received but wrong Ack\n\r");
-					return(-1);
-				}
-				
-				TCP_DEBUGOUT("Last ACK received, next LISTENING or CLOSED\r\n");
-				
-				/* We have no unacked data	*/
-				
-				soc->send_unacked = soc->send_next;				
-				
-				if(soc->type & TCP_TYPE_SERVER)
-					tcp_newstate(soc, TCP_STATE_LISTENING);
-				else
-					tcp_newstate(soc, TCP_STATE_CLOSED);
-												
-				return(0);
-							
-			}			
+			seq = soc->reasm_blk[i].end;
+			buf[olen++] = (UINT8)(seq >> 24);
+			buf[olen++] = (UINT8)(seq >> 16);
+			buf[olen++] = (UINT8)(seq >> 8);
+			buf[olen++] = (UINT8)seq;
+		}
+	}
+	
+	return(olen);
 
-			/* Is it repeated FIN?	*/
+}
+
+/** \brief Process options of received SYN packet
+ *	\date 19.10.2026
+ *	\param soc pointer to socket structure we're working with
+ *	\param olen length of options stored in received_tcp_packet
+ *
+ *	Invoked for received SYN and SYN+ACK packets. Segment size is set
+ *	to the smallest of remote host's MSS, Ethernet frame and network
+ *	transmit buffer, or to #TCP_DEF_MTU if remote host didn't send MSS.
+ *	MSS below #TCP_MIN_MSS is raised to it. Remote host's window
+ *	scale is taken into use if it sent the option, otherwise window
+ *	scaling is disabled in both directions. Same goes for selective
+ *	acknowledgments and timestamps. Space taken by timestamp option is
+ *	subtracted from the segment size (RFC 6691). Unknown options are
+ *	skipped and parsing stops at a malformed option.
+ */
+void tcp_getoptions (struct tcb* soc, UINT8 olen)
+{
+	UINT8* opt;
+	UINT8 i;
+	UINT8 len;
+	UINT16 mss;
+	
+	soc->flags &= ~(TCP_INTFLAGS_WSCALE | TCP_INTFLAGS_SACK | TCP_INTFLAGS_TSTAMP);
+	soc->snd_wscale = 0;
+	soc->send_mtu = TCP_DEF_MTU;
+	
+	opt = received_tcp_packet.opt;
+	i = 0;
+	
+	while(i < olen) {
+		if(opt[i] == TCP_OPTKIND_EOL)
+			break;
+		
+		if(opt[i] == TCP_OPTKIND_NOP) {
+			i++;
+			continue;
+		}
+		
+		/* Other options have length field	*/
+		
+		if(i + 1 >= olen)
+			break;
+		
+		len = opt[i + 1];
+		
+		if( (len < 2) || (i + len > olen) )
+			break;
+		
+		switch(opt[i]) {
+			case TCP_OPTKIND_MSS:
 			
-			if( received_tcp_packet.hlen_flags & TCP_FLAG_FIN	) {
+				if(len != TCP_OPTLEN_MSS)
+					break;
 				
-				TCP_DEBUGOUT("Repeated FIN, repeat ACK\n\r");
+				mss = ((UINT16)opt[i + 2]) << 8;
+				mss |= opt[i + 3];
 				
-				/* ACK FIN and all data	*/
+				if(mss < TCP_MIN_MSS)
+					mss = TCP_MIN_MSS;
 				
-				soc->receive_next = received_tcp_packet.seqno;
-				soc->receive_next++;
-				soc->receive_next += dlen;
-					
-				soc->myflags = TCP_FLAG_FIN | TCP_FLAG_ACK;
-				tcp_sendcontrol(sochandle);
-							
-				return(0);
-			
-			}			
-			
-		
-			break;
+				if(mss > TCP_MAX_MTU - MIN_TCP_HLEN)
+					mss = TCP_MAX_MTU - MIN_TCP_HLEN;
+				
+				if(mss > NETWORK_TX_BUFFER_SIZE - TCP_APP_OFFSET)
+					mss = NETWORK_TX_BUFFER_SIZE - TCP_APP_OFFSET;
+				
+				soc->send_mtu = mss + MIN_TCP_HLEN;
+				
+				break;
 			
-		case TCP_STATE_TIMED_WAIT:
-		
-			TCP_DEBUGOUT("TIMED_WAIT State...\r\n");
+			case TCP_OPTKIND_WSCALE:
+				
+				if(len != TCP_OPTLEN_WSCALE)
+					break;
+				
+				soc->snd_wscale = opt[i + 2];
+				
+				if(soc->snd_wscale > TCP_MAX_WSCALE)
+					soc->snd_wscale = TCP_MAX_WSCALE;
+				
+				soc->flags |= TCP_INTFLAGS_WSCALE;
+				
+				break;
 			
-			/* Check for RESET	*/
+			case TCP_OPTKIND_SACKPERM:
 			
-			if(received_tcp_packet.hlen_flags & TCP_FLAG_RESET) {
-				TCP_DEBUGOUT("ERROR:Reset received\r\n");
-
-				/* Inform application	*/
-
-				soc->event_listener(sochandle, TCP_EVENT_ABORT, soc->rem_ip, soc->remport);				
+				if(len == TCP_OPTLEN_SACKPERM)
+					soc->flags |= TCP_INTFLAGS_SACK;
 				
-				if(soc->type & TCP_TYPE_SERVER)
-					tcp_newstate(soc, TCP_STATE_LISTENING);
-				else
-					tcp_newstate(soc, TCP_STATE_CLOSED);
-					
-				return(-1);
-			}			
+				break;
 			
-			/* Is it repeated FIN?	*/
+			case TCP_OPTKIND_TSTAMP:
 			
-			if( received_tcp_packet.hlen_flags & TCP_FLAG_FIN	) {
-				
-				TCP_DEBUGOUT("Repeated FIN, repeat ACK\n\r");
+				if(len != TCP_OPTLEN_TSTAMP)
+					break;
 				
-				/* ACK FIN and all data	*/
+				soc->ts_recent = ((UINT32)opt[i + 2] << 24) | ((UINT32)opt[i + 3] << 16) |
+								 ((UINT32)opt[i + 4] << 8) | opt[i + 5];
+				soc->ts_recent_age = clock_ms();
+				soc->flags |= TCP_INTFLAGS_TSTAMP;
 				
-				soc->receive_next = received_tcp_packet.seqno;
-				soc->receive_next++;
-				soc->receive_next += dlen;
-					
-				soc->myflags = TCP_FLAG_ACK;
-				tcp_sendcontrol(sochandle);
-							
-				return(0);
+				break;
 			
-			}
+			default:
+				break;
+		}
 		
-			
+		i += len;
+	}
+	
+	/* MSS was raised to TCP_MIN_MSS so data still fits after options	*/
+	
+	if(soc->flags & TCP_INTFLAGS_TSTAMP)
+		soc->send_mtu -= TCP_DATA_OPTLEN;
+
+}
+
+/** \brief Find option from received packet
+ *	\date 19.10.2026
+ *	\param kind option kind to look for
+ *	\param olen length of options stored in received_tcp_packet
+ *	\return Pointer to the kind field of the option or 0 if packet
+ *		doesn't have the option. Length field is known to fit in options
+ *
+ *	Options are walked the same way as in tcp_getoptions() so that
+ *	parsing stops at a malformed option.
+ */
+UINT8* tcp_findoption (UINT8 kind, UINT8 olen)
+{
+	UINT8* opt;
+	UINT8 i;
+	UINT8 len;
+	
+	opt = received_tcp_packet.opt;
+	i = 0;
+	
+	while(i < olen) {
+		if(opt[i] == TCP_OPTKIND_EOL)
+			break;
 		
+		if(opt[i] == TCP_OPTKIND_NOP) {
+			i++;
+			continue;
+		}
+		
+		if(i + 1 >= olen)
+			break;
+		
+		len = opt[i + 1];
+		
+		if( (len < 2) || (i + len > olen) )
 			break;
+		
+		if(opt[i] == kind)
+			return(&opt[i]);
+		
+		i += len;
+	}
+	
+	return(0);
+
+}
+
+/** \brief Get timestamp option of received packet
+ *	\date 19.10.2026
+ *	\param olen length of options stored in received_tcp_packet
+ *	\param tsval pointer to variable where remote host's timestamp is
+ *		stored
+ *	\param tsecr pointer to variable where timestamp echoed by remote
+ *		host is stored
+ *	\return
+ *		\li 0 - Packet doesn't have a valid timestamp option
+ *		\li 1 - Timestamps stored
+ */
+UINT8 tcp_gettimestamp (UINT8 olen, UINT32* tsval, UINT32* tsecr)
+{
+	UINT8* opt;
 	
+	opt = tcp_findoption(TCP_OPTKIND_TSTAMP, olen);
 	
-		default:
+	if( (opt == 0) || (opt[1] != TCP_OPTLEN_TSTAMP) )
+		return(0);
+	
+	*tsval = ((UINT32)opt[2] << 24) | ((UINT32)opt[3] << 16) |
+			 ((UINT32)opt[4] << 8) | opt[5];
+	*tsecr = ((UINT32)opt[6] << 24) | ((UINT32)opt[7] << 16) |
+			 ((UINT32)opt[8] << 8) | opt[9];
+	
+	return(1);
+
+}
+
+/** \brief Add SACK blocks of received ACK to socket's scoreboard
+ *	\date 19.10.2026
+ *	\param soc pointer to socket structure we're working with
+ *	\param olen length of options stored in received_tcp_packet
+ *
+ *	\return Number of SACK blocks added
+ *
+ *	Blocks that don't lie between the oldest unacknowledged byte and
+ *	highest byte sent are ignored (this includes D-SACK blocks, RFC 2883).
+ */
+UINT8 tcp_sack_update (struct tcb* soc, UINT8 olen)
+{
+	UINT8* opt;
+	UINT8 len;
+	UINT8 j;
+	UINT32 start;
+	UINT32 end;
+	UINT8 added;
+	
+	added = 0;
+	
+	opt = tcp_findoption(TCP_OPTKIND_SACK, olen);
+	
+	if(opt == 0)
+		return(0);
+	
+	len = opt[1];
+	
+	for(j = 2; j + 8 <= len; j += 8) {
+		start = ((UINT32)opt[j] << 24) | ((UINT32)opt[j + 1] << 16) |
+				((UINT32)opt[j + 2] << 8) | opt[j + 3];
+		end = ((UINT32)opt[j + 4] << 24) | ((UINT32)opt[j + 5] << 16) |
+			  ((UINT32)opt[j + 6] << 8) | opt[j + 7];
 		
-			TCP_DEBUGOUT("ERROR:TCP State machine in unknown state!!\r\n");
-			
-			tcp_sendreset(&received_tcp_packet, frame->sip);
-			
-			RESET_SYSTEM();
+		if( ((INT32)(end - start) <= 0) ||
+			((INT32)(start - soc->send_unacked) <= 0) ||
+			((INT32)(end - soc->send_max) > 0) )
+			continue;
+		
+		tcp_sack_add(soc, start, end);
+		added++;
+	}
+	
+	return(added);
+
+}
+
+/** \brief Insert range of selectively acknowledged data to scoreboard
+ *	\date 19.10.2026
+ *	\param soc pointer to socket structure we're working with
+ *	\param start first sequence number of the range
+ *	\param end sequence number following the range
+ *
+ *	Overlapping and adjacent ranges are merged so that scoreboard stays
+ *	sorted and without overlaps. If scoreboard is full the highest range
+ *	is forgotten, which only makes the data above the remaining ranges
+ *	look not yet lost.
+ */
+void tcp_sack_add (struct tcb* soc, UINT32 start, UINT32 end)
+{
+	struct tcp_sackblock* b;
+	UINT8 i;
+	UINT8 k;
+	
+	b = soc->sacked;
+	i = 0;
+	
+	/* Absorb ranges touching the new one	*/
+	
+	while(i < soc->nsacked) {
+		if( ((INT32)(b[i].end - start) < 0) ||
+			((INT32)(end - b[i].start) < 0)		) {
+			i++;
+			continue;
+		}
+		
+		if( (INT32)(b[i].start - start) < 0 )
+			start = b[i].start;
+		
+		if( (INT32)(b[i].end - end) > 0 )
+			end = b[i].end;
+		
+		soc->nsacked--;
+		
+		for(k = i; k < soc->nsacked; k++)
+			b[k] = b[k + 1];
+	}
+	
+	/* Find place for the range	*/
+	
+	for(i = 0; i < soc->nsacked; i++)
+		if( (INT32)(b[i].start - start) > 0 )
+			break;
+	
+	if(soc->nsacked == TCP_SACK_BLOCKS) {
+		if(i == TCP_SACK_BLOCKS)
+			return;
+		
+		soc->nsacked--;
+	}
+	
+	for(k = soc->nsacked; k > i; k--)
+		b[k] = b[k - 1];
+	
+	b[i].start = start;
+	b[i].end = end;
+	soc->nsacked++;
+
+}
+
+/** \brief Remove cumulatively acknowledged data from scoreboard
+ *	\date 19.10.2026
+ *	\param soc pointer to socket structure we're working with
+ */
+void tcp_sack_trim (struct tcb* soc)
+{
+	UINT8 i;
+	UINT8 n;
+	
+	n = 0;
+	
+	for(i = 0; i < soc->nsacked; i++) {
+		if( (INT32)(soc->sacked[i].end - soc->send_unacked) <= 0 )
+			continue;
+		
+		soc->sacked[n] = soc->sacked[i];
+		
+		if( (INT32)(soc->sacked[n].start - soc->send_unacked) < 0 )
+			soc->sacked[n].start = soc->send_unacked;
+		
+		n++;
+	}
+	
+	soc->nsacked = n;
+
+}
+
+/** \brief Check if oldest unacknowledged data is lost
+ *	\date 19.10.2026
+ *	\param soc pointer to socket structure we're working with
+ *	\return
+ *		\li 0 - not known to be lost
+ *		\li 1 - lost
+ *
+ *	Data is considered lost when #TCP_DUPACK_THRESHOLD separate ranges
+ *	or more than #TCP_DUPACK_THRESHOLD - 1 segments after it are
+ *	selectively acknowledged (IsLost() of RFC 6675).
+ */
+UINT8 tcp_sack_lost (struct tcb* soc)
+{
+	UINT32 bytes;
+	UINT8 i;
+	
+	if(soc->nsacked >= TCP_DUPACK_THRESHOLD)
+		return(1);
+	
+	bytes = 0;
+	
+	for(i = 0; i < soc->nsacked; i++)
+		bytes += soc->sacked[i].end - soc->sacked[i].start;
+	
+	if( bytes > (UINT32)(TCP_DUPACK_THRESHOLD - 1) * (soc->send_mtu - MIN_TCP_HLEN) )
+		return(1);
+	
+	return(0);
+
+}
+
+/** \brief Find next hole to retransmit in fast recovery
+ *	\date 19.10.2026
+ *	\param soc pointer to socket structure we're working with
+ *	\param seq pointer to variable where first sequence number of the
+ *		hole is stored
+ *	\return Number of bytes to retransmit, 0 if there is no known hole
+ *
+ *	Data not selectively acknowledged but followed by selectively
+ *	acknowledged data is considered lost (RFC 6675, simplified). Holes
+ *	are retransmitted once per recovery, so search starts from the end
+ *	of data already retransmitted. Returned length is limited to one
+ *	segment.
+ */
+UINT16 tcp_sack_hole (struct tcb* soc, UINT32* seq)
+{
+	UINT32 s;
+	UINT32 len;
+	UINT8 i;
+	
+	s = soc->send_unacked;
+	
+	if( (INT32)(soc->rexmit_high - s) > 0 )
+		s = soc->rexmit_high;
+	
+	for(i = 0; i < soc->nsacked; i++) {
+	
+		/* Range below or around the search point?	*/
+		
+		if( (INT32)(soc->sacked[i].end - s) <= 0 )
+			continue;
+		
+		if( (INT32)(soc->sacked[i].start - s) <= 0 ) {
+			s = soc->sacked[i].end;
+			continue;
+		}
+		
+		len = soc->sacked[i].start - s;
+		
+		if(len > (UINT32)(soc->send_mtu - MIN_TCP_HLEN))
+			len = soc->send_mtu - MIN_TCP_HLEN;
+		
+		if(len > NETWORK_TX_BUFFER_SIZE - TCP_APP_OFFSET)
+			len = NETWORK_TX_BUFFER_SIZE - TCP_APP_OFFSET;
+		
+		*seq = s;
+		
+		return((UINT16)len);
+	}
+	
+	return(0);
+
+}
+
+/** \brief Initialize round-trip time estimation of a socket
+ *	\date 19.10.2026
+ *	\param soc pointer to socket structure we're working with
+ *
+ *	Invoked when a new connection is initiated, just before SYN packet
+ *	is sent. Retransmission time-out is set to its initial value
+ *	(#TCP_INIT_RETRY_TOUT) and measurement of round-trip time of the SYN
+ *	packet is started. Retransmission statistics are cleared as well.
+ */
+void tcp_rtt_init (struct tcb* soc)
+{
+	soc->flags &= ~(TCP_INTFLAGS_RTTVALID | TCP_INTFLAGS_RECOVERY);
+	soc->dupacks = 0;
+	soc->timeouts = 0;
+	soc->fast_retransmits = 0;
+	soc->rexmit_bytes = 0;
+	soc->flags |= TCP_INTFLAGS_RTTTIMING;
+	soc->rtt_time = clock_us();
+	soc->srtt = 0;
+	soc->rttvar = 0;
+	soc->rto = TCP_INIT_RETRY_TOUT*TIMERTIC;
+
+}
+
+/** \brief Update highest sent sequence number and start timing
+ *	\date 19.10.2026
+ *	\param soc pointer to socket structure we're working with
+ *	\param len number of data bytes just sent (send_next already
+ *		advanced)
+ *
+ *	Round-trip time is measured for one segment at a time. Measurement
+ *	is started only for segments carrying new data, because for
+ *	retransmitted segments it isn't known which transmission the
+ *	acknowledgment is for (Karn's algorithm).
+ */
+void tcp_rtt_sent (struct tcb* soc, UINT16 len)
+{
+	UINT8 newdata;
+	
+	if( (INT32)(soc->send_next - soc->send_max) <= 0 )
+		return;
+	
+	newdata = ( (INT32)(soc->send_next - len - soc->send_max) >= 0 );
+	
+	soc->send_max = soc->send_next;
+	
+	if( newdata == 0 )
+		return;
+	
+	if( soc->flags & TCP_INTFLAGS_RTTTIMING )
+		return;
+	
+	soc->flags |= TCP_INTFLAGS_RTTTIMING;
+	soc->rtt_seq = soc->send_next;
+	soc->rtt_time = clock_us();
+
+}
+
+/** \brief Take round-trip time sample of the timed segment
+ *	\date 19.10.2026
+ *	\param soc pointer to socket structure we're working with
+ *
+ *	Invoked when the timed segment is acknowledged. Time elapsed from
+ *	sending it to receiving the frame carrying the ACK (rx_time of
+ *	received_frame) is given to tcp_rtt_update(), so time spent queued
+ *	in the Ethernet controller isn't counted.
+ */
+void tcp_rtt_sample (struct tcb* soc)
+{
+	UINT32 r;
+	
+	soc->flags &= ~TCP_INTFLAGS_RTTTIMING;
+	
+	r = received_frame.rx_time - soc->rtt_time;
+	
+	/* Timing started while this frame was processed?	*/
+	
+	if( (INT32)r < 0 )
+		r = 0;
+	
+	tcp_rtt_update(soc, r);
+
+}
+
+/** \brief Calculate new retransmission time-out from round-trip time
+ *	\date 19.10.2026
+ *	\param soc pointer to socket structure we're working with
+ *	\param r round-trip time sample in microseconds
+ *
+ *	Smoothed round-trip time, its variation and retransmission time-out
+ *	are calculated as defined in RFC 6298. Timer granularity is one timer
+ *	tick (see #TIMERTIC).
+ */
+void tcp_rtt_update (struct tcb* soc, UINT32 r)
+{
+	UINT32 delta;
+	UINT32 rto;
+	
+	if( soc->flags & TCP_INTFLAGS_RTTVALID ) {
+		/* RTTVAR = 3/4 RTTVAR + 1/4 |SRTT - R|, SRTT = 7/8 SRTT + 1/8 R	*/
+		
+		if(soc->srtt > r)
+			delta = soc->srtt - r;
+		else
+			delta = r - soc->srtt;
+		
+		soc->rttvar = soc->rttvar - (soc->rttvar >> 2) + (delta >> 2);
+		soc->srtt = soc->srtt - (soc->srtt >> 3) + (r >> 3);
+	} else {
+		/* First measurement	*/
+		
+		soc->srtt = r;
+		soc->rttvar = r >> 1;
+		soc->flags |= TCP_INTFLAGS_RTTVALID;
+	}
+	
+	/* RTO = SRTT + max(G, 4*RTTVAR)	*/
 	
-	}
+	rto = soc->rttvar << 2;
 	
-	TCP_DEBUGOUT("Should not be there!\r\n");
+	if(rto < CLOCK_TICK_US)
+		rto = CLOCK_TICK_US;
 	
-	return(-1);
-		
-}
+	rto += soc->srtt;
+	
+	/* Convert to timer ticks. Add one since timer may expire up to	*/
+	/* one tick early												*/
+	
+	rto = rto / CLOCK_TICK_US + 1;
+	
+	if(rto < (TCP_MIN_RTO * (UINT32)TIMERTIC) / 1000)
+		rto = (TCP_MIN_RTO * (UINT32)TIMERTIC) / 1000;
+	
+	if(rto > (TCP_MAX_RTO * (UINT32)TIMERTIC) / 1000)
+		rto = (TCP_MAX_RTO * (UINT32)TIMERTIC) / 1000;
+	
+	soc->rto = (UINT16)rto;
 
+}
 
-/** \brief Create and send TCP packet
- * 	\author 
- *		\li Jari Lahti (jari.lahti@violasystems.com)
- *	\date 16.07.2002
- *	\param sockethandle handle to processed socket
- *	\param buf pointer to data buffer (where TCP header will be stored)
- *	\param blen buffer length in bytes
- *	\param dlen length of data in bytes
- *	\return 
- *		\li -1 - Error
- *		\li >0 - Packet OK
+/** \brief Back off retransmission time-out
+ *	\date 19.10.2026
+ *	\param soc pointer to socket structure we're working with
  *
- *	Based on data supplied as function parameters and data stored in 
- *	socket's tcb, TCP header is created in buffer, checksum is calculated
- *	and packet is forwarded to lower layers (IP).
+ *	Invoked on every retransmission time-out. Time-out is doubled (up to
+ *	#TCP_MAX_RTO) and kept so until new round-trip time sample is taken.
+ *	Measurement in progress is cancelled since the timed segment will be
+ *	retransmitted.
+ */
+void tcp_rtt_backoff (struct tcb* soc)
+{
+	soc->flags &= ~TCP_INTFLAGS_RTTTIMING;
+	
+	if(soc->rto >= (TCP_MAX_RTO * (UINT32)TIMERTIC) / 2000)
+		soc->rto = (TCP_MAX_RTO * (UINT32)TIMERTIC) / 1000;
+	else
+		soc->rto <<= 1;
+
+}
+
+/** \brief Ask application to regenerate unacknowledged data
+ *	\date 19.10.2026
+ *	\param sockethandle handle to socket
+ *	\return Value returned by application's event listener (<=0 if
+ *		application didn't send the data)
  *
+ *	All data in flight is considered lost and sending is restarted from
+ *	the oldest unacknowledged byte (go-back-N). Application is informed
+ *	with #TCP_EVENT_REGENERATE.
  */
-INT16 process_tcp_out (INT8 sockethandle, UINT8* buf, UINT16 blen, UINT16 dlen)
+INT32 tcp_regenerate (INT8 sockethandle)
 {
 	struct tcb* soc;
-	UINT16 cs;
-	UINT8 cs_cnt;
-	UINT16 i;
-	UINT8* buf_start;
-	
-	TCP_DEBUGOUT("Entering to send TCP packet\r\n");
+	UINT32 unacked;
+	UINT16 len;
+	UINT8 old_retries;
+	INT32 temp;
 	
-	if( sockethandle < 0 ) {
-		TCP_DEBUGOUT("ERROR:Socket Handle not valid (<0)\r\n");
-		return(-1);
-	}
+	soc = &tcp_socket[sockethandle];
 	
-	if( sockethandle > NO_OF_TCPSOCKETS ) {
-		TCP_DEBUGOUT("ERROR:Socket Handle not valid (>NO_OF_TCPSOCKETS)\r\n");
-		return(-1);
-	}
+	unacked = soc->send_next - soc->send_unacked;
+	len = (UINT16)unacked;
 	
-	if( (dlen + MIN_TCP_HLEN) > blen ) {
-		TCP_DEBUGOUT("ERROR:Transmit buffer too small for TCP header\r\n");
-		return(-1);
-	} 
+	if(len > soc->send_mtu - MIN_TCP_HLEN)
+		len = soc->send_mtu - MIN_TCP_HLEN;
 	
-	soc = &tcp_socket[sockethandle];				/* Get socket	*/
+	/* Rewind Send Next because the send process will adjust it			*/
+	/* So cheat the tcp_send to think there is no unacked data.			*/
+	/* All data in flight is sent again starting from the oldest		*/
+	/* unacknowledged byte (go-back-N)									*/
 	
-	buf_start = buf;
+	soc->send_next = soc->send_unacked;
 	
-	if( (dlen + MIN_TCP_HLEN) > soc->send_mtu ) {
-		TCP_DEBUGOUT("ERROR:Send MTU exceeded\r\n");
-		return(-1);
-	}
+	/* tcp_send will set the retiries_left to maximum but this is		*/
+	/* retransmitting already so we need to retain it in order to 		*/
+	/* avoid dead-lock													*/
 	
-	/* Assemble TCP header to buffer	*/
+	old_retries = soc->retries_left;
 	
-	*buf++ = (UINT8)(soc->locport >> 8);
-	*buf++ = (UINT8)soc->locport;
-	*buf++ = (UINT8)(soc->remport >> 8);
-	*buf++ = (UINT8)soc->remport;
-	*buf++ = (UINT8)(soc->send_unacked >>24);
-	*buf++ = (UINT8)(soc->send_unacked >>16);
-	*buf++ = (UINT8)(soc->send_unacked >>8);
-	*buf++ = (UINT8)(soc->send_unacked);
-	*buf++ = (UINT8)(soc->receive_next >>24);
-	*buf++ = (UINT8)(soc->receive_next >>16);
-	*buf++ = (UINT8)(soc->receive_next >>8);
-	*buf++ = (UINT8)(soc->receive_next);
-	*buf =	MIN_TCP_HLEN >> 2;
-	*buf <<= 4;
-	buf++;
-	*buf++ = soc->myflags;
-	*buf++ = (UINT8)(TCP_DEF_MTU >> 8);
-	*buf++ = (UINT8)TCP_DEF_MTU;
-	*buf++ = 0;								/* Checksum	*/
-	*buf++ = 0;
-	*buf++ = 0;								/* Urgent	*/
-	*buf++ = 0;
+	temp = soc->event_listener(sockethandle, TCP_EVENT_REGENERATE, (UINT32)len, unacked);
+
+	soc->retries_left = old_retries;
 	
-	 
-	/* Calculate checksum	*/
+	return(temp);
+
+}
+
+/** \brief Retransmit the oldest unacknowledged segment immediately
+ *	\date 19.10.2026
+ *	\param sockethandle handle to socket
+ *
+ *	Invoked when #TCP_DUPACK_THRESHOLD duplicate ACKs are received or when
+ *	a partial ACK is received during fast recovery. Sockets with a send
+ *	buffer retransmit just the missing segment and stay in fast recovery
+ *	until all data sent before the loss is acknowledged. If remote host
+ *	sends selective acknowledgments, the next hole in the scoreboard is
+ *	retransmitted instead of the oldest unacknowledged segment. Other sockets
+ *	can't resend a single segment so their application regenerates the
+ *	data just like on time-out, but retransmission time-out is not
+ *	backed off.
+ */
+void tcp_fastretransmit (INT8 sockethandle)
+{
+	struct tcb* soc;
+	UINT32 len;
+	UINT32 seq;
 	
-	cs = 0;
-	cs_cnt = 0;
+	soc = &tcp_socket[sockethandle];
 	
-	/* Do it firstly to IP pseudo header	*/
+	TCP_DEBUGOUT("Fast retransmit\r\n");
 	
-	cs = ip_checksum(cs, (UINT8)(localmachine.localip >> 24), cs_cnt++);	
-	cs = ip_checksum(cs, (UINT8)(localmachine.localip >> 16), cs_cnt++);
-	cs = ip_checksum(cs, (UINT8)(localmachine.localip >> 8), cs_cnt++);
-	cs = ip_checksum(cs, (UINT8)localmachine.localip, cs_cnt++);
+	soc->fast_retransmits++;
 	
-	cs = ip_checksum(cs, (UINT8)(soc->rem_ip >> 24), cs_cnt++);	
-	cs = ip_checksum(cs, (UINT8)(soc->rem_ip >> 16), cs_cnt++);
-	cs = ip_checksum(cs, (UINT8)(soc->rem_ip >> 8), cs_cnt++);
-	cs = ip_checksum(cs, (UINT8)soc->rem_ip, cs_cnt++);	
+	/* ACK of the timed segment would include the recovery	*/
 	
-	cs = ip_checksum(cs, 0, cs_cnt++);
+	soc->flags &= ~TCP_INTFLAGS_RTTTIMING;
 	
-	cs = ip_checksum(cs, (UINT8)IP_TCP, cs_cnt++);
+	if( (soc->sndbuf >= 0) || (soc->file >= 0) ) {
+		if( (soc->flags & TCP_INTFLAGS_RECOVERY) == 0 ) {
+			soc->flags |= TCP_INTFLAGS_RECOVERY;
+			soc->recover = soc->send_max;
+			soc->rexmit_high = soc->send_unacked;
+			tcp_cc_loss(soc, 0);
+		}
 		
-	cs = ip_checksum(cs, (UINT8)((dlen + MIN_TCP_HLEN) >> 8), cs_cnt++);
-	cs = ip_checksum(cs, (UINT8)(dlen + MIN_TCP_HLEN), cs_cnt++);
-	
-	/* Go to TCP header + data	*/
-	
-	buf = buf_start;
-	
-	cs = ip_checksum_buf(cs, buf, dlen + MIN_TCP_HLEN);
+		len = tcp_sack_hole(soc, &seq);
 		
-	cs = ~ cs;
+		/* Without SACK information resend the oldest segment unless	*/
+		/* it was resent already (NewReno)								*/
+		
+		if( (len == 0) && (soc->nsacked == 0) &&
+			((INT32)(soc->send_unacked - soc->rexmit_high) >= 0) ) {
+			seq = soc->send_unacked;
+			len = soc->send_max - seq;
+			
+			if(len > (UINT32)(soc->send_mtu - MIN_TCP_HLEN))
+				len = soc->send_mtu - MIN_TCP_HLEN;
+			
+			if(len > NETWORK_TX_BUFFER_SIZE - TCP_APP_OFFSET)
+				len = NETWORK_TX_BUFFER_SIZE - TCP_APP_OFFSET;
+		}
+		
+		if(len) {
+			tcp_sndbuf_xmit(sockethandle, (UINT16)(seq - soc->send_unacked), (UINT16)len);
+			soc->rexmit_high = seq + len;
+		}
+		
+		return;
+	}
+	
+	tcp_cc_loss(soc, 0);
+	tcp_regenerate(sockethandle);
 
-#if 0
-	/* Is the padding required?	*/
+}
+
+/** \brief Obtain a send buffer from send buffer pool
+ *	\date 19.10.2026
+ *	\return
+ *		\li -1 - no free send buffers
+ *		\li >=0 - handle to send buffer
+ *
+ *	Unlike timers, send buffers are optional so running out of them
+ *	isn't fatal. Socket simply stays without a buffer and its
+ *	application must regenerate the data.
+ */
+INT8 tcp_sndbuf_get (void)
+{
+#if TCP_NO_OF_SNDBUFS > 0
+	INT8 i;
 	
-	if(dlen & 0x01) {
-		TCP_DEBUGOUT("Padding required\r\n");
-		*buf = 0;
-		dlen++;
+	for(i=0; i < TCP_NO_OF_SNDBUFS; i++) {
+		if( tcp_sndbuf_pool[i].free == FALSE )
+			continue;
+		
+		tcp_sndbuf_pool[i].free = FALSE;
+		
+		return(i);
 	}
 #endif
+
+	return(-1);
+
+}
+
+/** \brief Release send buffer back to send buffer pool
+ *	\date 19.10.2026
+ *	\param nbr handle to send buffer being released
+ */
+void tcp_sndbuf_free (INT8 nbr)
+{
+#if TCP_NO_OF_SNDBUFS > 0
+	if( nbr < 0 )
+		return;
 	
-	/* Save checksum in correct place	*/
-	
-	buf = buf_start + 16;
-	*buf++ = (UINT8)(cs >> 8);
-	*buf = (UINT8)cs;
-	
-	/* Send it to IP	*/
+	if( nbr > (TCP_NO_OF_SNDBUFS-1) )
+		return;
 	
-	TCP_DEBUGOUT("Sending TCP...\r\n");
+	tcp_sndbuf_pool[nbr].free = TRUE;
+#endif
+
+}
+
+/** \brief Append data to socket's send buffer
+ *	\date 19.10.2026
+ *	\param soc pointer to socket structure we're working with
+ *	\param buf pointer to data
+ *	\param len number of bytes to append. Must fit to free space of
+ *		the buffer
+ *
+ *	Data is stored after the data already in the buffer, wrapping around
+ *	at the end of the buffer.
+ */
+void tcp_sndbuf_write (struct tcb* soc, UINT8* buf, UINT16 len)
+{
+#if TCP_NO_OF_SNDBUFS > 0
+	UINT8* dat;
+	UINT16 pos;
 	
-	process_ip_out(soc->rem_ip, IP_TCP, soc->tos, 100, buf_start, dlen + MIN_TCP_HLEN);
+	dat = tcp_sndbuf_pool[soc->sndbuf].data;
+	pos = soc->sndbuf_start + soc->sndbuf_len;
 	
-	TCP_DEBUGOUT("TCP packet sent\r\n");
+	if(pos >= TCP_SNDBUF_SIZE)
+		pos -= TCP_SNDBUF_SIZE;
 	
-	return(0);
+	soc->sndbuf_len += len;
 	
+	while(len--) {
+		dat[pos++] = *buf++;
+		
+		if(pos == TCP_SNDBUF_SIZE)
+			pos = 0;
+	}
+#endif
 
 }
 
-
-
-/** \brief Send a TCP control packet (no data)
- * 	\author 
- *		\li Jari Lahti (jari.lahti@violasystems.com)
- *	\date 17.07.2002
+/** \brief Send data from socket's send buffer
+ *	\date 19.10.2026
  *	\param sockethandle handle to socket
+ *	\return Number of data bytes sent
  *
- *	This function is used to initiate sending of a control (no data) TCP 
- *	packet. Important thing in these packets are the flags and sequence
- *	numbers they carry.
- *
+ *	Sends the data in send buffer, or the file being sent by
+ *	tcp_sendfile(), that wasn't sent yet (everything after send_next) as
+ *	long as it fits in the send window.
  */
-void tcp_sendcontrol (INT8 sockethandle)
+UINT16 tcp_sndbuf_output (INT8 sockethandle)
 {
-	UINT8 i;
-
+	UINT16 sent;
+#if (TCP_NO_OF_SNDBUFS > 0) || (TCP_NO_OF_REGIONS > 0)
+	struct tcb* soc;
+	UINT16 len;
+	UINT16 room;
+	UINT16 inflight;
+#endif
 	
-	TCP_DEBUGOUT("Entering to send TCP control packet\r\n");
+	sent = 0;
+
+#if (TCP_NO_OF_SNDBUFS > 0) || (TCP_NO_OF_REGIONS > 0)
+	soc = &tcp_socket[sockethandle];
 	
-	kick_WD();
+	if( (soc->sndbuf < 0) && (soc->file < 0) )
+		return(0);
 	
-	if( sockethandle < 0 ) {
-		TCP_DEBUGOUT("ERROR:Socket Handle not valid (<0)\r\n");
-		return;
+	for(;;) {
+		inflight = soc->send_next - soc->send_unacked;
+		
+		/* Anything not sent yet?	*/
+		
+		if(inflight >= soc->sndbuf_len) {
+			soc->coalesce &= ~TCP_COALESCE_FLUSH;
+			break;
+		}
+		
+		room = tcp_sendroom(soc);
+		
+		if(room == 0)
+			break;
+		
+		len = soc->sndbuf_len - inflight;
+		
+		if(len > room)
+			len = room;
+		
+		if(len > soc->send_mtu - MIN_TCP_HLEN)
+			len = soc->send_mtu - MIN_TCP_HLEN;
+		
+		if(len > NETWORK_TX_BUFFER_SIZE - TCP_APP_OFFSET)
+			len = NETWORK_TX_BUFFER_SIZE - TCP_APP_OFFSET;
+		
+		/* Never loop on empty segments	*/
+		
+		if(len == 0)
+			break;
+		
+		/* Wait for more data before sending a small segment?	*/
+		
+		if( (len < soc->send_mtu - MIN_TCP_HLEN) &&
+			(len < NETWORK_TX_BUFFER_SIZE - TCP_APP_OFFSET) &&
+			tcp_coalesce_hold(soc, inflight) )
+			break;
+		
+		soc->coalesce &= ~TCP_COALESCE_HELD;
+		
+		/* Start retransmission timer if this is the first packet in flight	*/
+		
+		if(inflight == 0)
+			init_timer(soc->retransmit_timerh, soc->rto);
+		
+		soc->send_next += len;
+		
+		tcp_sndbuf_xmit(sockethandle, inflight, len);
+		tcp_rtt_sent(soc, len);
+		
+		sent += len;
 	}
+#endif
+
+	return(sent);
+
+}
+
+/** \brief Decide whether small segment is held back
+ *	\date 19.10.2026
+ *	\param soc pointer to socket
+ *	\param inflight amount of data sent but not yet acknowledged
+ *	\return
+ *		\li 0 - send the segment now
+ *		\li 1 - hold the segment back and wait for more data
+ *
+ *	Invoked by tcp_sndbuf_output() when the segment it is about to send
+ *	is smaller than maximum segment size. Segment is held back if socket
+ *	is corked or if Nagle algorithm is enabled and there is unacknowledged
+ *	data. Held back data is flushed when the socket is uncorked or closed
+ *	and at the latest #TCP_FLUSH_TIME after it was first held back.
+ */
+UINT8 tcp_coalesce_hold (struct tcb* soc, UINT16 inflight)
+{
+	if(soc->coalesce & TCP_COALESCE_FLUSH)
+		return(0);
 	
-	if( sockethandle > NO_OF_TCPSOCKETS ) {
-		TCP_DEBUGOUT("ERROR:Socket Handle not valid (>NO_OF_TCPSOCKETS)\r\n");
-		return;
-	}
+	if( ((soc->coalesce & TCP_COALESCE_CORK) == 0) &&
+		(((soc->coalesce & TCP_COALESCE_NAGLE) == 0) || (inflight == 0)) )
+		return(0);
 	
-	process_tcp_out(sockethandle, &tcp_tempbuf[0], MIN_TCP_HLEN + 1, 0);
+	/* Start flush deadline when data is first held back. Socket	*/
+	/* is made ready by the timer when it's due					*/
 	
-	return;
+	if( (soc->coalesce & TCP_COALESCE_HELD) == 0 ) {
+		soc->coalesce |= TCP_COALESCE_HELD;
+		init_timer(soc->flush_timerh, (TCP_FLUSH_TIME * (UINT32)TIMERTIC + 999) / 1000);
+		return(1);
+	}
 	
+	if( check_timer(soc->flush_timerh) == 0 )
+		return(0);
 	
+	return(1);
+
 }
 
-/** \brief Send a reset (RST) packet to remote host
- * 	\author 
- *		\li Jari Lahti (jari.lahti@violasystems.com)
- *		\li Vladan Jovanovic (vladan.jovanovic@violasystems.com)
- *	\date 20.08.2002
- *	\param frame pointer to received TCP packet
- *	\param remip remote IP address of packet
+/** \brief Send one segment of data from socket's send buffer
+ *	\date 19.10.2026
+ *	\param sockethandle handle to socket
+ *	\param offset offset of the first byte from the oldest
+ *		unacknowledged byte
+ *	\param len number of bytes to send
  *
- *	Uses socket #NO_OF_TCPSOCKETS to send a RESET packet to peer. 
- *	This function is used when we are establishing connection but
- *	we receive something else than SYN or SYN+ACK when it's
- *	possible that the peer has still old connection on which
- *	needs to be resetted without canceling the connection establishment
- *	on process.
+ *	Data is sent straight from the buffer with the sequence number
+ *	corresponding to its place in the buffer, in two pieces if it wraps
+ *	around the end of the buffer. File being sent by tcp_sendfile() is
+ *	sent straight from its storage region. Used both for new data and
+ *	for retransmissions.
  */
-void tcp_sendreset (struct tcp_frame *frame, UINT32 remip)
+void tcp_sndbuf_xmit (INT8 sockethandle, UINT16 offset, UINT16 len)
 {
+#if (TCP_NO_OF_SNDBUFS > 0) || (TCP_NO_OF_REGIONS > 0)
 	struct tcb* soc;
+	struct ip_iovec iov[2];
+#if TCP_NO_OF_SNDBUFS > 0
+	UINT8* dat;
+	UINT16 pos;
+#endif
+	UINT32 next;
+	
+	soc = &tcp_socket[sockethandle];
+	
+	iov[0].len = len;
+	iov[1].len = 0;
+	
+#if TCP_NO_OF_REGIONS > 0
+	if(soc->file >= 0)
+		iov[0].data = tcp_region[soc->file].base + soc->file_pos + offset;
+#endif
 
-	soc = &tcp_socket[NO_OF_TCPSOCKETS];				/* Get socket	*/
-
-
-	/* Is this itself a reset packet?	*/
+#if TCP_NO_OF_SNDBUFS > 0
+	if(soc->file < 0) {
+		dat = tcp_sndbuf_pool[soc->sndbuf].data;
+		
+		/* Find the data in the ring buffer	*/
+		
+		pos = soc->sndbuf_start + offset;
+		
+		if(pos >= TCP_SNDBUF_SIZE)
+			pos -= TCP_SNDBUF_SIZE;
+		
+		iov[0].data = &dat[pos];
+		iov[1].data = &dat[0];
+		
+		if(len > TCP_SNDBUF_SIZE - pos) {
+			iov[0].len = TCP_SNDBUF_SIZE - pos;
+			iov[1].len = len - iov[0].len;
+		}
+	}
+#endif
+	
+	/* Count data that was sent before	*/
+	
+	next = soc->send_unacked + offset;
 	
-	if( frame->hlen_flags & TCP_FLAG_RESET )
-		return;
-
-	/* Set temporary tcb variables	*/
+	if( (INT32)(soc->send_max - next) > 0 )
+		soc->rexmit_bytes += ( (INT32)(soc->send_max - next) < (INT32)len ) ? soc->send_max - next : len;
 	
-	soc->rem_ip = remip;
-	soc->remport = frame->sport;
-	soc->locport = frame->dport;
-	soc->tos = 0;
+	/* tcp_sendseg takes sequence number from send_next	*/
 	
-	/* Does the packet have ACK flag set?	*/
+	next = soc->send_next;
+	soc->send_next = soc->send_unacked + offset + len;
 	
-	if( frame->hlen_flags & TCP_FLAG_ACK ) {
-		/* Jup, use it as our seq	*/
+	soc->myflags = TCP_FLAG_ACK | TCP_FLAG_PUSH;
+	tcp_sendseg(sockethandle, &tcp_tempbuf[0], TCP_APP_OFFSET, iov, iov[1].len ? 2 : 1);
+	
+	soc->send_next = next;
+#endif
+
+}
+
+/** \brief Obtain a reassembly buffer from reassembly buffer pool
+ *	\date 19.10.2026
+ *	\return
+ *		\li -1 - no free reassembly buffers
+ *		\li >=0 - handle to reassembly buffer
+ */
+INT8 tcp_reasm_get (void)
+{
+#if TCP_NO_OF_REASMBUFS > 0
+	INT8 i;
+	
+	for(i=0; i < TCP_NO_OF_REASMBUFS; i++) {
+		if( tcp_reasm_pool[i].free == FALSE )
+			continue;
 		
-		soc->send_unacked = frame->ackno;
-		soc->myflags = TCP_FLAG_RESET;	
-		soc->receive_next = frame->seqno;
-	} else {
-		soc->send_unacked = 0;
-		soc->myflags = TCP_FLAG_RESET | TCP_FLAG_ACK;	
-		soc->receive_next = frame->seqno+1;
-	}
+		tcp_reasm_pool[i].free = FALSE;
 		
+		return(i);
+	}
+#endif
+
+	return(-1);
+
+}
+
+/** \brief Release reassembly buffer back to reassembly buffer pool
+ *	\date 19.10.2026
+ *	\param nbr handle to reassembly buffer being released
+ */
+void tcp_reasm_free (INT8 nbr)
+{
+#if TCP_NO_OF_REASMBUFS > 0
+	if( nbr < 0 )
+		return;
 	
-	soc->send_mtu = TCP_DEF_MTU;
+	if( nbr > (TCP_NO_OF_REASMBUFS-1) )
+		return;
 	
-	tcp_sendcontrol(NO_OF_TCPSOCKETS);
+	tcp_reasm_pool[nbr].free = TRUE;
+#endif
 
 }
 
-
-/** \brief Get and return initial sequence number
- * 	\author 
- *		\li Jari Lahti (jari.lahti@violasystems.com)
- *	\date 17.07.2002
- *	\return UINT32 number containing initial sequence number to be used
- *
- *	This function returns initial sequence number to be used in a TCP 
- *	connection. For now, initial sequence number is selected based on
- *	base_timer value, which should be solid enough choice.
+/** \brief Forget out-of-order data of a socket
+ *	\date 19.10.2026
+ *	\param soc pointer to socket structure we're working with
  *
+ *	Reassembly buffer is returned to the pool.
  */
-UINT32 tcp_initseq (void)
+void tcp_reasm_clear (struct tcb* soc)
 {
-
-	TCP_DEBUGOUT("Calculating initial sequence number\r\n");
-	
-	return( ( (UINT32)base_timer << 24) | 0x00FFFFFF );
+	tcp_reasm_free(soc->reasm);
+	soc->reasm = -1;
+	soc->nreasm = 0;
 
 }
 
-/** \brief Try to match received TCP packet to a socket
- * 	\author 
- *		\li Jari Lahti (jari.lahti@violasystems.com)
- *	\date 12.07.2002
- *	\param ipframe pointer to received IP frame
- *	\param tcpframe pointer to received TCP frame to be mapped
+/** \brief Add range of out-of-order data to socket's list
+ *	\date 19.10.2026
+ *	\param soc pointer to socket structure we're working with
+ *	\param start first sequence number of the range
+ *	\param end sequence number following the range
  *	\return
- *		\li -1 - Error (no resources or no socket found)
- *		\li >=0 - Handle to mapped socket
- *
- *	Function iterates through socket table trying to find a socket for 
- *	whom this TCP packet is intended.
+ *		\li 0 - List is full, range not added
+ *		\li 1 - Range added
  *
+ *	Overlapping and adjacent ranges are merged into the new one, which
+ *	is put first in the list so that it is reported first in SACK option
+ *	(RFC 2018).
  */
-INT8 tcp_mapsocket (struct ip_frame* ipframe, struct tcp_frame* tcpframe)
+UINT8 tcp_reasm_add (struct tcb* soc, UINT32 start, UINT32 end)
 {
-	struct tcb* soc;
+	struct tcp_sackblock* b;
 	UINT8 i;
-
+	UINT8 k;
 	
-	/* Check if there is already connection on	*/
+	b = soc->reasm_blk;
+	i = 0;
 	
-	for( i=0; i < NO_OF_TCPSOCKETS; i++) {
-		soc = &tcp_socket[i];					/* Get socket	*/
+	/* Absorb ranges touching the new one	*/
+	
+	while(i < soc->nreasm) {
+		if( ((INT32)(b[i].end - start) < 0) ||
+			((INT32)(end - b[i].start) < 0)		) {
+			i++;
+			continue;
+		}
 		
-		if(soc->state == TCP_STATE_LISTENING)
-			continue;							/* No match		*/
-		if(soc->remport != tcpframe->sport)
-			continue;						
-		if(soc->locport != tcpframe->dport)
-			continue;						
-		if(soc->rem_ip != ipframe->sip)	
-			continue;						
+		if( (INT32)(b[i].start - start) < 0 )
+			start = b[i].start;
 		
-		/* There is connection on already	*/
+		if( (INT32)(b[i].end - end) > 0 )
+			end = b[i].end;
 		
-		TCP_DEBUGOUT("Active connection socket found\r\n");
+		soc->nreasm--;
 		
-		return(i);
+		for(k = i; k < soc->nreasm; k++)
+			b[k] = b[k + 1];
 	}
 	
-	/* Allocate listening one if SYN packet (Connection Request)	*/
+	if(soc->nreasm == TCP_SACK_BLOCKS)
+		return(0);
 	
-	TCP_DEBUGOUT("No active connection, checking if SYN packet\r\n");
+	for(k = soc->nreasm; k > 0; k--)
+		b[k] = b[k - 1];
 	
-	/* Is it SYN?	*/
+	b[0].start = start;
+	b[0].end = end;
+	soc->nreasm++;
 	
-	if( (tcpframe->hlen_flags & TCP_FLAG_SYN) == 0 )
-		return(-1);
-	if( tcpframe->hlen_flags & TCP_FLAG_ACK )
-		return(-1);
-	if( tcpframe->hlen_flags & TCP_FLAG_RESET )
-		return(-1);
-	if( tcpframe->hlen_flags & TCP_FLAG_FIN )
-		return(-1);
+	return(1);
+
+}
+
+/** \brief Store data of received out-of-order segment
+ *	\date 19.10.2026
+ *	\param soc pointer to socket structure we're working with
+ *	\param dlen length of data in received_tcp_packet
+ *
+ *	Invoked for segments starting after receive_next. Data is copied
+ *	from the Ethernet controller to socket's reassembly buffer, taking
+ *	one from the pool if socket doesn't have one yet. Only the part that
+ *	fits in the advertised window and in the buffer is kept. If there are
+ *	no free buffers or too many separate ranges, data is dropped and
+ *	remote host has to retransmit it.
+ */
+void tcp_reasm_store (struct tcb* soc, UINT16 dlen)
+{
+#if TCP_NO_OF_REASMBUFS > 0
+	UINT32 start;
+	UINT32 end;
+	UINT32 limit;
+	UINT8* dat;
+	UINT16 pos;
+	UINT16 len;
 	
-	TCP_DEBUGOUT("Trying to allocate listening one for SYN packet\r\n");
+	start = received_tcp_packet.seqno;
+	end = start + dlen;
 	
-	/* Search listening sockets	*/
+	limit = soc->receive_next + TCP_REASM_SIZE;
 	
-	for( i=0; i < NO_OF_TCPSOCKETS; i++) {
-		soc = &tcp_socket[i];				/* Get socket	*/
+	if( (INT32)(soc->rcv_adv - limit) < 0 )
+		limit = soc->rcv_adv;
 	
-		if(soc->state != TCP_STATE_LISTENING)
-			continue;	
+	if( (INT32)(end - limit) > 0 )
+		end = limit;
+	
+	if( (INT32)(end - start) <= 0 )
+		return;
+	
+	if(soc->reasm < 0) {
+		soc->reasm = tcp_reasm_get();
 		
-		if(soc->locport != tcpframe->dport)
+		if(soc->reasm < 0) {
+			TCP_DEBUGOUT("No free reassembly buffers, data dropped\r\n");
+			return;
+		}
+		
+		soc->reasm_seq = soc->receive_next;
+	}
+	
+	if( tcp_reasm_add(soc, start, end) == 0 ) {
+		TCP_DEBUGOUT("Too many out-of-order ranges, data dropped\r\n");
+		return;
+	}
+	
+	/* Copy data to buffer, wrapping around at the end	*/
+	
+	dat = tcp_reasm_pool[soc->reasm].data;
+	pos = (UINT16)((start - soc->reasm_seq) % TCP_REASM_SIZE);
+	len = (UINT16)(end - start);
+	
+	NETWORK_RECEIVE_INITIALIZE(received_tcp_packet.buf_index);
+	
+	if(len > TCP_REASM_SIZE - pos) {
+		RECEIVE_NETWORK_BUF(&dat[pos], TCP_REASM_SIZE - pos);
+		len -= TCP_REASM_SIZE - pos;
+		pos = 0;
+	}
+	
+	RECEIVE_NETWORK_BUF(&dat[pos], len);
+#endif
+
+}
+
+/** \brief Give stored out-of-order data to application
+ *	\date 19.10.2026
+ *	\param sochandle handle to socket
+ *
+ *	Invoked when receive_next has advanced. Data stored after
+ *	receive_next that is now in order is given to application with
+ *	#TCP_EVENT_DATA (see tcp_deliver()), in two parts if it wraps
+ *	around the end of the buffer. Application reads it with
+ *	RECEIVE_NETWORK_B() as usual (see NETWORK_RECEIVE_MEMORY()). Ranges
+ *	that are no longer needed are
+ *	forgotten and the buffer is released when it becomes empty.
+ */
+void tcp_reasm_deliver (INT8 sochandle)
+{
+#if TCP_NO_OF_REASMBUFS > 0
+	struct tcb* soc;
+	struct tcp_sackblock* b;
+	UINT32 end;
+	UINT16 pos;
+	UINT16 len;
+	UINT8 i;
+	UINT8 k;
+	
+	soc = &tcp_socket[sochandle];
+	b = soc->reasm_blk;
+	end = soc->receive_next;
+	
+	/* Take ranges reaching receive_next out of the list	*/
+	
+	i = 0;
+	
+	while(i < soc->nreasm) {
+		if( (INT32)(b[i].start - soc->receive_next) > 0 ) {
+			i++;
 			continue;
+		}
 		
-		/* Bind it	*/
+		if( (INT32)(b[i].end - end) > 0 )
+			end = b[i].end;
 		
-		soc->rem_ip = ipframe->sip;
-		soc->remport = tcpframe->sport;
+		soc->nreasm--;
 		
-		TCP_DEBUGOUT("Allocated new socket\r\n");
+		for(k = i; k < soc->nreasm; k++)
+			b[k] = b[k + 1];
+	}
+	
+	/* Application may close the socket while reading	*/
+	
+	while( (soc->reasm >= 0) && ((INT32)(end - soc->receive_next) > 0) ) {
+		pos = (UINT16)((soc->receive_next - soc->reasm_seq) % TCP_REASM_SIZE);
+		len = (UINT16)(end - soc->receive_next);
 		
-		return(i);
+		if(len > TCP_REASM_SIZE - pos)
+			len = TCP_REASM_SIZE - pos;
 		
+		NETWORK_RECEIVE_MEMORY(&tcp_reasm_pool[soc->reasm].data[pos]);
+		received_tcp_packet.buf_index = 0;
+		NETWORK_RECEIVE_INITIALIZE(0);
+		
+		tcp_deliver(sochandle, len);
+		
+		NETWORK_RECEIVE_MEMORY(0);
+		soc->receive_next += len;
 	}
 	
-	/* No success	*/
-	
-	TCP_DEBUGOUT("ERROR:No socket found or allocated for TCP packet\r\n");
+	if(soc->nreasm == 0)
+		tcp_reasm_clear(soc);
+#endif
+
+}
+
+/** \brief Obtain a receive buffer from receive buffer pool
+ *	\date 19.10.2026
+ *	\return
+ *		\li -1 - no free receive buffers
+ *		\li >=0 - handle to receive buffer
+ */
+INT8 tcp_rcvbuf_get (void)
+{
+#if TCP_NO_OF_RCVBUFS > 0
+	INT8 i;
 	
+	for(i=0; i < TCP_NO_OF_RCVBUFS; i++) {
+		if( tcp_rcvbuf_pool[i].free == FALSE )
+			continue;
+		
+		tcp_rcvbuf_pool[i].free = FALSE;
+		
+		return(i);
+	}
+#endif
+
 	return(-1);
 
 }
 
+/** \brief Release receive buffer back to receive buffer pool
+ *	\date 19.10.2026
+ *	\param nbr handle to receive buffer being released
+ */
+void tcp_rcvbuf_free (INT8 nbr)
+{
+#if TCP_NO_OF_RCVBUFS > 0
+	if( nbr < 0 )
+		return;
+	
+	if( nbr > (TCP_NO_OF_RCVBUFS-1) )
+		return;
+	
+	tcp_rcvbuf_pool[nbr].free = TRUE;
+#endif
 
-/** \brief Change TCP socket state and reinitialize timers
- * 	\author 
- *		\li Jari Lahti (jari.lahti@violasystems.com)
- *	\date 18.07.2002
- *	\param soc pointer to socket structure we're working with
- *	\param nstate new socket state
+}
+
+/** \brief Give in-order data to application
+ *	\date 19.10.2026
+ *	\param sochandle handle to socket the data was received on
+ *	\param len number of bytes at the current receive position
  *
- *	This function is used for every state-change that occurs in the TCP
- *	sockets so as to provide correct timers/retransmittions that ensure
- *	TCP connection is lasting.
+ *	Without a receive buffer application reads the data in
+ *	#TCP_EVENT_DATA. Socket that has a receive buffer stores the data
+ *	there and tells application how much it can read with tcp_recv().
+ *	Window remote host may fill never exceeds the free space in the
+ *	buffer, so the data always fits. Invoker advances receive_next.
  */
-void tcp_newstate (struct tcb* soc, UINT8 nstate)
+void tcp_deliver (INT8 sochandle, UINT16 len)
 {
-	soc->state = nstate;
-	soc->retries_left = TCP_DEF_RETRIES;
-
-	/* In some states we don't want to wait for many retries (e.g. TIMED_WAIT)	*/
+	struct tcb* soc;
+#if TCP_NO_OF_RCVBUFS > 0
+	UINT8* dat;
+	UINT16 pos;
+	UINT16 n;
+#endif
 	
-	switch(soc->state) {
-		case TCP_STATE_TIMED_WAIT:
-			soc->retries_left = 0;
-			break;
-		
-		case TCP_STATE_SYN_SENT:	
-			/* When we are sending SYN it's propably that ARP is not valid 	*/
-			/* Do retransmit faster on first time							*/
-			init_timer(soc->retransmit_timerh, TCP_INIT_RETRY_TOUT*TIMERTIC);
-			soc->retries_left = TCP_CON_ATTEMPTS;
-			break;
-
-		case TCP_STATE_LAST_ACK:
-		case TCP_STATE_FINW1:
-		case TCP_STATE_FINW2:
-		case TCP_STATE_CLOSING:
-			soc->retries_left = 1;
-			break;
-		
-		default:
-			break;
+	soc = &tcp_socket[sochandle];
 	
+	if(soc->rcvbuf < 0) {
+		soc->event_listener(sochandle, TCP_EVENT_DATA, len, 0);
+		return;
 	}
 	
+#if TCP_NO_OF_RCVBUFS > 0
+	if(len > TCP_RCVBUF_SIZE - soc->rcvbuf_len) {
+		TCP_DEBUGOUT("Data exceeds receive buffer\r\n");
+		len = TCP_RCVBUF_SIZE - soc->rcvbuf_len;
+	}
 	
-	/* KeepAlive timer	*/
-	if(soc->state == TCP_STATE_CONNECTED)
-		init_timer(soc->persist_timerh, soc->tout);
+	if(len == 0)
+		return;
 	
-	/* Retransmit timer	*/
+	dat = tcp_rcvbuf_pool[soc->rcvbuf].data;
+	pos = soc->rcvbuf_start + soc->rcvbuf_len;
 	
-	init_timer(soc->retransmit_timerh, TCP_DEF_RETRY_TOUT*TIMERTIC);
+	if(pos >= TCP_RCVBUF_SIZE)
+		pos -= TCP_RCVBUF_SIZE;
 	
-	return;
-
+	/* Store in two parts if data wraps around the end of buffer	*/
+	
+	n = TCP_RCVBUF_SIZE - pos;
+	
+	if(n > len)
+		n = len;
+	
+	RECEIVE_NETWORK_BUF(&dat[pos], n);
+	
+	if(len > n)
+		RECEIVE_NETWORK_BUF(dat, len - n);
+	
+	soc->rcvbuf_len += len;
+	soc->rcv_wnd = TCP_RCVBUF_SIZE - soc->rcvbuf_len;
+	
+	soc->event_listener(sochandle, TCP_EVENT_DATA, soc->rcvbuf_len, 0);
+#endif
 
 }
 
@@ -2506,46 +6510,54 @@ void tcp_newstate (struct tcb* soc, UINT8 nstate)
  *		\li >0 - free local TCP port number
  *
  *	Function attempts to find new local port number that can be used to 
- *	establish a connection. 
+ *	establish a connection. Search starts from a random port in range
+ *	#TCP_PORTS_START - #TCP_PORTS_END (RFC 6056 algorithm 1) so that
+ *	the port of the next connection can't be guessed. Ports are looked
+ *	up from tcp_portuse[] table instead of scanning all sockets and
+ *	because the table has more entries than there are sockets the
+ *	search ends after few steps at most.
  */
 UINT16 tcp_getfreeport (void)
 {
-	struct tcb* soc;
-	static UINT16 lastport = 1;
-	UINT16 start;
-	UINT16 i;
+	static UINT32 count = 0;
+	UINT32 port;
+	UINT8 i;
 	
-
-	/* Try with every port to every socket untill free found	*/
-		
-	for( start = lastport++; start != lastport; lastport++) {
-		if(lastport == TCP_PORTS_END)
-			lastport = 1;
-			
-		for(i = 0; i < NO_OF_TCPSOCKETS; i++) {
-			soc = &tcp_socket[i];					/* Get socket	*/
-			
-			if( (soc->state > TCP_STATE_CLOSED) && (soc->locport == lastport) ) {
-				/* Blaah, this socket has reserved the port, go to next one	*/
-				break; 
-			}
-			
-		}	
-			
-		/* Did we found it?	*/
-			
-		if( i == NO_OF_TCPSOCKETS)
-			break; 
-			
-	}
+	port = TCP_PORTS_START + mix32(clock_us() ^ ++count) % 
+			((UINT32)(TCP_PORTS_END - TCP_PORTS_START) + 1);
+	
+	for(i = 0; i < TCP_PORTMAP_SIZE; i++) {
+		if(tcp_portuse[(UINT16)port % TCP_PORTMAP_SIZE] == 0)
+			return((UINT16)port);
 		
-	if(lastport == start) {
-		TCP_DEBUGOUT("Out of TCP ports!!\n\r");
-		return(0);
+		if(port++ == TCP_PORTS_END)
+			port = TCP_PORTS_START;
 	}
+	
+	TCP_DEBUGOUT("Out of TCP ports!!\n\r");
+	return(0);
 		
-	return(lastport);
-		
+}
+
+/** \brief Set local port of a socket
+ *	\date 19.10.2026
+ *	\param soc pointer to socket
+ *	\param port new local port number, 0 for none
+ *
+ *	Changes local port of the socket and keeps tcp_portuse[] table
+ *	used by tcp_getfreeport() up to date. Must be used for all sockets
+ *	of the socket pool instead of assigning <i>locport</i> directly.
+ */
+void tcp_setlocport (struct tcb* soc, UINT16 port)
+{
+	if(soc->locport != 0)
+		tcp_portuse[soc->locport % TCP_PORTMAP_SIZE]--;
+	
+	if(port != 0)
+		tcp_portuse[port % TCP_PORTMAP_SIZE]++;
+	
+	soc->locport = port;
+
 }
 
 
@@ -2556,15 +6568,18 @@ UINT16 tcp_getfreeport (void)
  *	\date 16.07.2002
  *	\param ipframe pointer to IP frame that carried TCP message
  *	\param len length of TCP portion 
+ *	\param olen length of TCP options
  *	\return
  *		\li 0 - checksum corrupted
  *		\li 1 - checksum OK
  *
  *	Function recalculates TCP checksum (pseudoheader+header+data) and 
  *	compares it to received checksum to see if everything is OK or there 
- *	is a problem with the checksum.
+ *	is a problem with the checksum. Header must have been read to
+ *	tcp_tempbuf and options to received_tcp_packet already, the data
+ *	is read from the network.
  */
-UINT8 tcp_check_cs (struct ip_frame* ipframe, UINT16 len)
+UINT8 tcp_check_cs (struct ip_frame* ipframe, UINT16 len, UINT8 olen)
 {
 	UINT16 cs;
 	UINT8 cs_cnt;
@@ -2592,6 +6607,13 @@ UINT8 tcp_check_cs (struct ip_frame* ipframe, UINT16 len)
 	cs = ip_checksum(cs, (UINT8)(len >> 8), cs_cnt++);
 	cs = ip_checksum(cs, (UINT8)len, cs_cnt++);
 	
+	/* Header and options	*/
+	
+	cs = ip_checksum_buf(cs, tcp_tempbuf, MIN_TCP_HLEN);
+	cs = ip_checksum_buf(cs, received_tcp_packet.opt, olen);
+	len -= MIN_TCP_HLEN + olen;
+	cs_cnt += MIN_TCP_HLEN + olen;
+	
 	/* Go to TCP data	*/
 	while(len>15)
 	{		
@@ -0,0 +1,516 @@
+/*
+ *Copyright (c) 2000-2002 Viola Systems Ltd.
+ *All rights reserved.
+ *
+ *Redistribution and use in source and binary forms, with or without 
+ *modification, are permitted provided that the following conditions 
+ *are met:
+ *
+ *1. Redistributions of source code must retain the above copyright 
+ *notice, this list of conditions and the following disclaimer.
+ *
+ *2. Redistributions in binary form must reproduce the above copyright 
+ *notice, this list of conditions and the following disclaimer in the 
+ *documentation and/or other materials provided with the distribution.
+ *
+ *3. The end-user documentation included with the redistribution, if 
+ *any, must include the following acknowledgment:
+ *	"This product includes software developed by Viola 
+ *	Systems (http://www.violasystems.com/)."
+ *
+ *Alternately, this acknowledgment may appear in the software itself, 
+ *if and wherever such third-party acknowledgments normally appear.
+ *
+ *4. The names "OpenTCP" and "Viola Systems" must not be used to 
+ *endorse or promote products derived from this software without prior 
+ *written permission. For written permission, please contact 
+ *opentcp@opentcp.org.
+ *
+ *5. Products derived from this software may not be called "OpenTCP", 
+ *nor may "OpenTCP" appear in their name, without prior written 
+ *permission of the Viola Systems Ltd.
+ *
+ *THIS SOFTWARE IS PROVIDED "AS IS" AND ANY EXPRESSED OR IMPLIED 
+ *WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF 
+ *MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. 
+ *IN NO EVENT SHALL VIOLA SYSTEMS LTD. OR ITS CONTRIBUTORS BE LIABLE 
+ *FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR 
+ *CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF 
+ *SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR 
+ *BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, 
+ *WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE 
+ *OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, 
+ *EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ *====================================================================
+ *
+ *OpenTCP is the unified open source TCP/IP stack available on a series 
+ *of 8/16-bit microcontrollers, please see <http://www.opentcp.org>.
+ *
+ *For more information on how to network-enable your devices, or how to 
+ *obtain commercial technical support for OpenTCP, please see 
+ *<http://www.violasystems.com/>.
+ */
+
+/** \file tcp_cc.c
+ *	\brief OpenTCP TCP congestion control
+ *	\version 1.0
+ *	\date 19.10.2026
+ *	\bug
+ *	\warning
+ *	\todo
+ *
+ *	Congestion window (cwnd) limits how much data a TCP socket may have
+ *	in flight in addition to the window advertised by the remote host.
+ *	Slow start, fast recovery and reaction to retransmission time-out
+ *	(RFC 5681, RFC 6582) are common to all algorithms and implemented
+ *	here by the tcp_cc_xxx functions invoked from tcp.c. Growth of the
+ *	window in congestion avoidance and the reduction after a loss are
+ *	delegated to the algorithm selected for the socket in
+ *	tcp_getsocket(), see tcp_cc_ops.
+ *
+ *	Available algorithms are NewReno (#TCP_TYPE_CC_NEWRENO) and CUBIC
+ *	(#TCP_TYPE_CC_CUBIC).
+ */
+
+#include <inet/debug.h>
+#include <inet/datatypes.h>
+#include <inet/timers.h>
+#include <inet/tcp_ip.h>
+
+/** \brief NewReno congestion control algorithm
+ */
+struct tcp_cc_ops tcp_cc_newreno = {
+	tcp_newreno_init,
+	tcp_newreno_ack,
+	tcp_newreno_loss
+};
+
+/** \brief CUBIC congestion control algorithm
+ */
+struct tcp_cc_ops tcp_cc_cubic = {
+	tcp_cubic_init,
+	tcp_cubic_ack,
+	tcp_cubic_loss
+};
+
+
+/***********************************************************************/
+/*******	Common part											********/
+/***********************************************************************/
+
+/** \brief Find congestion control algorithm
+ *	\date 19.10.2026
+ *	\param type congestion control bits of socket type
+ *		(#TCP_TYPE_CC_NEWRENO, #TCP_TYPE_CC_CUBIC)
+ *	\return
+ *		\li 0 - no such algorithm
+ *		\li pointer to algorithm's tcp_cc_ops otherwise
+ */
+struct tcp_cc_ops* tcp_cc_select (UINT8 type)
+{
+	switch(type & TCP_TYPE_CC_MASK) {
+		case TCP_TYPE_CC_NEWRENO:
+			return(&tcp_cc_newreno);
+		
+		case TCP_TYPE_CC_CUBIC:
+			return(&tcp_cc_cubic);
+		
+		default:
+			return(0);
+	}
+
+}
+
+/** \brief Initialize congestion window of a new connection
+ *	\date 19.10.2026
+ *	\param soc pointer to socket structure we're working with
+ *
+ *	Invoked when connection gets established. Initial window is set
+ *	according to RFC 3390, slow start threshold is arbitrarily high so
+ *	slow start lasts until the first loss.
+ */
+void tcp_cc_init (struct tcb* soc)
+{
+	UINT32 mss;
+	
+	mss = soc->send_mtu - MIN_TCP_HLEN;
+	
+	soc->cwnd = 4380;
+	
+	if(soc->cwnd < 2 * mss)
+		soc->cwnd = 2 * mss;
+	
+	if(soc->cwnd > 4 * mss)
+		soc->cwnd = 4 * mss;
+	
+	soc->ssthresh = 0xFFFFFFFFL;
+	
+	soc->cc->init(soc);
+
+}
+
+/** \brief Grow congestion window on acknowledgment of new data
+ *	\date 19.10.2026
+ *	\param soc pointer to socket structure we're working with
+ *	\param acked number of newly acknowledged bytes
+ *
+ *	In slow start window grows by the number of acknowledged bytes, but
+ *	at most one segment per ACK (RFC 5681). In congestion avoidance
+ *	socket's algorithm decides. During fast recovery acknowledged data
+ *	is no longer in flight so the window is deflated by that amount
+ *	(partial ACK, RFC 6582).
+ */
+void tcp_cc_ack (struct tcb* soc, UINT32 acked)
+{
+	UINT32 mss;
+	
+	mss = soc->send_mtu - MIN_TCP_HLEN;
+	
+	if(soc->flags & TCP_INTFLAGS_RECOVERY) {
+		if(soc->cwnd > acked)
+			soc->cwnd -= acked;
+		else
+			soc->cwnd = 0;
+		
+		if(acked >= mss)
+			soc->cwnd += mss;
+		
+		if(soc->cwnd < mss)
+			soc->cwnd = mss;
+		
+		return;
+	}
+	
+	if(soc->cwnd < soc->ssthresh) {
+		if(acked > mss)
+			acked = mss;
+		
+		soc->cwnd += acked;
+	} else
+		soc->cc->ack(soc, acked);
+	
+	if(soc->cwnd > TCP_CC_MAX_CWND)
+		soc->cwnd = TCP_CC_MAX_CWND;
+
+}
+
+/** \brief Inflate congestion window on duplicate ACK
+ *	\date 19.10.2026
+ *	\param soc pointer to socket structure we're working with
+ *
+ *	Every duplicate ACK received during fast recovery tells that one more
+ *	segment has left the network, so one new segment may be sent.
+ */
+void tcp_cc_dupack (struct tcb* soc)
+{
+	if( (soc->flags & TCP_INTFLAGS_RECOVERY) == 0 )
+		return;
+	
+	soc->cwnd += soc->send_mtu - MIN_TCP_HLEN;
+	
+	if(soc->cwnd > TCP_CC_MAX_CWND)
+		soc->cwnd = TCP_CC_MAX_CWND;
+
+}
+
+/** \brief Reduce congestion window after a loss
+ *	\date 19.10.2026
+ *	\param soc pointer to socket structure we're working with
+ *	\param timeout non-zero if loss was detected by retransmission
+ *		time-out, zero for fast retransmit
+ *
+ *	Socket's algorithm sets the new slow start threshold. After time-out
+ *	sending starts again from one segment in slow start. After fast
+ *	retransmit window is set to the threshold, inflated by the segments
+ *	that triggered it if socket entered fast recovery.
+ */
+void tcp_cc_loss (struct tcb* soc, UINT8 timeout)
+{
+	UINT32 mss;
+	
+	mss = soc->send_mtu - MIN_TCP_HLEN;
+	
+	soc->cc->loss(soc);
+	
+	if(timeout) {
+		soc->cwnd = mss;
+		return;
+	}
+	
+	soc->cwnd = soc->ssthresh;
+	
+	if(soc->flags & TCP_INTFLAGS_RECOVERY)
+		soc->cwnd += TCP_DUPACK_THRESHOLD * mss;
+
+}
+
+/** \brief Deflate congestion window when fast recovery ends
+ *	\date 19.10.2026
+ *	\param soc pointer to socket structure we're working with
+ *
+ *	Window is set to slow start threshold, but not more than one segment
+ *	above the amount of data still in flight so that no burst of
+ *	segments is sent (RFC 6582).
+ */
+void tcp_cc_recovered (struct tcb* soc)
+{
+	UINT32 mss;
+	UINT32 flight;
+	
+	mss = soc->send_mtu - MIN_TCP_HLEN;
+	flight = soc->send_max - soc->send_unacked;
+	
+	if(flight < mss)
+		flight = mss;
+	
+	soc->cwnd = soc->ssthresh;
+	
+	if(soc->cwnd > flight + mss)
+		soc->cwnd = flight + mss;
+
+}
+
+
+/***********************************************************************/
+/*******	NewReno												********/
+/***********************************************************************/
+
+/** \brief Initialize NewReno state of a socket
+ *	\date 19.10.2026
+ *	\param soc pointer to socket structure we're working with
+ *
+ *	NewReno has no state of its own.
+ */
+void tcp_newreno_init (struct tcb* soc)
+{
+	/* Nothing to do	*/
+
+}
+
+/** \brief NewReno congestion avoidance
+ *	\date 19.10.2026
+ *	\param soc pointer to socket structure we're working with
+ *	\param acked number of newly acknowledged bytes
+ *
+ *	Window grows by approximately one segment per round-trip time.
+ */
+void tcp_newreno_ack (struct tcb* soc, UINT32 acked)
+{
+	UINT32 mss;
+	UINT32 inc;
+	
+	mss = soc->send_mtu - MIN_TCP_HLEN;
+	
+	inc = mss * mss / soc->cwnd;
+	
+	if(inc == 0)
+		inc = 1;
+	
+	soc->cwnd += inc;
+
+}
+
+/** \brief NewReno reaction to loss
+ *	\date 19.10.2026
+ *	\param soc pointer to socket structure we're working with
+ *
+ *	Slow start threshold is set to half of the data in flight, but to
+ *	at least two segments.
+ */
+void tcp_newreno_loss (struct tcb* soc)
+{
+	UINT32 mss;
+	UINT32 flight;
+	
+	mss = soc->send_mtu - MIN_TCP_HLEN;
+	flight = soc->send_max - soc->send_unacked;
+	
+	soc->ssthresh = flight / 2;
+	
+	if(soc->ssthresh < 2 * mss)
+		soc->ssthresh = 2 * mss;
+
+}
+
+
+/***********************************************************************/
+/*******	CUBIC												********/
+/***********************************************************************/
+
+/** \brief Initialize CUBIC state of a socket
+ *	\date 19.10.2026
+ *	\param soc pointer to socket structure we're working with
+ */
+void tcp_cubic_init (struct tcb* soc)
+{
+	struct tcp_cubic* cu;
+	
+	cu = &soc->ccdata.cubic;
+	
+	cu->w_max = 0;
+	cu->w_est = 0;
+	cu->origin = 0;
+	cu->epoch = 0;
+	cu->k = 0;
+	cu->valid = 0;
+
+}
+
+/** \brief CUBIC congestion avoidance
+ *	\date 19.10.2026
+ *	\param soc pointer to socket structure we're working with
+ *	\param acked number of newly acknowledged bytes
+ *
+ *	Window follows the cubic function W(t) = C*(t-K)^3 + Wmax (RFC 8312)
+ *	where t is time since the last loss and C = 0.4. Time is counted in
+ *	hundredths of second and all arithmetic is done in 32-bit integers,
+ *	so t-K is limited to 10 seconds. Window never grows slower than
+ *	NewReno window would (TCP-friendly region).
+ */
+void tcp_cubic_ack (struct tcb* soc, UINT32 acked)
+{
+	struct tcp_cubic* cu;
+	UINT32 mss;
+	UINT32 t;
+	UINT32 d;
+	UINT32 off;
+	UINT32 target;
+	UINT32 inc;
+	
+	cu = &soc->ccdata.cubic;
+	mss = soc->send_mtu - MIN_TCP_HLEN;
+	
+	/* First ACK in congestion avoidance starts a new epoch	*/
+	
+	if(cu->valid == 0) {
+		cu->valid = 1;
+		cu->epoch = clock_us();
+		cu->w_est = soc->cwnd;
+		
+		if(soc->cwnd < cu->w_max) {
+			/* K = cubic root((Wmax - cwnd) / C), d is in hundredths	*/
+			/* of segment and K in hundredths of second				*/
+			
+			d = (cu->w_max - soc->cwnd) * 100 / mss;
+			
+			if(d > 100000)
+				d = 100000;
+			
+			cu->k = tcp_cubic_cbrt(d * 25000);
+			cu->origin = cu->w_max;
+		} else {
+			cu->k = 0;
+			cu->origin = soc->cwnd;
+		}
+	}
+	
+	/* Target is the window one round-trip time from now	*/
+	
+	t = (clock_us() - cu->epoch + soc->srtt) / 10000;
+	
+	if(t > cu->k)
+		d = t - cu->k;
+	else
+		d = cu->k - t;
+	
+	if(d > 1000)
+		d = 1000;
+	
+	/* C * d^3 segments, d^3 / 2500 is that in thousandths	*/
+	
+	off = d * d * d / 2500;
+	off = off * mss / 1000;
+	
+	if(t > cu->k)
+		target = cu->origin + off;
+	else if(cu->origin > off)
+		target = cu->origin - off;
+	else
+		target = 0;
+	
+	/* Approach the target during one round-trip time, but grow	*/
+	/* at most 1.5 times per round-trip time					*/
+	
+	if(target > soc->cwnd) {
+		inc = (target - soc->cwnd) * mss / soc->cwnd;
+		
+		if(inc > mss / 2)
+			inc = mss / 2;
+		
+		soc->cwnd += inc;
+	}
+	
+	/* NewReno with CUBIC's decrease factor would grow by		*/
+	/* 3 * (1 - 0.7) / (1 + 0.7) = 17/32 segments per round-trip	*/
+	
+	cu->w_est += acked * mss * 17 / 32 / soc->cwnd;
+	
+	if(cu->w_est > soc->cwnd)
+		soc->cwnd = cu->w_est;
+
+}
+
+/** \brief CUBIC reaction to loss
+ *	\date 19.10.2026
+ *	\param soc pointer to socket structure we're working with
+ *
+ *	Window is reduced by factor 0.7. If the loss happened before the
+ *	window reached the previous maximum Wmax is lowered further to
+ *	release bandwidth for new flows (fast convergence).
+ */
+void tcp_cubic_loss (struct tcb* soc)
+{
+	struct tcp_cubic* cu;
+	UINT32 mss;
+	UINT32 w;
+	
+	cu = &soc->ccdata.cubic;
+	mss = soc->send_mtu - MIN_TCP_HLEN;
+	
+	/* Use data in flight if application didn't fill the window	*/
+	
+	w = soc->send_max - soc->send_unacked;
+	
+	if(w > soc->cwnd)
+		w = soc->cwnd;
+	
+	if(w < cu->w_max)
+		cu->w_max = w * 17 / 20;
+	else
+		cu->w_max = w;
+	
+	cu->valid = 0;
+	
+	soc->ssthresh = w * 7 / 10;
+	
+	if(soc->ssthresh < 2 * mss)
+		soc->ssthresh = 2 * mss;
+
+}
+
+/** \brief Integer cube root
+ *	\date 19.10.2026
+ *	\param x value whose cube root is calculated
+ *	\return Cube root of x rounded down
+ */
+UINT16 tcp_cubic_cbrt (UINT32 x)
+{
+	UINT32 y;
+	UINT32 b;
+	INT8 s;
+	
+	y = 0;
+	
+	for(s = 30; s >= 0; s -= 3) {
+		y <<= 1;
+		b = 3 * y * (y + 1) + 1;
+		
+		if( (x >> s) >= b ) {
+			x -= b << s;
+			y++;
+		}
+	}
+	
+	return((UINT16)y);
+
+}
@@ -87,8 +87,24 @@ struct
 {
 	UINT32 value;
 	UINT8 free;
+	void (*expired)(UINT8);		/**< Invoked when value reaches zero */
+	UINT8 arg;					/**< Argument given to expired()	 */
 } timer_pool[NUMTIMERS];
 
+/** \brief Number of timer ticks since timer pool initialization
+ *
+ *	Incremented by decrement_timers() and used as the coarse part of the
+ *	monotonic clock. See clock_get() for details.
+ */
+volatile UINT32 clock_ticks;
+
+/** \brief Last value returned by the monotonic clock
+ *
+ *	Used to keep the clock monotonic in case it is read with interrupts
+ *	disabled just after the hardware counter has reloaded.
+ */
+struct clock_time clock_last;
+
 /** \brief Initialize timer pool
  *	\ingroup core_initializer
  * 	\author 
@@ -109,9 +125,14 @@ void timer_pool_init (void)
 	for( i=0; i < NUMTIMERS; i++) {
 		timer_pool[i].value = 0;
 		timer_pool[i].free = TRUE;
-		
+		timer_pool[i].expired = 0;
+
 	}
-		
+
+	clock_ticks = 0;
+	clock_last.hi = 0;
+	clock_last.lo = 0;
+
 
 }
 
@@ -141,6 +162,7 @@ UINT8 get_timer (void)
 			/* Mark is reserved		  */
 			
 			timer_pool[i].free = FALSE;
+			timer_pool[i].expired = 0;
 			first_match = i;
 			return first_match;		/* Return Handle	*/
 		}
@@ -238,6 +260,35 @@ UINT32 check_timer (UINT8 nbr)
 }
 
 
+/** \brief Set function to be invoked when timer expires
+ *	\date 19.10.2026
+ *	\param nbr handle of timer
+ *	\param fn function invoked with <i>arg</i> when the timer value is
+ *		decremented to zero, or 0 for none
+ *	\param arg value passed to <i>fn</i>
+ *	\warning
+ *		\li <i>fn</i> is invoked from decrement_timers(), that is, from
+ *		timer interrupt. It must be short and must not enable interrupts.
+ *
+ *	Lets a module react on its timers expiring instead of checking them
+ *	with check_timer() all the time. Timer initialized to zero with
+ *	init_timer() doesn't invoke the function.
+ */
+void notify_timer (UINT8 nbr, void (*fn)(UINT8), UINT8 arg)
+{
+	if( nbr > (NUMTIMERS-1) ) 
+		return; 
+
+	OS_EnterCritical();
+	
+	timer_pool[nbr].expired = fn;
+	timer_pool[nbr].arg = arg;
+	
+	OS_ExitCritical();
+
+}
+
+
 /** \brief Decrement all timers' values by one
  * 	\author 
  *		\li Vladan Jovanovic (vladan.jovanovic@violasystems.com)
@@ -252,7 +303,124 @@ void decrement_timers (void)
 	/* Go Through Timers */
 	
 	for( i=0; i<NUMTIMERS; i++ ) {
-		if( (timer_pool[i].free == FALSE) && (timer_pool[i].value != 0))
+		if( (timer_pool[i].free == FALSE) && (timer_pool[i].value != 0)) {
 			timer_pool[i].value --;
+			
+			if( (timer_pool[i].value == 0) && (timer_pool[i].expired != 0) )
+				timer_pool[i].expired(timer_pool[i].arg);
+		}
+	}
+
+	clock_ticks++;
+}
+
+
+/** \brief Read 64-bit monotonic microsecond clock
+ *	\date 19.10.2026
+ *	\param t pointer to structure where current time is stored
+ *
+ *	Invoke this function to get the number of microseconds elapsed since
+ *	timer_pool_init() was invoked. The value is built from the number of
+ *	timer ticks counted by decrement_timers() and the time elapsed since
+ *	the last tick, as returned by architecture specific
+ *	#CLOCK_SUBTICK_US() macro.
+ *
+ *	Returned values never decrease. If only time differences are needed
+ *	use clock_us() instead.
+ */
+void clock_get (struct clock_time* t)
+{
+	UINT32 ticks;
+	UINT32 sub;
+	UINT32 part;
+
+	/* Read tick count and hardware counter consistently. If tick	*/
+	/* interrupt occured in between just read them again			*/
+
+	do {
+		ticks = clock_ticks;
+		sub = CLOCK_SUBTICK_US();
+	} while( ticks != clock_ticks );
+
+	/* ticks * CLOCK_TICK_US + sub, calculated in 16-bit halves so	*/
+	/* that no intermediate result overflows 32 bits				*/
+
+	t->lo = (ticks & 0xFFFF) * CLOCK_TICK_US;
+	part = (ticks >> 16) * CLOCK_TICK_US;
+	t->hi = part >> 16;
+
+	part <<= 16;
+	t->lo += part;
+	if( t->lo < part )
+		t->hi++;
+
+	t->lo += sub;
+	if( t->lo < sub )
+		t->hi++;
+
+	/* Don't let time go backwards	*/
+
+	if( (t->hi < clock_last.hi) ||
+		((t->hi == clock_last.hi) && (t->lo < clock_last.lo)) ) {
+		*t = clock_last;
+		return;
 	}
+
+	clock_last = *t;
+
+}
+
+
+/** \brief Return lower 32 bits of the monotonic microsecond clock
+ *	\date 19.10.2026
+ *	\return Number of microseconds since timer pool initialization,
+ *		modulo 2^32
+ *
+ *	Lower part of the clock wraps around approximately every 71 minutes
+ *	so use it for measuring time differences (round-trip times, latencies)
+ *	only. Differences are calculated as <i>(UINT32)(later - earlier)</i>
+ *	which gives correct result even if the clock wrapped around in
+ *	between.
+ */
+UINT32 clock_us (void)
+{
+	struct clock_time t;
+
+	clock_get(&t);
+
+	return t.lo;
+}
+
+
+/** \brief Return the monotonic clock in milliseconds
+ *	\date 19.10.2026
+ *	\return Number of milliseconds since timer pool initialization,
+ *		modulo 2^32
+ *
+ *	Unlike clock_us(), this value wraps around only after about 49 days
+ *	and increases steadily over the wrap of the microsecond clock, so it
+ *	is suitable for protocol timestamps. Calculated by dividing the
+ *	64-bit microsecond count by 1000 in 16-bit steps.
+ */
+UINT32 clock_ms (void)
+{
+	struct clock_time t;
+	UINT32 r;
+	UINT32 q1;
+	UINT32 q0;
+
+	clock_get(&t);
+
+	/* Upper part of quotient would fall outside 32 bits	*/
+
+	r = t.hi % 1000;
+
+	r = (r << 16) | (t.lo >> 16);
+	q1 = r / 1000;
+	r = r % 1000;
+
+	r = (r << 16) | (t.lo & 0xFFFF);
+	q0 = r / 1000;
+
+	return (q1 << 16) + q0;
 }
@@ -76,6 +76,7 @@
 
 #include <inet/debug.h>
 #include <inet/datatypes.h>
+#include <inet/timers.h>
 #include <inet/ethernet.h>
 #include <inet/ip.h>
 #include <inet/tcp_ip.h>
@@ -93,6 +94,13 @@
  */
 struct ucb udp_socket[NO_OF_UDPSOCKETS];
 
+/** \brief Local port use table
+ *
+ *	Entry <i>p % #UDP_PORTMAP_SIZE</i> counts the sockets that have local
+ *	port <i>p</i>. Kept up to date by udp_setlocport().
+ */
+UINT8 udp_portuse[UDP_PORTMAP_SIZE];
+
 /**	\brief Used for storing field information about the received UDP packet
  *	
  *	Various fields from the received UDP packet are stored in this variable.
@@ -128,6 +136,9 @@ INT8 udp_init (void)
 	
 	UDP_DEBUGOUT("Initializing UDP");
 	
+	for(i=0; i < UDP_PORTMAP_SIZE; i++)
+		udp_portuse[i] = 0;
+	
 	for(i=0; i < NO_OF_UDPSOCKETS; i++) {
 		soc = &udp_socket[i];			/* Get Socket	*/
 		
@@ -201,7 +212,7 @@ INT8 udp_getsocket (UINT8 tos, INT32 (*listener)(INT8, UINT8, UINT32, UINT16, UI
 			
 			soc->state = UDP_STATE_CLOSED;
 			soc->tos = tos;
-			soc->locport = 0;
+			udp_setlocport(soc, 0);
 			
 			soc->opts = 0;
 			
@@ -265,7 +276,7 @@ INT8 udp_releasesocket (INT8 sochandle)
 	
 	soc->state = UDP_STATE_FREE;
 	soc->tos = 0;
-	soc->locport = 0;
+	udp_setlocport(soc, 0);
 	soc->opts = UDP_OPT_SEND_CS | UDP_OPT_CHECK_CS;	
 	soc->event_listener = 0;
 
@@ -310,13 +321,15 @@ INT8 udp_open (INT8 sochandle, UINT16 locport)
 	
 	if(locport == 0) {
 		locport=udp_getfreeport();
-		return(-1);
+		
+		if(locport == 0)
+			return(-1);
 	}
 	
 	soc = &udp_socket[sochandle];		/* Get referense	*/
 
 	soc->state = UDP_STATE_OPENED;
-	soc->locport = locport;
+	udp_setlocport(soc, locport);
 	
 	return(sochandle);
 
@@ -676,48 +689,52 @@ INT16 process_udp_in(struct ip_frame* frame, UINT16 len)
  *	\date 19.10.2002
  *	\return 
  *		\li 0 - no free ports!
- *		\li >0 - free local TCP port number
+ *		\li >0 - free local UDP port number
  *
  *	Function attempts to find new local port number that can be used to 
- *	establish a connection. 
+ *	establish a connection. Works like tcp_getfreeport(), starting from
+ *	a random port in range #UDP_PORTS_START - #UDP_PORTS_END and using
+ *	udp_portuse[] table to skip ports already in use.
  */
 UINT16 udp_getfreeport (void){
-	struct ucb* soc;
-	static UINT16 lastport = 1;
-	UINT16 start;
-	UINT16 i;
+	static UINT32 count = 0;
+	UINT32 port;
+	UINT8 i;
 	
-
-	/* Try with every port to every socket untill free found	*/
-		
-	for( start = lastport++; start != lastport; lastport++)	{
-		if(lastport == UDP_PORTS_END)
-			lastport = 1;
-			
-		for(i = 0; i < NO_OF_UDPSOCKETS; i++) {
-			soc = &udp_socket[i];					/* Get socket	*/
-			
-			if( (soc->state > UDP_STATE_CLOSED) && (soc->locport == lastport) )			{
-				/* Blaah, this socket has reserved the port, go to next one	*/
-				break; 
-			}
-			
-		}	
-			
-		/* Did we found it?	*/
-			
-		if( i == NO_OF_UDPSOCKETS)
-			break; 
-			
-	}
+	port = UDP_PORTS_START + mix32(clock_us() ^ ++count) % 
+			((UINT32)(UDP_PORTS_END - UDP_PORTS_START) + 1);
+	
+	for(i = 0; i < UDP_PORTMAP_SIZE; i++) {
+		if(udp_portuse[(UINT16)port % UDP_PORTMAP_SIZE] == 0)
+			return((UINT16)port);
 		
-	if(lastport == start) {
-		DEBUGOUT("Out of UDP ports!!\n\r");
-		return(0);
+		if(port++ == UDP_PORTS_END)
+			port = UDP_PORTS_START;
 	}
+	
+	DEBUGOUT("Out of UDP ports!!\n\r");
+	return(0);
 		
-	return(lastport);
-		
+}
+
+/** \brief Set local port of a socket
+ *	\date 19.10.2026
+ *	\param soc pointer to socket
+ *	\param port new local port number, 0 for none
+ *
+ *	Changes local port of the socket and keeps udp_portuse[] table
+ *	used by udp_getfreeport() up to date.
+ */
+void udp_setlocport (struct ucb* soc, UINT16 port)
+{
+	if(soc->locport != 0)
+		udp_portuse[soc->locport % UDP_PORTMAP_SIZE]--;
+	
+	if(port != 0)
+		udp_portuse[port % UDP_PORTMAP_SIZE]++;
+	
+	soc->locport = port;
+
 }
 
 